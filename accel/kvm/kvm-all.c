@@ -22,6 +22,7 @@
 #include "qemu/atomic.h"
 #include "qemu/option.h"
 #include "qemu/config-file.h"
+#include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "hw/hw.h"
@@ -82,6 +83,8 @@ struct KVMState
     int vcpu_events;
     int robust_singlestep;
     int debugregs;
+    /* Per-VM halt-polling limit in ns, -1 if left at the host default */
+    int64_t halt_poll_ns;
 #ifdef KVM_CAP_SET_GUEST_DEBUG
     struct kvm_sw_breakpoint_head kvm_sw_breakpoints;
 #endif
@@ -1239,6 +1242,77 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg,
     return kvm_update_routing_entry(s, &kroute);
 }
 
+static int kvm_irqchip_init_msi_route_devid(struct kvm_irq_routing_entry *kroute,
+                                            int virq, MSIMessage msg,
+                                            uint32_t devid)
+{
+    kroute->gsi = virq;
+    kroute->type = KVM_IRQ_ROUTING_MSI;
+    kroute->flags = 0;
+    kroute->u.msi.address_lo = (uint32_t)msg.address;
+    kroute->u.msi.address_hi = msg.address >> 32;
+    kroute->u.msi.data = le32_to_cpu(msg.data);
+    if (kvm_msi_devid_required()) {
+        kroute->flags = KVM_MSI_VALID_DEVID;
+        kroute->u.msi.devid = devid;
+    }
+    return kvm_arch_fixup_msi_route(kroute, msg.address, msg.data, NULL);
+}
+
+int kvm_irqchip_add_msi_route_devid(KVMState *s, MSIMessage msg,
+                                    uint32_t devid)
+{
+    struct kvm_irq_routing_entry kroute = {};
+    int virq;
+
+    if (kvm_gsi_direct_mapping()) {
+        return kvm_arch_msi_data_to_gsi(msg.data);
+    }
+
+    if (!kvm_gsi_routing_enabled()) {
+        return -ENOSYS;
+    }
+
+    virq = kvm_irqchip_get_virq(s);
+    if (virq < 0) {
+        return virq;
+    }
+
+    if (kvm_irqchip_init_msi_route_devid(&kroute, virq, msg, devid)) {
+        kvm_irqchip_release_virq(s, virq);
+        return -EINVAL;
+    }
+
+    trace_kvm_irqchip_add_msi_route((char *)"N/A", 0, virq);
+
+    kvm_add_routing_entry(s, &kroute);
+    kvm_irqchip_commit_routes(s);
+
+    return virq;
+}
+
+int kvm_irqchip_update_msi_route_devid(KVMState *s, int virq, MSIMessage msg,
+                                       uint32_t devid)
+{
+    struct kvm_irq_routing_entry kroute = {};
+
+    if (kvm_gsi_direct_mapping()) {
+        return 0;
+    }
+
+    if (!kvm_irqchip_in_kernel()) {
+        return -ENOSYS;
+    }
+
+    if (kvm_irqchip_init_msi_route_devid(&kroute, virq, msg, devid)) {
+        return -EINVAL;
+    }
+
+    trace_kvm_irqchip_update_msi_route(virq);
+
+    return kvm_update_routing_entry(s, &kroute);
+}
+
 static int kvm_irqchip_assign_irqfd(KVMState *s, int fd, int rfd, int virq,
                                     bool assign)
 {
@@ -1289,6 +1363,18 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 {
     return -ENOSYS;
 }
+
+int kvm_irqchip_add_msi_route_devid(KVMState *s, MSIMessage msg,
+                                    uint32_t devid)
+{
+    return -ENOSYS;
+}
+
+int kvm_irqchip_update_msi_route_devid(KVMState *s, int virq, MSIMessage msg,
+                                       uint32_t devid)
+{
+    return -ENOSYS;
+}
 #endif /* !KVM_CAP_IRQ_ROUTING */
 
 int kvm_irqchip_add_irqfd_notifier_gsi(KVMState *s, EventNotifier *n,
@@ -1556,6 +1642,22 @@ static int kvm_init(MachineState *ms)
 
     kvm_state = s;
 
+    s->halt_poll_ns = machine_kvm_halt_poll_ns(ms);
+    if (s->halt_poll_ns >= 0) {
+        if (kvm_vm_check_extension(s, KVM_CAP_HALT_POLL) <= 0) {
+            warn_report("kvm-halt-poll-ns is not supported by the host "
+                        "kernel, using the host default");
+            s->halt_poll_ns = -1;
+        } else {
+            ret = kvm_vm_enable_cap(s, KVM_CAP_HALT_POLL, 0, s->halt_poll_ns);
+            if (ret < 0) {
+                error_report("kvm-halt-poll-ns=%" PRId64 " failed: %s",
+                             s->halt_poll_ns, strerror(-ret));
+                goto err;
+            }
+        }
+    }
+
     /*
      * if memory encryption object is specified then initialize the memory
      * encryption context.
@@ -2059,6 +2161,45 @@ int kvm_has_many_ioeventfds(void)
     return kvm_state->many_ioeventfds;
 }
 
+/*
+ * KVM only exports halt-polling counters through debugfs, in a per-VM
+ * directory named after our pid and the VM file descriptor.
+ */
+static bool kvm_read_vm_stat(KVMState *s, const char *name, uint64_t *value)
+{
+    char *path, *contents;
+    const char *end;
+    bool ok;
+
+    path = g_strdup_printf("/sys/kernel/debug/kvm/%d-%d/%s",
+                           getpid(), s->vmfd, name);
+    ok = g_file_get_contents(path, &contents, NULL, NULL);
+    g_free(path);
+    if (!ok) {
+        return false;
+    }
+    ok = qemu_strtou64(contents, &end, 10, value) == 0;
+    g_free(contents);
+    return ok;
+}
+
+bool kvm_get_halt_poll_stats(KVMHaltPollStats *stats)
+{
+    uint64_t attempted;
+
+    if (!kvm_enabled()) {
+        return false;
+    }
+    stats->halt_poll_ns = kvm_state->halt_poll_ns;
+    if (!kvm_read_vm_stat(kvm_state, "halt_successful_poll",
+                          &stats->successful) ||
+        !kvm_read_vm_stat(kvm_state, "halt_attempted_poll", &attempted)) {
+        return false;
+    }
+    stats->failed = attempted - MIN(attempted, stats->successful);
+    return true;
+}
+
 int kvm_has_gsi_routing(void)
 {
 #ifdef KVM_CAP_IRQ_ROUTING
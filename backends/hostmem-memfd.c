@@ -19,6 +19,9 @@
 
 #define TYPE_MEMORY_BACKEND_MEMFD "memory-backend-memfd"
 
+/* Default placement of pinned backends, large enough for 1 GiB pages */
+#define MEMFD_PIN_DEFAULT_ALIGN (1ULL << 30)
+
 #define MEMORY_BACKEND_MEMFD(obj)                                        \
     OBJECT_CHECK(HostMemoryBackendMemfd, (obj), TYPE_MEMORY_BACKEND_MEMFD)
 
@@ -29,6 +32,7 @@ struct HostMemoryBackendMemfd {
 
     bool hugetlb;
     uint64_t hugetlbsize;
+    uint64_t align;
     bool seal;
 };
 
@@ -36,6 +40,7 @@ static void
 memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 {
     HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(backend);
+    uint64_t align = m->align;
     char *name;
     int fd;
 
@@ -57,9 +62,21 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
         return;
     }
 
+    /*
+     * A pinned backend is populated and locked before devices are realized,
+     * and placed so that both the host and vhost-user backends can map it
+     * with the largest pages.
+     */
+    if (backend->pin) {
+        backend->prealloc = true;
+        if (!align) {
+            align = MEMFD_PIN_DEFAULT_ALIGN;
+        }
+    }
+
     name = object_get_canonical_path(OBJECT(backend));
     memory_region_init_ram_from_fd(&backend->mr, OBJECT(backend),
-                                   name, backend->size, true, fd, errp);
+                                   name, backend->size, align, true, fd, errp);
     g_free(name);
 }
 
@@ -112,6 +129,61 @@ memfd_backend_get_hugetlbsize(Object *obj, Visitor *v, const char *name,
     visit_type_size(v, name, &value, errp);
 }
 
+static void
+memfd_backend_set_align(Object *obj, Visitor *v, const char *name,
+                        void *opaque, Error **errp)
+{
+    HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(obj);
+    Error *local_err = NULL;
+    uint64_t value;
+
+    if (host_memory_backend_mr_inited(MEMORY_BACKEND(obj))) {
+        error_setg(&local_err, "cannot change property value");
+        goto out;
+    }
+
+    visit_type_size(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (value & (value - 1)) {
+        error_setg(&local_err, "Property '%s.%s' must be a power of two",
+                   object_get_typename(obj), name);
+        goto out;
+    }
+    m->align = value;
+out:
+    error_propagate(errp, local_err);
+}
+
+static void
+memfd_backend_get_align(Object *obj, Visitor *v, const char *name,
+                        void *opaque, Error **errp)
+{
+    HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(obj);
+    uint64_t value = m->align;
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static bool
+memfd_backend_get_pin(Object *o, Error **errp)
+{
+    return MEMORY_BACKEND(o)->pin;
+}
+
+static void
+memfd_backend_set_pin(Object *o, bool value, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(o);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->pin = value;
+}
+
 static bool
 memfd_backend_get_seal(Object *o, Error **errp)
 {
@@ -148,6 +220,14 @@ memfd_backend_class_init(ObjectClass *oc, void *data)
                               memfd_backend_get_hugetlbsize,
                               memfd_backend_set_hugetlbsize,
                               NULL, NULL, &error_abort);
+    object_class_property_add(oc, "align", "int",
+                              memfd_backend_get_align,
+                              memfd_backend_set_align,
+                              NULL, NULL, &error_abort);
+    object_class_property_add_bool(oc, "pin",
+                                   memfd_backend_get_pin,
+                                   memfd_backend_set_pin,
+                                   &error_abort);
     object_class_property_add_bool(oc, "seal",
                                    memfd_backend_get_seal,
                                    memfd_backend_set_seal,
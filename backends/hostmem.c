@@ -17,14 +17,47 @@
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/visitor.h"
 #include "qemu/config-file.h"
+#include "qemu/mmap-alloc.h"
 #include "qom/object_interfaces.h"
+#include "qemu/thread.h"
+#include "qemu/main-loop.h"
+#include "trace.h"
+
+static QLIST_HEAD(, HostMemoryBackend) prealloc_pending =
+    QLIST_HEAD_INITIALIZER(prealloc_pending);
 
 #ifdef CONFIG_NUMA
+#include <numa.h>
 #include <numaif.h>
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_DEFAULT != MPOL_DEFAULT);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_PREFERRED != MPOL_PREFERRED);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_BIND != MPOL_BIND);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_INTERLEAVE != MPOL_INTERLEAVE);
+
+#define HOST_MEM_REBIND_MAX_THREADS 8
+
+/* Granularity at which the rebind threads claim memory to move */
+#define HOST_MEM_REBIND_CHUNK_SIZE (64 * 1024 * 1024)
+
+struct HostMemoryRebind {
+    char *area;
+    size_t size;
+    size_t chunk;
+    HostMemPolicy policy;
+    DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
+    unsigned long maxnode;
+
+    int num_threads;
+    QemuThread *threads;
+    QEMUBH *bh;
+    MemdevRebindStatus status;
+
+    /* Updated by the threads */
+    size_t next;
+    size_t done;
+    int running;
+    int error;
+};
 #endif
 
 static void
@@ -135,6 +168,222 @@ host_memory_backend_set_policy(Object *obj, int policy, Error **errp)
 #endif
 }
 
+#ifdef CONFIG_NUMA
+/* Returns the maxnode argument for mbind(), minus one (see below) */
+static unsigned long host_memory_backend_maxnode(const unsigned long *nodes)
+{
+    unsigned long lastbit = find_last_bit(nodes, MAX_NODES);
+
+    /* lastbit == MAX_NODES means maxnode = 0 */
+    return (lastbit + 1) % (MAX_NODES + 1);
+}
+
+/*
+ * Check for invalid host-nodes and policies and give more verbose error
+ * messages than mbind().
+ */
+static bool host_memory_backend_check_policy(HostMemPolicy policy,
+                                             unsigned long maxnode,
+                                             Error **errp)
+{
+    if (maxnode && policy == MPOL_DEFAULT) {
+        error_setg(errp, "host-nodes must be empty for policy default,"
+                   " or you should explicitly specify a policy other"
+                   " than default");
+        return false;
+    } else if (maxnode == 0 && policy != MPOL_DEFAULT) {
+        error_setg(errp, "host-nodes must be set for policy %s",
+                   HostMemPolicy_str(policy));
+        return false;
+    }
+    return true;
+}
+
+/* Copy the pages from CPUs local to their destination */
+static void host_memory_backend_rebind_set_affinity(HostMemoryRebind *job)
+{
+    struct bitmask *mask;
+    unsigned long node;
+
+    if (!job->maxnode || numa_available() < 0) {
+        return;
+    }
+    mask = numa_allocate_nodemask();
+    for (node = find_first_bit(job->host_nodes, job->maxnode);
+         node < job->maxnode;
+         node = find_next_bit(job->host_nodes, job->maxnode, node + 1)) {
+        numa_bitmask_setbit(mask, node);
+    }
+    numa_run_on_node_mask(mask);
+    numa_free_nodemask(mask);
+}
+
+static void *host_memory_backend_rebind_thread(void *opaque)
+{
+    HostMemoryRebind *job = opaque;
+    size_t offset;
+
+    host_memory_backend_rebind_set_affinity(job);
+
+    while ((offset = atomic_fetch_add(&job->next, job->chunk)) < job->size) {
+        size_t len = MIN(job->chunk, job->size - offset);
+
+        /* With MPOL_MF_STRICT, EIO reports pages that stayed behind */
+        if (mbind(job->area + offset, len, job->policy,
+                  job->maxnode ? job->host_nodes : NULL, job->maxnode + 1,
+                  MPOL_MF_MOVE | MPOL_MF_STRICT)) {
+            atomic_cmpxchg(&job->error, 0, errno);
+        }
+        atomic_add(&job->done, len);
+    }
+
+    if (atomic_fetch_dec(&job->running) == 1) {
+        qemu_bh_schedule(job->bh);
+    }
+    return NULL;
+}
+
+static void host_memory_backend_rebind_finish(HostMemoryRebind *job)
+{
+    int i;
+
+    for (i = 0; i < job->num_threads; i++) {
+        qemu_thread_join(&job->threads[i]);
+    }
+    g_free(job->threads);
+    job->threads = NULL;
+    qemu_bh_delete(job->bh);
+    job->bh = NULL;
+
+    job->status = job->error ? MEMDEV_REBIND_STATUS_FAILED
+                             : MEMDEV_REBIND_STATUS_COMPLETED;
+    trace_host_memory_backend_rebind_finish(job->area, job->done, job->error);
+}
+
+static void host_memory_backend_rebind_bh(void *opaque)
+{
+    host_memory_backend_rebind_finish(opaque);
+}
+#endif
+
+void host_memory_backend_rebind(HostMemoryBackend *backend,
+                                const unsigned long *host_nodes,
+                                HostMemPolicy policy, Error **errp)
+{
+#ifdef CONFIG_NUMA
+    HostMemoryRebind *job;
+    unsigned long maxnode = host_memory_backend_maxnode(host_nodes);
+    void *ptr;
+    uint64_t sz;
+    int i;
+
+    if (!host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "memory backend is not initialized yet");
+        return;
+    }
+    if (backend->prealloc_job) {
+        error_setg(errp, "memory backend is still being preallocated");
+        return;
+    }
+    if (backend->rebind &&
+        backend->rebind->status == MEMDEV_REBIND_STATUS_ACTIVE) {
+        error_setg(errp, "memory backend is already being moved");
+        return;
+    }
+    if (!host_memory_backend_check_policy(policy, maxnode, errp)) {
+        return;
+    }
+
+    ptr = memory_region_get_ram_ptr(&backend->mr);
+    sz = memory_region_size(&backend->mr);
+
+    /*
+     * Switch the policy for new allocations right away, without moving
+     * anything; this also catches nodes that do not exist on the host.
+     */
+    if (mbind(ptr, sz, policy, maxnode ? host_nodes : NULL, maxnode + 1, 0)) {
+        error_setg_errno(errp, errno,
+                         "cannot bind memory to host NUMA nodes");
+        return;
+    }
+    bitmap_copy(backend->host_nodes, host_nodes, MAX_NODES + 1);
+    backend->policy = policy;
+
+    g_free(backend->rebind);
+    job = backend->rebind = g_new0(HostMemoryRebind, 1);
+    job->area = ptr;
+    job->size = sz;
+    job->chunk = QEMU_ALIGN_UP(HOST_MEM_REBIND_CHUNK_SIZE,
+                               qemu_ram_pagesize(backend->mr.ram_block));
+    job->policy = policy;
+    bitmap_copy(job->host_nodes, host_nodes, MAX_NODES + 1);
+    job->maxnode = maxnode;
+    job->status = MEMDEV_REBIND_STATUS_ACTIVE;
+    job->bh = qemu_bh_new(host_memory_backend_rebind_bh, job);
+
+    job->num_threads = MIN(HOST_MEM_REBIND_MAX_THREADS,
+                           DIV_ROUND_UP(sz, job->chunk));
+    job->running = job->num_threads;
+    job->threads = g_new0(QemuThread, job->num_threads);
+
+    trace_host_memory_backend_rebind_start(ptr, sz, policy, maxnode,
+                                           job->num_threads);
+    for (i = 0; i < job->num_threads; i++) {
+        qemu_thread_create(&job->threads[i], "hostmem-rebind",
+                           host_memory_backend_rebind_thread, job,
+                           QEMU_THREAD_JOINABLE);
+    }
+#else
+    error_setg(errp, "NUMA node binding are not supported by this QEMU");
+#endif
+}
+
+MemdevRebindInfo *host_memory_backend_rebind_info(HostMemoryBackend *backend)
+{
+#ifdef CONFIG_NUMA
+    HostMemoryRebind *job = backend->rebind;
+    MemdevRebindInfo *info;
+
+    if (!job) {
+        return NULL;
+    }
+    info = g_new0(MemdevRebindInfo, 1);
+    info->status = job->status;
+    info->total = job->size;
+    info->done = atomic_read(&job->done);
+    if (job->status == MEMDEV_REBIND_STATUS_FAILED) {
+        info->has_error = true;
+        info->error = g_strdup_printf("cannot move memory to host NUMA "
+                                      "nodes: %s", strerror(job->error));
+    }
+    return info;
+#else
+    return NULL;
+#endif
+}
+
+static bool host_memory_backend_get_host_nodes_follow(Object *obj,
+                                                      Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->host_nodes_follow;
+}
+
+static void host_memory_backend_set_host_nodes_follow(Object *obj, bool value,
+                                                      Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+#ifndef CONFIG_NUMA
+    if (value) {
+        error_setg(errp, "NUMA node binding are not supported by this QEMU");
+        return;
+    }
+#endif
+    backend->host_nodes_follow = value;
+}
+
 static bool host_memory_backend_get_merge(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -161,6 +410,93 @@ static void host_memory_backend_set_merge(Object *obj, bool value, Error **errp)
     }
 }
 
+/*
+ * RAM blocks get MADV_HUGEPAGE by default; "off" additionally keeps
+ * khugepaged from collapsing the range behind the guest's back.
+ */
+static void host_memory_backend_apply_thp(HostMemoryBackend *backend,
+                                          Error **errp)
+{
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    int advice;
+
+    switch (backend->thp) {
+    case ON_OFF_AUTO_ON:
+        advice = QEMU_MADV_HUGEPAGE;
+        break;
+    case ON_OFF_AUTO_OFF:
+        advice = QEMU_MADV_NOHUGEPAGE;
+        break;
+    default:
+        return;
+    }
+
+    /* hugetlbfs pages are huge already */
+    if (qemu_ram_pagesize(backend->mr.ram_block) != getpagesize()) {
+        return;
+    }
+    if (advice == QEMU_MADV_INVALID || qemu_madvise(ptr, sz, advice)) {
+        error_setg(errp, "transparent huge page policy not supported "
+                   "by the host");
+    }
+}
+
+static int
+host_memory_backend_get_thp(Object *obj, Error **errp G_GNUC_UNUSED)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->thp;
+}
+
+static void
+host_memory_backend_set_thp(Object *obj, int value, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend) && value == ON_OFF_AUTO_AUTO) {
+        error_setg(errp, "cannot reset transparent huge page policy to auto");
+        return;
+    }
+    backend->thp = value;
+    if (host_memory_backend_mr_inited(backend)) {
+        host_memory_backend_apply_thp(backend, errp);
+    }
+}
+
+static void
+host_memory_backend_get_thp_size(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    Error *local_err = NULL;
+    uint64_t value;
+
+    value = host_memory_backend_thp_size(MEMORY_BACKEND(obj), &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    visit_type_size(v, name, &value, errp);
+}
+
+uint64_t host_memory_backend_thp_size(HostMemoryBackend *backend,
+                                      Error **errp)
+{
+    int64_t size;
+
+    if (!host_memory_backend_mr_inited(backend)) {
+        return 0;
+    }
+    size = qemu_ram_thp_size(memory_region_get_ram_ptr(&backend->mr),
+                             memory_region_size(&backend->mr));
+    if (size < 0) {
+        error_setg(errp, "transparent huge page usage is not available");
+        return 0;
+    }
+    return size;
+}
+
 static bool host_memory_backend_get_dump(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -187,6 +523,80 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/*
+ * Run the preallocation threads on the CPUs of the host nodes the memory
+ * is bound to, so that zeroing the pages does not cross the interconnect.
+ */
+static MemPrealloc *
+host_memory_backend_prealloc_start(HostMemoryBackend *backend, Error **errp)
+{
+    const unsigned long *host_nodes = NULL;
+
+#ifdef CONFIG_NUMA
+    if (backend->policy != HOST_MEM_POLICY_DEFAULT) {
+        host_nodes = backend->host_nodes;
+    }
+#endif
+    return os_mem_prealloc_start(memory_region_get_fd(&backend->mr),
+                                 memory_region_get_ram_ptr(&backend->mr),
+                                 memory_region_size(&backend->mr),
+                                 smp_cpus, host_nodes, MAX_NODES, errp);
+}
+
+static void host_memory_backend_prealloc(HostMemoryBackend *backend,
+                                         Error **errp)
+{
+    MemPrealloc *job = host_memory_backend_prealloc_start(backend, errp);
+
+    if (job) {
+        os_mem_prealloc_finish(job, errp);
+    }
+}
+
+/*
+ * Lock the populated memory so that DMA mappings set up by vfio and vhost
+ * at realize time never have to fault pages back in.
+ */
+static void host_memory_backend_pin(HostMemoryBackend *backend, Error **errp)
+{
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+
+    if (mlock(ptr, sz)) {
+        error_setg_errno(errp, errno, "cannot pin memory backend '%s'",
+                         backend->id ? backend->id : "");
+    }
+}
+
+static void host_memory_backend_prealloc_wait(HostMemoryBackend *backend,
+                                              Error **errp)
+{
+    Error *local_err = NULL;
+
+    if (backend->prealloc_job) {
+        os_mem_prealloc_finish(backend->prealloc_job, &local_err);
+        backend->prealloc_job = NULL;
+        QLIST_REMOVE(backend, prealloc_next);
+        if (!local_err && backend->pin) {
+            host_memory_backend_pin(backend, &local_err);
+        }
+        error_propagate(errp, local_err);
+    }
+}
+
+void host_memory_backend_prealloc_wait_all(Error **errp)
+{
+    Error *local_err = NULL;
+
+    while (!QLIST_EMPTY(&prealloc_pending)) {
+        HostMemoryBackend *backend = QLIST_FIRST(&prealloc_pending);
+
+        host_memory_backend_prealloc_wait(backend,
+                                          local_err ? NULL : &local_err);
+    }
+    error_propagate(errp, local_err);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -214,11 +624,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        os_mem_prealloc(fd, ptr, sz, smp_cpus, &local_err);
+        host_memory_backend_prealloc(backend, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -227,6 +633,44 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_async(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prealloc_async = value;
+}
+
+static void
+host_memory_backend_get_prealloc_progress(Object *obj, Visitor *v,
+                                          const char *name, void *opaque,
+                                          Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    size_t done, total;
+    uint8_t value = 0;
+
+    if (backend->prealloc_job) {
+        os_mem_prealloc_progress(backend->prealloc_job, &done, &total);
+        value = total ? done * 100 / total : 100;
+    } else if (host_memory_backend_mr_inited(backend) &&
+               (backend->prealloc || backend->force_prealloc)) {
+        value = 100;
+    }
+    visit_type_uint8(v, name, &value, errp);
+}
+
 static void host_memory_backend_init(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -286,25 +730,20 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
         if (!backend->dump) {
             qemu_madvise(ptr, sz, QEMU_MADV_DONTDUMP);
         }
+        host_memory_backend_apply_thp(backend, &local_err);
+        if (local_err) {
+            goto out;
+        }
 #ifdef CONFIG_NUMA
-        unsigned long lastbit = find_last_bit(backend->host_nodes, MAX_NODES);
-        /* lastbit == MAX_NODES means maxnode = 0 */
-        unsigned long maxnode = (lastbit + 1) % (MAX_NODES + 1);
+        unsigned long maxnode =
+            host_memory_backend_maxnode(backend->host_nodes);
         /* ensure policy won't be ignored in case memory is preallocated
          * before mbind(). note: MPOL_MF_STRICT is ignored on hugepages so
          * this doesn't catch hugepage case. */
         unsigned flags = MPOL_MF_STRICT | MPOL_MF_MOVE;
 
-        /* check for invalid host-nodes and policies and give more verbose
-         * error messages than mbind(). */
-        if (maxnode && backend->policy == MPOL_DEFAULT) {
-            error_setg(errp, "host-nodes must be empty for policy default,"
-                       " or you should explicitly specify a policy other"
-                       " than default");
-            return;
-        } else if (maxnode == 0 && backend->policy != MPOL_DEFAULT) {
-            error_setg(errp, "host-nodes must be set for policy %s",
-                       HostMemPolicy_str(backend->policy));
+        if (!host_memory_backend_check_policy(backend->policy, maxnode,
+                                              errp)) {
             return;
         }
 
@@ -329,12 +768,22 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * This is necessary to guarantee memory is allocated with
          * specified NUMA policy in place.
          */
-        if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            smp_cpus, &local_err);
+        if (backend->prealloc && backend->prealloc_async && !qdev_hotplug) {
+            /* Let the board and the other devices initialize meanwhile */
+            backend->prealloc_job =
+                host_memory_backend_prealloc_start(backend, &local_err);
             if (local_err) {
                 goto out;
             }
+            QLIST_INSERT_HEAD(&prealloc_pending, backend, prealloc_next);
+        } else if (backend->prealloc) {
+            host_memory_backend_prealloc(backend, &local_err);
+            if (local_err) {
+                goto out;
+            }
+            if (backend->pin) {
+                host_memory_backend_pin(backend, &local_err);
+            }
         }
     }
 out:
@@ -344,7 +793,15 @@ out:
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
-    if (host_memory_backend_is_mapped(MEMORY_BACKEND(uc))) {
+    HostMemoryBackend *backend = MEMORY_BACKEND(uc);
+
+#ifdef CONFIG_NUMA
+    if (backend->rebind &&
+        backend->rebind->status == MEMDEV_REBIND_STATUS_ACTIVE) {
+        return false;
+    }
+#endif
+    if (host_memory_backend_is_mapped(backend)) {
         return false;
     } else {
         return true;
@@ -404,6 +861,12 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "prealloc",
         host_memory_backend_get_prealloc,
         host_memory_backend_set_prealloc, &error_abort);
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async, &error_abort);
+    object_class_property_add(oc, "prealloc-progress", "uint8",
+        host_memory_backend_get_prealloc_progress,
+        NULL, NULL, NULL, &error_abort);
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -416,6 +879,16 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         &HostMemPolicy_lookup,
         host_memory_backend_get_policy,
         host_memory_backend_set_policy, &error_abort);
+    object_class_property_add_bool(oc, "host-nodes-follow",
+        host_memory_backend_get_host_nodes_follow,
+        host_memory_backend_set_host_nodes_follow, &error_abort);
+    object_class_property_add_enum(oc, "thp", "OnOffAuto",
+        &OnOffAuto_lookup,
+        host_memory_backend_get_thp,
+        host_memory_backend_set_thp, &error_abort);
+    object_class_property_add(oc, "thp-size", "size",
+        host_memory_backend_get_thp_size,
+        NULL, NULL, NULL, &error_abort);
     object_class_property_add_str(oc, "id", get_id, set_id, &error_abort);
     object_class_property_add_bool(oc, "share",
         host_memory_backend_get_share, host_memory_backend_set_share,
@@ -425,6 +898,14 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
 static void host_memory_backend_finalize(Object *o)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(o);
+
+    host_memory_backend_prealloc_wait(backend, NULL);
+#ifdef CONFIG_NUMA
+    if (backend->rebind && backend->rebind->threads) {
+        host_memory_backend_rebind_finish(backend->rebind);
+    }
+    g_free(backend->rebind);
+#endif
     g_free(backend->id);
 }
 
@@ -13,6 +13,7 @@
 #include "trace-root.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/cutils.h"
 
 /* #define DEBUG_IOMMU */
 
@@ -157,7 +158,7 @@ static void dma_blk_cb(void *opaque, int ret)
     if (dbs->iov.size == 0) {
         trace_dma_map_wait(dbs);
         dbs->bh = aio_bh_new(dbs->ctx, reschedule_dma, dbs);
-        cpu_register_map_client(dbs->bh);
+        address_space_register_map_client(dbs->sg->as, dbs->bh);
         return;
     }
 
@@ -183,7 +184,7 @@ static void dma_aio_cancel(BlockAIOCB *acb)
         blk_aio_cancel_async(dbs->acb);
     }
     if (dbs->bh) {
-        cpu_unregister_map_client(dbs->bh);
+        address_space_unregister_map_client(dbs->sg->as, dbs->bh);
         qemu_bh_delete(dbs->bh);
         dbs->bh = NULL;
     }
@@ -232,16 +233,25 @@ BlockAIOCB *dma_blk_io(AioContext *ctx,
 static uint64_t dma_buf_rw(uint8_t *ptr, int32_t len, QEMUSGList *sg,
                            DMADirection dir)
 {
+    bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+    unsigned flags = 0;
     uint64_t resid;
     int sg_cur_index;
 
     resid = sg->size;
     sg_cur_index = 0;
     len = MIN(len, resid);
+
+    /* Data going to the guest is not read back by QEMU */
+    if (is_write && len >= QEMU_NONTEMPORAL_COPY_MIN) {
+        flags |= MEMTX_COPY_NONTEMPORAL;
+    }
+    dma_barrier(sg->as, dir);
     while (len > 0) {
         ScatterGatherEntry entry = sg->sg[sg_cur_index++];
         int32_t xfer = MIN(len, entry.len);
-        dma_memory_rw(sg->as, entry.base, ptr, xfer, dir);
+        address_space_copy(sg->as, entry.base, MEMTXATTRS_UNSPECIFIED,
+                           ptr, xfer, is_write, flags);
         ptr += xfer;
         len -= xfer;
         resid -= xfer;
@@ -36,12 +36,19 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
 
 #define MAX_GUEST_NOTE_SIZE (1 << 20) /* 1MB should be enough */
 
+/* kdump pages are compressed by a pool of threads, in batches */
+#define DUMP_BATCH_PAGES            256
+#define DUMP_MAX_COMPRESS_THREADS   8
+
 #define ELF_NOTE_SIZE(hdr_size, name_size, desc_size)   \
     ((DIV_ROUND_UP((hdr_size), 4) +                     \
       DIV_ROUND_UP((name_size), 4) +                    \
@@ -376,6 +383,34 @@ static void write_data(DumpState *s, void *buf, int length, Error **errp)
     }
 }
 
+/*
+ * write one page of memory to vmcore. If the vmcore is a regular file,
+ * zero pages are not written at all and leave a hole in the file instead.
+ * Holes are only left past the original end of the file; before it, they
+ * would expose whatever the file contained.
+ */
+static void write_page(DumpState *s, void *buf, int length, Error **errp)
+{
+    if (s->sparse && buffer_is_zero(buf, length)) {
+        off_t pos = lseek(s->fd, 0, SEEK_CUR);
+
+        if (pos < 0) {
+            error_setg_errno(errp, errno, "dump: failed to save memory");
+            return;
+        }
+        if (pos >= s->sparse_start) {
+            if (lseek(s->fd, length, SEEK_CUR) < 0) {
+                error_setg_errno(errp, errno, "dump: failed to save memory");
+                return;
+            }
+            s->written_size += length;
+            return;
+        }
+    }
+
+    write_data(s, buf, length, errp);
+}
+
 /* write the memory to vmcore. 1 page per I/O. */
 static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
                          int64_t size, Error **errp)
@@ -384,7 +419,7 @@ static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
     Error *local_err = NULL;
 
     for (i = 0; i < size / s->dump_info.page_size; i++) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
+        write_page(s, block->host_addr + start + i * s->dump_info.page_size,
                    s->dump_info.page_size, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
@@ -393,7 +428,7 @@ static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
     }
 
     if ((size % s->dump_info.page_size) != 0) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
+        write_page(s, block->host_addr + start + i * s->dump_info.page_size,
                    size % s->dump_info.page_size, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
@@ -667,7 +702,20 @@ static void create_vmcore(DumpState *s, Error **errp)
         return;
     }
 
-    dump_iterate(s, errp);
+    dump_iterate(s, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    /* a trailing hole must still be part of the file */
+    if (s->sparse) {
+        off_t end = lseek(s->fd, 0, SEEK_CUR);
+
+        if (end < 0 || ftruncate(s->fd, end) < 0) {
+            error_setg_errno(errp, errno, "dump: failed to save memory");
+        }
+    }
 }
 
 static int write_start_flat_header(int fd)
@@ -1282,6 +1330,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1294,20 +1347,334 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * A batch of consecutive dumpable pages.  The dump thread fills in @pages,
+ * a compression thread fills in @data, @flags and @size, and the dump thread
+ * then writes the results out in the order the batches were queued.
+ */
+typedef struct DumpPageBatch {
+    unsigned nr;
+    uint8_t *pages[DUMP_BATCH_PAGES];
+    const uint8_t *data[DUMP_BATCH_PAGES];  /* NULL for zero pages */
+    uint32_t flags[DUMP_BATCH_PAGES];
+    size_t size[DUMP_BATCH_PAGES];
+    uint8_t *buf_out;                       /* DUMP_BATCH_PAGES * len_buf_out */
+    bool done;
+} DumpPageBatch;
+
+typedef struct DumpCompressPool DumpCompressPool;
+
+typedef struct DumpCompressWorker {
+    DumpCompressPool *pool;
+    QemuThread thread;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressWorker;
+
+struct DumpCompressPool {
+    DumpState *s;
+    size_t len_buf_out;
+
+    QemuMutex lock;
+    QemuCond work_cond;         /* a batch was queued, or quit is set */
+    QemuCond done_cond;         /* a batch was compressed */
+    bool quit;
+
+    /* ring of batches; the counters only ever increase */
+    unsigned nr_batches;
+    DumpPageBatch *batches;
+    uint64_t queued;            /* batches handed to the workers */
+    uint64_t claimed;           /* batches picked up by a worker */
+    uint64_t written;           /* batches written to the vmcore */
+
+    unsigned nr_workers;
+    DumpCompressWorker *workers;
+};
+
+#ifdef CONFIG_ZSTD
+static bool dump_zstd_compress(DumpCompressWorker *w, const uint8_t *buf,
+                               size_t size, uint8_t *buf_out, size_t *size_out)
+{
+    size_t ret = ZSTD_compressCCtx(w->zstd, buf_out, *size_out, buf, size, 1);
+
+    if (ZSTD_isError(ret)) {
+        return false;
+    }
+    *size_out = ret;
+    return true;
+}
+#endif
+
+/*
+ * compress one page of a batch. only one compression format will be used
+ * here, for s->flag_compress is set. But when compression fails to work,
+ * or does not make the page smaller, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpCompressWorker *w, DumpPageBatch *b,
+                               unsigned i)
+{
+    DumpState *s = w->pool->s;
+    size_t page_size = s->dump_info.page_size;
+    uint8_t *buf = b->pages[i];
+    uint8_t *buf_out = b->buf_out + i * w->pool->len_buf_out;
+    size_t size_out = w->pool->len_buf_out;
+
+    if (is_zero_page(buf, page_size)) {
+        b->data[i] = NULL;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+            (compress2(buf_out, (uLongf *)&size_out, buf,
+                       page_size, Z_BEST_SPEED) == Z_OK) &&
+            (size_out < page_size)) {
+        b->flags[i] = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+            (lzo1x_1_compress(buf, page_size, buf_out,
+            (lzo_uint *)&size_out, w->wrkmem) == LZO_E_OK) &&
+            (size_out < page_size)) {
+        b->flags[i] = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+            (snappy_compress((char *)buf, page_size,
+            (char *)buf_out, &size_out) == SNAPPY_OK) &&
+            (size_out < page_size)) {
+        b->flags[i] = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) &&
+            dump_zstd_compress(w, buf, page_size, buf_out, &size_out) &&
+            (size_out < page_size)) {
+        b->flags[i] = DUMP_DH_COMPRESSED_ZSTD;
+#endif
+    } else {
+        b->flags[i] = 0;
+        b->data[i] = buf;
+        b->size[i] = page_size;
+        return;
+    }
+
+    b->data[i] = buf_out;
+    b->size[i] = size_out;
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressWorker *w = opaque;
+    DumpCompressPool *pool = w->pool;
+    DumpPageBatch *b;
+    unsigned i;
+
+    qemu_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->claimed == pool->queued) {
+            qemu_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        b = &pool->batches[pool->claimed++ % pool->nr_batches];
+        qemu_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < b->nr; i++) {
+            dump_compress_page(w, b, i);
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        b->done = true;
+        qemu_cond_signal(&pool->done_cond);
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*
+ * start the compression workers. on failure, the workers that were started
+ * are left in the pool and dump_compress_pool_cleanup() must still be
+ * called.
+ */
+static bool dump_compress_pool_init(DumpCompressPool *pool, DumpState *s,
+                                    size_t len_buf_out, Error **errp)
+{
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned i;
+
+    pool->s = s;
+    pool->len_buf_out = len_buf_out;
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->work_cond);
+    qemu_cond_init(&pool->done_cond);
+    pool->quit = false;
+    pool->queued = pool->claimed = pool->written = 0;
+
+    /* the guest is stopped while dumping, so its CPUs are ours to use */
+    pool->nr_workers = MAX(1, MIN(nr_cpus, DUMP_MAX_COMPRESS_THREADS));
+
+    /* enough batches to keep every worker busy while one is being written */
+    pool->nr_batches = pool->nr_workers * 2;
+    pool->batches = g_new0(DumpPageBatch, pool->nr_batches);
+    for (i = 0; i < pool->nr_batches; i++) {
+        pool->batches[i].buf_out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+    }
+
+    pool->workers = g_new0(DumpCompressWorker, pool->nr_workers);
+    for (i = 0; i < pool->nr_workers; i++) {
+        DumpCompressWorker *w = &pool->workers[i];
+
+        w->pool = pool;
+#ifdef CONFIG_ZSTD
+        if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+            w->zstd = ZSTD_createCCtx();
+            if (!w->zstd) {
+                pool->nr_workers = i;
+                error_setg(errp, "dump: failed to create zstd context");
+                return false;
+            }
+        }
+#endif
+#ifdef CONFIG_LZO
+        w->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        qemu_thread_create(&w->thread, "dump_compress", dump_compress_thread,
+                           w, QEMU_THREAD_JOINABLE);
+    }
+
+    return true;
+}
+
+static void dump_compress_pool_cleanup(DumpCompressPool *pool)
+{
+    unsigned i;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->quit = true;
+    qemu_cond_broadcast(&pool->work_cond);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nr_workers; i++) {
+        DumpCompressWorker *w = &pool->workers[i];
+
+        qemu_thread_join(&w->thread);
+#ifdef CONFIG_LZO
+        g_free(w->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+        ZSTD_freeCCtx(w->zstd);
+#endif
+    }
+    g_free(pool->workers);
+
+    for (i = 0; i < pool->nr_batches; i++) {
+        g_free(pool->batches[i].buf_out);
+    }
+    g_free(pool->batches);
+
+    qemu_cond_destroy(&pool->done_cond);
+    qemu_cond_destroy(&pool->work_cond);
+    qemu_mutex_destroy(&pool->lock);
+}
+
+/*
+ * queue batches of pages until the ring is full or there are no more pages.
+ * Returns false once every page has been queued.
+ */
+static bool dump_queue_batches(DumpCompressPool *pool,
+                               GuestPhysBlock **block_iter, uint64_t *pfn_iter)
+{
+    DumpPageBatch *b;
+    bool more = true;
+
+    qemu_mutex_lock(&pool->lock);
+    while (pool->queued - pool->written < pool->nr_batches) {
+        b = &pool->batches[pool->queued % pool->nr_batches];
+        b->done = false;
+        for (b->nr = 0; b->nr < DUMP_BATCH_PAGES; b->nr++) {
+            if (!get_next_page(block_iter, pfn_iter, &b->pages[b->nr],
+                               pool->s)) {
+                more = false;
+                break;
+            }
+        }
+        if (b->nr) {
+            pool->queued++;
+            qemu_cond_signal(&pool->work_cond);
+        }
+        if (!more) {
+            break;
+        }
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    return more;
+}
+
+/* write the pages of a compressed batch into the caches of vmcore */
+static void dump_write_batch(DumpState *s, DumpPageBatch *b,
+                             DataCache *page_desc, DataCache *page_data,
+                             const PageDescriptor *pd_zero, off_t *offset_data,
+                             Error **errp)
+{
+    PageDescriptor pd;
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < b->nr; i++) {
+        if (!b->data[i]) {
+            ret = write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                              false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return;
+            }
+            continue;
+        }
+
+        ret = write_cache(page_data, b->data[i], b->size[i], false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page data");
+            return;
+        }
+
+        pd.flags = cpu_to_dump32(s, b->flags[i]);
+        pd.size = cpu_to_dump32(s, b->size[i]);
+        pd.page_flags = cpu_to_dump64(s, 0);
+        pd.offset = cpu_to_dump64(s, *offset_data);
+        *offset_data += b->size[i];
+
+        ret = write_cache(page_desc, &pd, sizeof(PageDescriptor), false);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page desc");
+            return;
+        }
+    }
+
+    /* query-dump may be looking from the main thread */
+    atomic_set(&s->written_size,
+               s->written_size + (int64_t)b->nr * s->dump_info.page_size);
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    DumpCompressPool pool;
+    DumpPageBatch *b;
+    bool more;
+    Error *local_err = NULL;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1320,11 +1687,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    if (!dump_compress_pool_init(&pool, s, len_buf_out, errp)) {
+        goto out;
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1345,100 +1710,37 @@ static void write_dump_pages(DumpState *s, Error **errp)
     offset_data += s->dump_info.page_size;
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore batch by batch. the worker threads check for
+     * zero pages and compress the others while this thread writes out the
+     * batches that are done, in pfn order. zero page will all be resided in
+     * the first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
+    more = true;
+    for (;;) {
+        if (more) {
+            more = dump_queue_batches(&pool, &block_iter, &pfn_iter);
+        }
+        if (pool.written == pool.queued) {
+            break;
+        }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+        b = &pool.batches[pool.written % pool.nr_batches];
+        qemu_mutex_lock(&pool.lock);
+        while (!b->done) {
+            qemu_cond_wait(&pool.done_cond, &pool.lock);
+        }
+        qemu_mutex_unlock(&pool.lock);
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
+        dump_write_batch(s, b, &page_desc, &page_data, &pd_zero, &offset_data,
+                         &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            goto out;
         }
-        s->written_size += s->dump_info.page_size;
+
+        qemu_mutex_lock(&pool.lock);
+        pool.written++;
+        qemu_mutex_unlock(&pool.lock);
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1453,14 +1755,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_compress_pool_cleanup(&pool);
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1636,6 +1933,25 @@ static void vmcoreinfo_update_phys_base(DumpState *s)
     g_strfreev(lines);
 }
 
+/*
+ * the ELF vmcore is written sequentially, so zero pages can be skipped by
+ * seeking over them if the vmcore is a regular file. *size is set to the
+ * current size of the file.
+ */
+static bool dump_fd_is_sparse(int fd, off_t *size)
+{
+    struct stat st;
+    int flags;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    *size = st.st_size;
+
+    flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && !(flags & O_APPEND);
+}
+
 static void dump_init(DumpState *s, int fd, bool has_format,
                       DumpGuestMemoryFormat format, bool paging, bool has_filter,
                       int64_t begin, int64_t length, Error **errp)
@@ -1801,6 +2117,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1812,6 +2132,8 @@ static void dump_init(DumpState *s, int fd, bool has_format,
         memory_mapping_filter(&s->list, s->begin, s->length);
     }
 
+    s->sparse = dump_fd_is_sparse(fd, &s->sparse_start);
+
     /*
      * calculate phdr_num
      *
@@ -1904,7 +2226,7 @@ DumpQueryResult *qmp_query_dump(Error **errp)
     result->status = atomic_read(&state->status);
     /* make sure we are reading status and written_size in order */
     smp_rmb();
-    result->completed = state->written_size;
+    result->completed = atomic_read(&state->written_size);
     result->total = state->total_size;
     return result;
 }
@@ -1955,7 +2277,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -1970,6 +2292,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #if !defined(WIN32)
     if (strstart(file, "fd:", &p)) {
         fd = monitor_get_fd(cur_mon, p, errp);
@@ -2044,5 +2373,12 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
+    item = item->next;
+    item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+#endif
+
     return cap;
 }
@@ -168,17 +168,52 @@ typedef struct PhysPageMap {
     unsigned nodes_nb_alloc;
     Node *nodes;
     MemoryRegionSection *sections;
+    /* Number of map entries and subpage slots pointing at each section */
+    unsigned *section_users;
+    /* Sections and nodes dropped by incremental updates, ready for reuse */
+    GArray *free_sections;
+    GArray *free_nodes;
 } PhysPageMap;
 
+/* Entry overwritten by phys_page_compact(), so that a copy of the map
+ * can be expanded back and updated in place.  @node is PHYS_MAP_NODE_NIL
+ * for the root entry.
+ */
+typedef struct PhysPageCompacted {
+    uint32_t node;
+    uint32_t idx;
+    PhysPageEntry orig;
+} PhysPageCompacted;
+
 struct AddressSpaceDispatch {
-    MemoryRegionSection *mru_section;
+    /* Unique for the whole run; tags the entries of dispatch_cache */
+    uint64_t gen;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
     PhysPageEntry phys_map;
     PhysPageMap map;
+    GArray *compacted;
 };
 
+/* Per-thread direct-mapped cache of recent page lookups, so that vCPUs
+ * and iothreads hopping between devices neither walk the radix tree
+ * every time nor fight over a shared most-recently-used pointer.  Every
+ * new dispatch gets a new generation, which retires the entries of the
+ * old one.
+ */
+#define DISPATCH_CACHE_BITS 6
+#define DISPATCH_CACHE_SIZE (1 << DISPATCH_CACHE_BITS)
+
+typedef struct DispatchCacheEntry {
+    uint64_t gen;
+    hwaddr index;
+    MemoryRegionSection *section;
+} DispatchCacheEntry;
+
+static __thread DispatchCacheEntry dispatch_cache[DISPATCH_CACHE_SIZE];
+static uint64_t dispatch_gen;
+
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
 typedef struct subpage_t {
     MemoryRegion iomem;
@@ -229,6 +264,8 @@ static void phys_map_node_reserve(PhysPageMap *map, unsigned nodes)
     }
 }
 
+static void phys_section_use(PhysPageMap *map, uint16_t section, int delta);
+
 static uint32_t phys_map_node_alloc(PhysPageMap *map, bool leaf)
 {
     unsigned i;
@@ -236,10 +273,16 @@ static uint32_t phys_map_node_alloc(PhysPageMap *map, bool leaf)
     PhysPageEntry e;
     PhysPageEntry *p;
 
-    ret = map->nodes_nb++;
+    if (map->free_nodes && map->free_nodes->len) {
+        ret = g_array_index(map->free_nodes, uint32_t,
+                            map->free_nodes->len - 1);
+        g_array_set_size(map->free_nodes, map->free_nodes->len - 1);
+    } else {
+        ret = map->nodes_nb++;
+        assert(ret != PHYS_MAP_NODE_NIL);
+        assert(ret != map->nodes_nb_alloc);
+    }
     p = map->nodes[ret];
-    assert(ret != PHYS_MAP_NODE_NIL);
-    assert(ret != map->nodes_nb_alloc);
 
     e.skip = leaf ? 0 : 1;
     e.ptr = leaf ? PHYS_SECTION_UNASSIGNED : PHYS_MAP_NODE_NIL;
@@ -249,6 +292,49 @@ static uint32_t phys_map_node_alloc(PhysPageMap *map, bool leaf)
     return ret;
 }
 
+/* Drop whatever @lp, an entry at @level, points to.  Only needed when
+ * updating an existing map; a map built from scratch never overwrites
+ * anything but empty entries.
+ */
+static void phys_page_drop(PhysPageMap *map, PhysPageEntry *lp, int level)
+{
+    uint32_t node = lp->ptr;
+    unsigned i;
+
+    if (!lp->skip) {
+        phys_section_use(map, lp->ptr, -1);
+        return;
+    }
+    if (node == PHYS_MAP_NODE_NIL) {
+        return;
+    }
+    for (i = 0; i < P_L2_SIZE; ++i) {
+        phys_page_drop(map, &map->nodes[node][i], level - 1);
+    }
+    if (!map->free_nodes) {
+        map->free_nodes = g_array_new(false, false, sizeof(uint32_t));
+    }
+    g_array_append_val(map->free_nodes, node);
+}
+
+/* Turn @lp, a leaf covering a whole node at @level, into a node whose
+ * entries all point to the same section.
+ */
+static void phys_page_split(PhysPageMap *map, PhysPageEntry *lp, int level)
+{
+    uint16_t section = lp->ptr;
+    uint32_t node = phys_map_node_alloc(map, level == 0);
+    unsigned i;
+
+    for (i = 0; i < P_L2_SIZE; ++i) {
+        map->nodes[node][i].skip = 0;
+        map->nodes[node][i].ptr = section;
+    }
+    phys_section_use(map, section, P_L2_SIZE - 1);
+    lp->skip = 1;
+    lp->ptr = node;
+}
+
 static void phys_page_set_level(PhysPageMap *map, PhysPageEntry *lp,
                                 hwaddr *index, hwaddr *nb, uint16_t leaf,
                                 int level)
@@ -258,14 +344,23 @@ static void phys_page_set_level(PhysPageMap *map, PhysPageEntry *lp,
 
     if (lp->skip && lp->ptr == PHYS_MAP_NODE_NIL) {
         lp->ptr = phys_map_node_alloc(map, level == 0);
+    } else if (!lp->skip) {
+        phys_page_split(map, lp, level);
     }
     p = map->nodes[lp->ptr];
     lp = &p[(*index >> (level * P_L2_BITS)) & (P_L2_SIZE - 1)];
 
     while (*nb && lp < &p[P_L2_SIZE]) {
         if ((*index & (step - 1)) == 0 && *nb >= step) {
-            lp->skip = 0;
-            lp->ptr = leaf;
+            phys_page_drop(map, lp, level);
+            if (level && leaf == PHYS_SECTION_UNASSIGNED) {
+                lp->skip = 1;
+                lp->ptr = PHYS_MAP_NODE_NIL;
+            } else {
+                lp->skip = 0;
+                lp->ptr = leaf;
+                phys_section_use(map, leaf, 1);
+            }
             *index += step;
             *nb -= step;
         } else {
@@ -288,11 +383,13 @@ static void phys_page_set(AddressSpaceDispatch *d,
 /* Compact a non leaf page entry. Simply detect that the entry has a single child,
  * and update our entry so we can skip it and go directly to the destination.
  */
-static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
+static void phys_page_compact(AddressSpaceDispatch *d, PhysPageEntry *lp)
 {
+    Node *nodes = d->map.nodes;
     unsigned valid_ptr = P_L2_SIZE;
     int valid = 0;
     PhysPageEntry *p;
+    PhysPageCompacted c;
     int i;
 
     if (lp->ptr == PHYS_MAP_NODE_NIL) {
@@ -308,7 +405,7 @@ static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
         valid_ptr = i;
         valid++;
         if (p[i].skip) {
-            phys_page_compact(&p[i], nodes);
+            phys_page_compact(d, &p[i]);
         }
     }
 
@@ -324,6 +421,16 @@ static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
         return;
     }
 
+    if (lp == &d->phys_map) {
+        c.node = PHYS_MAP_NODE_NIL;
+        c.idx = 0;
+    } else {
+        c.node = (lp - &nodes[0][0]) / P_L2_SIZE;
+        c.idx = (lp - &nodes[0][0]) % P_L2_SIZE;
+    }
+    c.orig = *lp;
+    g_array_append_val(d->compacted, c);
+
     lp->ptr = p[valid_ptr].ptr;
     if (!p[valid_ptr].skip) {
         /* If our only child is a leaf, make this a leaf. */
@@ -341,7 +448,7 @@ static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
 void address_space_dispatch_compact(AddressSpaceDispatch *d)
 {
     if (d->phys_map.skip) {
-        phys_page_compact(&d->phys_map, d->map.nodes);
+        phys_page_compact(d, &d->phys_map);
     }
 }
 
@@ -384,13 +491,19 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = atomic_read(&d->mru_section);
+    hwaddr index = addr >> TARGET_PAGE_BITS;
+    DispatchCacheEntry *e;
+    MemoryRegionSection *section;
     subpage_t *subpage;
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
-        !section_covers_addr(section, addr)) {
+    e = &dispatch_cache[(index ^ d->gen) & (DISPATCH_CACHE_SIZE - 1)];
+    if (e->gen == d->gen && e->index == index) {
+        section = e->section;
+    } else {
         section = phys_page_find(d, addr);
-        atomic_set(&d->mru_section, section);
+        e->gen = d->gen;
+        e->index = index;
+        e->section = section;
     }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
@@ -1067,6 +1180,15 @@ static void *(*phys_mem_alloc)(size_t size, uint64_t *align, bool shared) =
 static uint16_t phys_section_add(PhysPageMap *map,
                                  MemoryRegionSection *section)
 {
+    uint16_t n;
+
+    if (map->free_sections && map->free_sections->len) {
+        n = g_array_index(map->free_sections, uint16_t,
+                          map->free_sections->len - 1);
+        g_array_set_size(map->free_sections, map->free_sections->len - 1);
+        goto out;
+    }
+
     /* The physical section number is ORed with a page-aligned
      * pointer to produce the iotlb entries.  Thus it should
      * never overflow into the page-aligned value.
@@ -1077,10 +1199,15 @@ static uint16_t phys_section_add(PhysPageMap *map,
         map->sections_nb_alloc = MAX(map->sections_nb_alloc * 2, 16);
         map->sections = g_renew(MemoryRegionSection, map->sections,
                                 map->sections_nb_alloc);
+        map->section_users = g_renew(unsigned, map->section_users,
+                                     map->sections_nb_alloc);
     }
-    map->sections[map->sections_nb] = *section;
+    n = map->sections_nb++;
+out:
+    map->sections[n] = *section;
+    map->section_users[n] = 0;
     memory_region_ref(section->mr);
-    return map->sections_nb++;
+    return n;
 }
 
 static void phys_section_destroy(MemoryRegion *mr)
@@ -1096,14 +1223,55 @@ static void phys_section_destroy(MemoryRegion *mr)
     }
 }
 
+/* Account for @delta references to @section from the map, releasing the
+ * section once nothing points to it anymore.  The dummy sections live as
+ * long as the map.
+ */
+static void phys_section_use(PhysPageMap *map, uint16_t section, int delta)
+{
+    MemoryRegionSection *s = &map->sections[section];
+    unsigned i;
+
+    if (section <= PHYS_SECTION_WATCH) {
+        return;
+    }
+    map->section_users[section] += delta;
+    if (map->section_users[section]) {
+        return;
+    }
+
+    if (s->mr->subpage) {
+        subpage_t *subpage = container_of(s->mr, subpage_t, iomem);
+
+        for (i = 0; i < TARGET_PAGE_SIZE; i++) {
+            phys_section_use(map, subpage->sub_section[i], -1);
+        }
+    }
+    phys_section_destroy(s->mr);
+    s->mr = NULL;
+    if (!map->free_sections) {
+        map->free_sections = g_array_new(false, false, sizeof(uint16_t));
+    }
+    g_array_append_val(map->free_sections, section);
+}
+
 static void phys_sections_free(PhysPageMap *map)
 {
     while (map->sections_nb > 0) {
         MemoryRegionSection *section = &map->sections[--map->sections_nb];
-        phys_section_destroy(section->mr);
+        if (section->mr) {
+            phys_section_destroy(section->mr);
+        }
     }
     g_free(map->sections);
+    g_free(map->section_users);
     g_free(map->nodes);
+    if (map->free_sections) {
+        g_array_free(map->free_sections, true);
+    }
+    if (map->free_nodes) {
+        g_array_free(map->free_nodes, true);
+    }
 }
 
 static void register_subpage(FlatView *fv, MemoryRegionSection *section)
@@ -1118,6 +1286,7 @@ static void register_subpage(FlatView *fv, MemoryRegionSection *section)
         .size = int128_make64(TARGET_PAGE_SIZE),
     };
     hwaddr start, end;
+    uint16_t n;
 
     assert(existing->mr->subpage || existing->mr == &io_mem_unassigned);
 
@@ -1132,8 +1301,9 @@ static void register_subpage(FlatView *fv, MemoryRegionSection *section)
     }
     start = section->offset_within_address_space & ~TARGET_PAGE_MASK;
     end = start + int128_get64(section->size) - 1;
-    subpage_register(subpage, start, end,
-                     phys_section_add(&d->map, section));
+    n = phys_section_add(&d->map, section);
+    subpage_register(subpage, start, end, n);
+    phys_section_use(&d->map, n, end - start + 1);
 }
 
 
@@ -1331,7 +1501,15 @@ static void *file_ram_alloc(RAMBlock *block,
         perror("ftruncate");
     }
 
-    area = qemu_ram_mmap(fd, memory, block->mr->align,
+    /*
+     * Like anonymous RAM, place small-page files (tmpfs, memfd) so that
+     * transparent huge pages can back them.  This only affects the host
+     * address, not the alignment reported to the guest.
+     */
+    area = qemu_ram_mmap(fd, memory,
+                         block->page_size == getpagesize() ?
+                         MAX(block->mr->align, QEMU_VMALLOC_ALIGN) :
+                         block->mr->align,
                          block->flags & RAM_SHARED);
     if (area == MAP_FAILED) {
         error_setg_errno(errp, errno,
@@ -2313,13 +2491,94 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     assert(n == PHYS_SECTION_WATCH);
 
     d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
+    d->compacted = g_array_new(false, false, sizeof(PhysPageCompacted));
+    d->gen = ++dispatch_gen;
+
+    return d;
+}
+
+/* Copy @old into a new, uncompacted dispatch for @fv, to be updated with
+ * address_space_dispatch_clear() and flatview_add_to_dispatch() instead of
+ * being rebuilt from scratch.
+ */
+AddressSpaceDispatch *address_space_dispatch_clone(AddressSpaceDispatch *old,
+                                                   FlatView *fv)
+{
+    AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
+    PhysPageMap *map = &d->map;
+    unsigned i;
+
+    d->gen = ++dispatch_gen;
+    d->phys_map = old->phys_map;
+    map->nodes_nb = map->nodes_nb_alloc = old->map.nodes_nb;
+    map->nodes = g_memdup(old->map.nodes, map->nodes_nb * sizeof(Node));
+    for (i = old->compacted->len; i-- > 0; ) {
+        PhysPageCompacted *c = &g_array_index(old->compacted,
+                                              PhysPageCompacted, i);
+
+        if (c->node == PHYS_MAP_NODE_NIL) {
+            d->phys_map = c->orig;
+        } else {
+            map->nodes[c->node][c->idx] = c->orig;
+        }
+    }
+    d->compacted = g_array_new(false, false, sizeof(PhysPageCompacted));
+
+    map->sections_nb = map->sections_nb_alloc = old->map.sections_nb;
+    map->sections = g_memdup(old->map.sections,
+                             map->sections_nb * sizeof(MemoryRegionSection));
+    map->section_users = g_memdup(old->map.section_users,
+                                  map->sections_nb * sizeof(unsigned));
+    for (i = 0; i < map->sections_nb; i++) {
+        MemoryRegionSection *section = &map->sections[i];
+
+        if (!section->mr) {
+            continue;
+        }
+        section->fv = fv;
+        if (section->mr->subpage) {
+            subpage_t *orig = container_of(section->mr, subpage_t, iomem);
+            subpage_t *subpage = subpage_init(fv, orig->base);
+
+            memcpy(subpage->sub_section, orig->sub_section,
+                   TARGET_PAGE_SIZE * sizeof(uint16_t));
+            section->mr = &subpage->iomem;
+        }
+        memory_region_ref(section->mr);
+    }
+    if (old->map.free_sections) {
+        map->free_sections = g_array_sized_new(false, false, sizeof(uint16_t),
+                                               old->map.free_sections->len);
+        g_array_append_vals(map->free_sections, old->map.free_sections->data,
+                            old->map.free_sections->len);
+    }
+    if (old->map.free_nodes) {
+        map->free_nodes = g_array_sized_new(false, false, sizeof(uint32_t),
+                                            old->map.free_nodes->len);
+        g_array_append_vals(map->free_nodes, old->map.free_nodes->data,
+                            old->map.free_nodes->len);
+    }
 
     return d;
 }
 
+/* Unmap the pages covering [*start, *last], widening the range to page
+ * boundaries.  The caller then adds back every section in that range.
+ */
+void address_space_dispatch_clear(AddressSpaceDispatch *d,
+                                  hwaddr *start, hwaddr *last)
+{
+    *start &= TARGET_PAGE_MASK;
+    *last |= ~TARGET_PAGE_MASK;
+    phys_page_set(d, *start >> TARGET_PAGE_BITS,
+                  ((*last - *start) >> TARGET_PAGE_BITS) + 1,
+                  PHYS_SECTION_UNASSIGNED);
+}
+
 void address_space_dispatch_free(AddressSpaceDispatch *d)
 {
     phys_sections_free(&d->map);
+    g_array_free(d->compacted, true);
     g_free(d);
 }
 
@@ -2633,6 +2892,61 @@ MemTxResult address_space_rw(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
     }
 }
 
+MemTxResult address_space_copy(AddressSpace *as, hwaddr addr,
+                               MemTxAttrs attrs, void *buf, hwaddr len,
+                               bool is_write, unsigned flags)
+{
+    MemTxResult result = MEMTX_OK;
+    bool nt = flags & MEMTX_COPY_NONTEMPORAL;
+    uint8_t *p = buf;
+    hwaddr done = 0;
+    FlatView *fv;
+
+    if (!len) {
+        return MEMTX_OK;
+    }
+
+    trace_address_space_copy(as, addr, len, is_write, nt);
+    rcu_read_lock();
+    fv = address_space_to_flatview(as);
+    while (done < len) {
+        hwaddr l = len - done;
+        hwaddr xlat;
+        MemoryRegion *mr = flatview_translate(fv, addr + done, &xlat, &l,
+                                              is_write);
+
+        if (memory_access_is_direct(mr, is_write)) {
+            /* One copy for the whole RAM run; @buf may be guest RAM too */
+            uint8_t *ram = qemu_ram_ptr_length(mr->ram_block, xlat, &l, false);
+            uint8_t *dst = is_write ? ram : p + done;
+            uint8_t *src = is_write ? p + done : ram;
+
+            if (nt && !ranges_overlap((uintptr_t)dst, l, (uintptr_t)src, l)) {
+                qemu_memcpy_nontemporal(dst, src, l);
+            } else {
+                memmove(dst, src, l);
+            }
+            if (is_write) {
+                invalidate_and_set_dirty(mr, xlat, l);
+            }
+        } else {
+            l = MIN(l, INT_MAX);
+            if (is_write) {
+                result |= flatview_write_continue(fv, addr + done, attrs,
+                                                  p + done, l, xlat, l, mr);
+            } else {
+                result |= flatview_read_continue(fv, addr + done, attrs,
+                                                 p + done, l, xlat, l, mr);
+            }
+        }
+        done += l;
+    }
+    rcu_read_unlock();
+
+    atomic_add(is_write ? &as->copy_bytes_to : &as->copy_bytes_from, len);
+    return result;
+}
+
 void cpu_physical_memory_rw(hwaddr addr, uint8_t *buf,
                             int len, int is_write)
 {
@@ -2700,53 +3014,51 @@ void cpu_flush_icache_range(hwaddr start, int len)
                                            start, NULL, len, FLUSH_CACHE);
 }
 
+#define BOUNCE_BUFFER_MAGIC 0xb4017ceb4ffe12edULL
+
 typedef struct {
+    uint64_t magic;
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
-    hwaddr len;
-    bool in_use;
+    size_t len;
+    uint8_t buffer[];
 } BounceBuffer;
 
-static BounceBuffer bounce;
-
-typedef struct MapClient {
+struct AddressSpaceMapClient {
     QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(map_client_list, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+};
 
-static void cpu_unregister_map_client_do(MapClient *client)
+static void address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    qemu_mutex_lock(&as->map_client_list_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    /* Write map_client_list before reading bounce_buffer_size.  */
+    smp_mb();
+    if (atomic_read(&as->bounce_buffer_size) < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -2762,28 +3074,27 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    qemu_mutex_lock(&as->map_client_list_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
-static void cpu_notify_map_clients(void)
+static void address_space_notify_map_clients(AddressSpace *as)
 {
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_lock(&as->map_client_list_lock);
+    address_space_notify_map_clients_locked(as);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, int len,
@@ -2839,8 +3150,8 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -2863,26 +3174,47 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        size_t used = atomic_read(&as->bounce_buffer_size);
+        BounceBuffer *bounce;
+
+        /* Grab as much of the remaining bounce buffer space as needed */
+        for (;;) {
+            hwaddr alloc = MIN(as->max_bounce_buffer_size - MIN(used,
+                               as->max_bounce_buffer_size), l);
+            size_t actual = atomic_cmpxchg(&as->bounce_buffer_size, used,
+                                           used + alloc);
+            if (actual == used) {
+                l = alloc;
+                break;
+            }
+            used = actual;
+        }
+
+        if (l == 0) {
+            atomic_inc(&as->bounce_waits);
+            trace_address_space_map_bounce_wait(as, addr, len);
             rcu_read_unlock();
+            *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        atomic_inc(&as->bounce_maps);
+        trace_address_space_map_bounce(as, addr, l, used + l);
 
+        bounce = g_malloc0(l + sizeof(BounceBuffer));
+        bounce->magic = BOUNCE_BUFFER_MAGIC;
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
+        bounce->addr = addr;
+        bounce->len = l;
+
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                          bounce->buffer, l);
         }
 
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -2902,27 +3234,34 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
-        MemoryRegion *mr;
-        ram_addr_t addr1;
+    MemoryRegion *mr;
+    ram_addr_t addr1;
+    BounceBuffer *bounce;
 
-        mr = memory_region_from_host(buffer, &addr1);
-        assert(mr != NULL);
+    mr = memory_region_from_host(buffer, &addr1);
+    if (mr != NULL) {
         if (is_write) {
             invalidate_and_set_dirty(mr, addr1, access_len);
         }
         memory_region_unref(mr);
         return;
     }
+
+    bounce = container_of(buffer, BounceBuffer, buffer);
+    assert(bounce->magic == BOUNCE_BUFFER_MAGIC);
+
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
-    cpu_notify_map_clients();
+
+    atomic_sub(&as->bounce_buffer_size, bounce->len);
+    bounce->magic = ~BOUNCE_BUFFER_MAGIC;
+    memory_region_unref(bounce->mr);
+    g_free(bounce);
+    /* Write bounce_buffer_size before reading map_client_list.  */
+    smp_mb();
+    address_space_notify_map_clients(as);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
@@ -3224,7 +3563,7 @@ void mtree_print_dispatch(fprintf_function mon, void *f,
 {
     int i;
 
-    mon(f, "  Dispatch\n");
+    mon(f, "  Dispatch (generation %" PRIu64 ")\n", d->gen);
     mon(f, "    Physical sections\n");
 
     for (i = 0; i < d->map.sections_nb; ++i) {
@@ -3232,14 +3571,17 @@ void mtree_print_dispatch(fprintf_function mon, void *f,
         const char *names[] = { " [unassigned]", " [not dirty]",
                                 " [ROM]", " [watch]" };
 
-        mon(f, "      #%d @" TARGET_FMT_plx ".." TARGET_FMT_plx " %s%s%s%s%s",
+        if (!s->mr) {
+            mon(f, "      #%d [free]\n", i);
+            continue;
+        }
+        mon(f, "      #%d @" TARGET_FMT_plx ".." TARGET_FMT_plx " %s%s%s%s",
             i,
             s->offset_within_address_space,
             s->offset_within_address_space + MR_SIZE(s->mr->size),
             s->mr->name ? s->mr->name : "(noname)",
             i < ARRAY_SIZE(names) ? names[i] : "",
             s->mr == root ? " [ROOT]" : "",
-            s == d->mru_section ? " [MRU]" : "",
             s->mr->is_iommu ? " [iommu]" : "");
 
         if (s->mr->alias) {
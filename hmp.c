@@ -93,6 +93,14 @@ void hmp_info_kvm(Monitor *mon, const QDict *qdict)
     } else {
         monitor_printf(mon, "not compiled\n");
     }
+    if (info->has_halt_poll_ns) {
+        monitor_printf(mon, "halt-poll-ns: %" PRId64 "\n", info->halt_poll_ns);
+    }
+    if (info->has_halt_poll_successful) {
+        monitor_printf(mon, "halt polls: %" PRId64 " successful, %" PRId64
+                       " failed\n", info->halt_poll_successful,
+                       info->halt_poll_failed);
+    }
 
     qapi_free_KvmInfo(info);
 }
@@ -579,7 +587,14 @@ void hmp_info_balloon(Monitor *mon, const QDict *qdict)
         return;
     }
 
-    monitor_printf(mon, "balloon: actual=%" PRId64 "\n", info->actual >> 20);
+    monitor_printf(mon, "balloon: actual=%" PRId64, info->actual >> 20);
+    if (info->has_free_page_reported) {
+        monitor_printf(mon, " free_page_reported=%" PRId64
+                       " free_page_discarded=%" PRId64,
+                       info->free_page_reported >> 20,
+                       info->free_page_discarded >> 20);
+    }
+    monitor_printf(mon, "\n");
 
     qapi_free_BalloonInfo(info);
 }
@@ -1700,6 +1715,7 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     bool zlib = qdict_get_try_bool(qdict, "zlib", false);
     bool lzo = qdict_get_try_bool(qdict, "lzo", false);
     bool snappy = qdict_get_try_bool(qdict, "snappy", false);
+    bool zstd = qdict_get_try_bool(qdict, "zstd", false);
     const char *file = qdict_get_str(qdict, "filename");
     bool has_begin = qdict_haskey(qdict, "begin");
     bool has_length = qdict_haskey(qdict, "length");
@@ -1710,8 +1726,8 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     enum DumpGuestMemoryFormat dump_format = DUMP_GUEST_MEMORY_FORMAT_ELF;
     char *prot;
 
-    if (zlib + lzo + snappy > 1) {
-        error_setg(&err, "only one of '-z|-l|-s' can be set");
+    if (zlib + lzo + snappy + zstd > 1) {
+        error_setg(&err, "only one of '-z|-l|-s|-Z' can be set");
         hmp_handle_error(mon, &err);
         return;
     }
@@ -1728,6 +1744,10 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
         dump_format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
     }
 
+    if (zstd) {
+        dump_format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+    }
+
     if (has_begin) {
         begin = qdict_get_int(qdict, "begin");
     }
@@ -1978,6 +1998,23 @@ void hmp_info_memdev(Monitor *mon, const QDict *qdict)
                        HostMemPolicy_str(m->value->policy));
         visit_complete(v, &str);
         monitor_printf(mon, "  host nodes: %s\n", str);
+        monitor_printf(mon, "  thp: %s\n", OnOffAuto_str(m->value->thp));
+        if (m->value->has_thp_size) {
+            monitor_printf(mon, "  thp size: %" PRIu64 "\n",
+                           m->value->thp_size);
+        }
+        monitor_printf(mon, "  host nodes follow: %s\n",
+                       m->value->host_nodes_follow ? "true" : "false");
+        if (m->value->has_rebind) {
+            MemdevRebindInfo *r = m->value->rebind;
+
+            monitor_printf(mon, "  rebind: %s, %" PRIu64 "/%" PRIu64 "\n",
+                           MemdevRebindStatus_str(r->status),
+                           r->done, r->total);
+            if (r->has_error) {
+                monitor_printf(mon, "  rebind error: %s\n", r->error);
+            }
+        }
 
         g_free(str);
         visit_free(v);
@@ -1997,6 +2034,7 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
     MemoryDeviceInfoList *info;
     MemoryDeviceInfo *value;
     PCDIMMDeviceInfo *di;
+    VirtioMEMDeviceInfo *vmi;
 
     for (info = info_list; info; info = info->next) {
         value = info->value;
@@ -2011,6 +2049,25 @@ void hmp_info_memory_devices(Monitor *mon, const QDict *qdict)
                 di = value->u.nvdimm.data;
                 break;
 
+            case MEMORY_DEVICE_INFO_KIND_VIRTIO_MEM:
+                di = NULL;
+                vmi = value->u.virtio_mem.data;
+                monitor_printf(mon, "Memory device [%s]: \"%s\"\n",
+                               MemoryDeviceInfoKind_str(value->type),
+                               vmi->has_id ? vmi->id : "");
+                monitor_printf(mon, "  memaddr: 0x%" PRIx64 "\n",
+                               vmi->memaddr);
+                monitor_printf(mon, "  node: %" PRId64 "\n", vmi->node);
+                monitor_printf(mon, "  requested-size: %" PRIu64 "\n",
+                               vmi->requested_size);
+                monitor_printf(mon, "  size: %" PRIu64 "\n", vmi->size);
+                monitor_printf(mon, "  max-size: %" PRIu64 "\n",
+                               vmi->max_size);
+                monitor_printf(mon, "  block-size: %" PRIu64 "\n",
+                               vmi->block_size);
+                monitor_printf(mon, "  memdev: %s\n", vmi->memdev);
+                break;
+
             default:
                 di = NULL;
                 break;
@@ -2050,6 +2107,10 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-forever=%s\n",
+                       value->poll_forever ? "on" : "off");
+        monitor_printf(mon, "  poll-idle-ns=%" PRId64 "\n", value->poll_idle_ns);
+        monitor_printf(mon, "  poll-budget=%" PRId64 "\n", value->poll_budget);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -171,6 +171,8 @@ static void acpi_pcihp_eject_slot(AcpiPciHpState *s, unsigned bsel, unsigned slo
         PCIDevice *dev = PCI_DEVICE(qdev);
         if (PCI_SLOT(dev->devfn) == slot) {
             if (!acpi_pcihp_pc_no_hotplug(s, dev)) {
+                hotplug_handler_unplug(qdev_get_hotplug_handler(qdev), qdev,
+                                       &error_abort);
                 object_unparent(OBJECT(qdev));
             }
         }
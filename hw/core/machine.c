@@ -102,6 +102,38 @@ static void machine_set_kvm_shadow_mem(Object *obj, Visitor *v,
     ms->kvm_shadow_mem = value;
 }
 
+static void machine_get_kvm_halt_poll_ns(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    int64_t value = ms->kvm_halt_poll_ns;
+
+    visit_type_int(v, name, &value, errp);
+}
+
+static void machine_set_kvm_halt_poll_ns(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    int64_t value;
+
+    visit_type_int(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value < 0 || value > UINT32_MAX) {
+        error_setg(errp, "kvm-halt-poll-ns must be between 0 and %" PRIu32,
+                   UINT32_MAX);
+        return;
+    }
+
+    ms->kvm_halt_poll_ns = value;
+}
+
 static char *machine_get_kernel(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -548,6 +580,12 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size", &error_abort);
 
+    object_class_property_add(oc, "kvm-halt-poll-ns", "int",
+        machine_get_kvm_halt_poll_ns, machine_set_kvm_halt_poll_ns,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "kvm-halt-poll-ns",
+        "KVM halt-polling limit for this VM, in nanoseconds", &error_abort);
+
     object_class_property_add_str(oc, "kernel",
         machine_get_kernel, machine_set_kernel, &error_abort);
     object_class_property_set_description(oc, "kernel",
@@ -653,6 +691,7 @@ static void machine_initfn(Object *obj)
 
     ms->kernel_irqchip_allowed = true;
     ms->kvm_shadow_mem = -1;
+    ms->kvm_halt_poll_ns = -1;
     ms->dump_guest_core = true;
     ms->mem_merge = true;
     ms->enable_graphics = true;
@@ -691,6 +730,11 @@ int machine_kvm_shadow_mem(MachineState *machine)
     return machine->kvm_shadow_mem;
 }
 
+int64_t machine_kvm_halt_poll_ns(MachineState *machine)
+{
+    return machine->kvm_halt_poll_ns;
+}
+
 int machine_phandle_start(MachineState *machine)
 {
     return machine->phandle_start;
@@ -1635,18 +1635,19 @@ build_tpm2(GArray *table_data, BIOSLinker *linker, GArray *tcpalog)
 static void build_srat_hotpluggable_memory(GArray *table_data, uint64_t base,
                                            uint64_t len, int default_node)
 {
-    MemoryDeviceInfoList *info_list = qmp_pc_dimm_device_list();
+    MemoryDeviceInfoList *info_list = qmp_memory_device_list();
     MemoryDeviceInfoList *info;
     MemoryDeviceInfo *mi;
     PCDIMMDeviceInfo *di;
-    uint64_t end = base + len, cur, size;
-    bool is_nvdimm;
+    VirtioMEMDeviceInfo *vi;
+    uint64_t end = base + len, cur, size, addr;
+    int node;
     AcpiSratMemoryAffinity *numamem;
     MemoryAffinityFlags flags;
 
     for (cur = base, info = info_list;
          cur < end;
-         cur += size, info = info->next) {
+         cur = addr + size, info = info->next) {
         numamem = acpi_data_push(table_data, sizeof *numamem);
 
         if (!info) {
@@ -1656,26 +1657,38 @@ static void build_srat_hotpluggable_memory(GArray *table_data, uint64_t base,
         }
 
         mi = info->value;
-        is_nvdimm = (mi->type == MEMORY_DEVICE_INFO_KIND_NVDIMM);
-        di = !is_nvdimm ? mi->u.dimm.data : mi->u.nvdimm.data;
-
-        if (cur < di->addr) {
-            build_srat_memory(numamem, cur, di->addr - cur, default_node,
-                              MEM_AFFINITY_HOTPLUGGABLE | MEM_AFFINITY_ENABLED);
-            numamem = acpi_data_push(table_data, sizeof *numamem);
-        }
-
-        size = di->size;
-
         flags = MEM_AFFINITY_ENABLED;
-        if (di->hotpluggable) {
+        switch (mi->type) {
+        case MEMORY_DEVICE_INFO_KIND_VIRTIO_MEM:
+            /* The whole region: the guest adds memory blocks from it later */
+            vi = mi->u.virtio_mem.data;
+            addr = vi->memaddr;
+            size = vi->max_size;
+            node = vi->node;
             flags |= MEM_AFFINITY_HOTPLUGGABLE;
-        }
-        if (is_nvdimm) {
+            break;
+        case MEMORY_DEVICE_INFO_KIND_NVDIMM:
             flags |= MEM_AFFINITY_NON_VOLATILE;
+            /* fall through */
+        default:
+            di = mi->type == MEMORY_DEVICE_INFO_KIND_NVDIMM ?
+                 mi->u.nvdimm.data : mi->u.dimm.data;
+            addr = di->addr;
+            size = di->size;
+            node = di->node;
+            if (di->hotpluggable) {
+                flags |= MEM_AFFINITY_HOTPLUGGABLE;
+            }
+            break;
+        }
+
+        if (cur < addr) {
+            build_srat_memory(numamem, cur, addr - cur, default_node,
+                              MEM_AFFINITY_HOTPLUGGABLE | MEM_AFFINITY_ENABLED);
+            numamem = acpi_data_push(table_data, sizeof *numamem);
         }
 
-        build_srat_memory(numamem, di->addr, size, di->node, flags);
+        build_srat_memory(numamem, addr, size, node, flags);
     }
 
     qapi_free_MemoryDeviceInfoList(info_list);
@@ -58,6 +58,7 @@
 #include "hw/pci/pci_host.h"
 #include "acpi-build.h"
 #include "hw/mem/pc-dimm.h"
+#include "hw/mem/memory-device.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-common.h"
 #include "qapi/visitor.h"
@@ -1162,6 +1163,81 @@ static void pc_dimm_unplug(HotplugHandler *hotplug_dev,
     error_propagate(errp, local_err);
 }
 
+/*
+ * Memory devices other than DIMMs (virtio-mem-pci) sit on another bus: the
+ * machine maps their memory and leaves the rest to the bus hotplug handler.
+ */
+static void pc_memory_device_pre_plug(HotplugHandler *hotplug_dev,
+                                      DeviceState *dev, Error **errp)
+{
+    HotplugHandler *bus_handler = qdev_get_bus_hotplug_handler(dev);
+    PCMachineState *pcms = PC_MACHINE(hotplug_dev);
+
+    if (!memory_region_size(&pcms->hotplug_memory.mr)) {
+        error_setg(errp, "memory devices are not enabled, please specify"
+                   " the maxmem option");
+        return;
+    }
+
+    if (bus_handler) {
+        hotplug_handler_pre_plug(bus_handler, dev, errp);
+    }
+}
+
+static void pc_memory_device_plug(HotplugHandler *hotplug_dev,
+                                  DeviceState *dev, Error **errp)
+{
+    HotplugHandler *bus_handler = qdev_get_bus_hotplug_handler(dev);
+    PCMachineState *pcms = PC_MACHINE(hotplug_dev);
+    Error *local_err = NULL;
+
+    memory_device_plug(MEMORY_DEVICE(dev), &pcms->hotplug_memory,
+                       TARGET_PAGE_SIZE, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (bus_handler) {
+        hotplug_handler_plug(bus_handler, dev, &local_err);
+        if (local_err) {
+            memory_device_unplug(MEMORY_DEVICE(dev), &pcms->hotplug_memory);
+        }
+    }
+out:
+    error_propagate(errp, local_err);
+}
+
+static void pc_memory_device_unplug_request(HotplugHandler *hotplug_dev,
+                                            DeviceState *dev, Error **errp)
+{
+    HotplugHandler *bus_handler = qdev_get_bus_hotplug_handler(dev);
+
+    if (!bus_handler) {
+        error_setg(errp, "memory device unplug is not supported on this bus");
+        return;
+    }
+    hotplug_handler_unplug_request(bus_handler, dev, errp);
+}
+
+static void pc_memory_device_unplug(HotplugHandler *hotplug_dev,
+                                    DeviceState *dev, Error **errp)
+{
+    HotplugHandler *bus_handler = qdev_get_bus_hotplug_handler(dev);
+    PCMachineState *pcms = PC_MACHINE(hotplug_dev);
+    Error *local_err = NULL;
+
+    if (bus_handler) {
+        hotplug_handler_unplug(bus_handler, dev, &local_err);
+        if (local_err) {
+            goto out;
+        }
+    }
+
+    memory_device_unplug(MEMORY_DEVICE(dev), &pcms->hotplug_memory);
+out:
+    error_propagate(errp, local_err);
+}
+
 static int pc_apic_cmp(const void *a, const void *b)
 {
    CPUArchId *apic_a = (CPUArchId *)a;
@@ -1390,6 +1466,9 @@ static void pc_machine_device_pre_plug_cb(HotplugHandler *hotplug_dev,
 {
     if (object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
         pc_cpu_pre_plug(hotplug_dev, dev, errp);
+    } else if (object_dynamic_cast(OBJECT(dev), TYPE_MEMORY_DEVICE) &&
+               !object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM)) {
+        pc_memory_device_pre_plug(hotplug_dev, dev, errp);
     }
 }
 
@@ -1398,6 +1477,8 @@ static void pc_machine_device_plug_cb(HotplugHandler *hotplug_dev,
 {
     if (object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM)) {
         pc_dimm_plug(hotplug_dev, dev, errp);
+    } else if (object_dynamic_cast(OBJECT(dev), TYPE_MEMORY_DEVICE)) {
+        pc_memory_device_plug(hotplug_dev, dev, errp);
     } else if (object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
         pc_cpu_plug(hotplug_dev, dev, errp);
     }
@@ -1408,6 +1489,8 @@ static void pc_machine_device_unplug_request_cb(HotplugHandler *hotplug_dev,
 {
     if (object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM)) {
         pc_dimm_unplug_request(hotplug_dev, dev, errp);
+    } else if (object_dynamic_cast(OBJECT(dev), TYPE_MEMORY_DEVICE)) {
+        pc_memory_device_unplug_request(hotplug_dev, dev, errp);
     } else if (object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
         pc_cpu_unplug_request_cb(hotplug_dev, dev, errp);
     } else {
@@ -1421,6 +1504,8 @@ static void pc_machine_device_unplug_cb(HotplugHandler *hotplug_dev,
 {
     if (object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM)) {
         pc_dimm_unplug(hotplug_dev, dev, errp);
+    } else if (object_dynamic_cast(OBJECT(dev), TYPE_MEMORY_DEVICE)) {
+        pc_memory_device_unplug(hotplug_dev, dev, errp);
     } else if (object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
         pc_cpu_unplug_cb(hotplug_dev, dev, errp);
     } else {
@@ -1434,7 +1519,7 @@ static HotplugHandler *pc_get_hotpug_handler(MachineState *machine,
 {
     PCMachineClass *pcmc = PC_MACHINE_GET_CLASS(machine);
 
-    if (object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM) ||
+    if (object_dynamic_cast(OBJECT(dev), TYPE_MEMORY_DEVICE) ||
         object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
         return HOTPLUG_HANDLER(machine);
     }
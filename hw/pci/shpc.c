@@ -245,6 +245,10 @@ static void shpc_free_devices_in_slot(SHPCDevice *shpc, int slot)
          ++devfn) {
         PCIDevice *affected_dev = shpc->sec_bus->devices[devfn];
         if (affected_dev) {
+            DeviceState *qdev = DEVICE(affected_dev);
+
+            hotplug_handler_unplug(qdev_get_hotplug_handler(qdev), qdev,
+                                   &error_abort);
             object_unparent(OBJECT(affected_dev));
         }
     }
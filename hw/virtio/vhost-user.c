@@ -29,6 +29,9 @@
 #include <linux/userfaultfd.h>
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
+/* Upper bound for VHOST_USER_GET_MAX_MEM_SLOTS */
+#define VHOST_USER_MAX_RAM_SLOTS     512
+#define VHOST_USER_SLAVE_MAX_FDS     8
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 
 /*
@@ -47,10 +50,18 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_CRYPTO_SESSION = 7,
     VHOST_USER_PROTOCOL_F_PAGEFAULT = 8,
     VHOST_USER_PROTOCOL_F_CONFIG = 9,
+    VHOST_USER_PROTOCOL_F_HOST_NOTIFIER = 11,
+    VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
-#define VHOST_USER_PROTOCOL_FEATURE_MASK ((1 << VHOST_USER_PROTOCOL_F_MAX) - 1)
+/* The other bits above 9 are assigned to features not implemented here */
+#define VHOST_USER_PROTOCOL_FEATURE_MASK \
+    (((1ULL << (VHOST_USER_PROTOCOL_F_CONFIG + 1)) - 1) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_HOST_NOTIFIER) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD) | \
+     (1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS))
 
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
@@ -84,6 +95,11 @@ typedef enum VhostUserRequest {
     VHOST_USER_POSTCOPY_ADVISE  = 28,
     VHOST_USER_POSTCOPY_LISTEN  = 29,
     VHOST_USER_POSTCOPY_END     = 30,
+    VHOST_USER_GET_INFLIGHT_FD = 31,
+    VHOST_USER_SET_INFLIGHT_FD = 32,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -91,6 +107,7 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_NONE = 0,
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
+    VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -107,11 +124,23 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
 } VhostUserLog;
 
+typedef struct VhostUserInflight {
+    uint64_t mmap_size;
+    uint64_t mmap_offset;
+    uint16_t num_queues;
+    uint16_t queue_size;
+} VhostUserInflight;
+
 typedef struct VhostUserConfig {
     uint32_t offset;
     uint32_t size;
@@ -130,6 +159,12 @@ typedef struct VhostUserCryptoSession {
     uint8_t auth_key[VHOST_CRYPTO_SYM_HMAC_MAX_KEY_LEN];
 } VhostUserCryptoSession;
 
+typedef struct VhostUserVringArea {
+    uint64_t u64;
+    uint64_t size;
+    uint64_t offset;
+} VhostUserVringArea;
+
 static VhostUserConfig c __attribute__ ((unused));
 #define VHOST_USER_CONFIG_HDR_SIZE (sizeof(c.offset) \
                                    + sizeof(c.size) \
@@ -152,10 +187,13 @@ typedef union {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
         struct vhost_iotlb_msg iotlb;
         VhostUserConfig config;
         VhostUserCryptoSession session;
+        VhostUserInflight inflight;
+        VhostUserVringArea area;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -171,6 +209,15 @@ static VhostUserMsg m __attribute__ ((unused));
 /* The version of the protocol we support */
 #define VHOST_USER_VERSION    (0x1)
 
+/* A queue notification area mapped from the backend, see
+ * VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG.
+ */
+typedef struct VhostUserHostNotifier {
+    MemoryRegion mr;
+    void *addr;
+    bool set;
+} VhostUserHostNotifier;
+
 struct vhost_user {
     struct vhost_dev *dev;
     CharBackend *chr;
@@ -189,6 +236,17 @@ struct vhost_user {
 
     /* True once we've entered postcopy_listen */
     bool               postcopy_listen;
+
+    /* Maximum number of memory regions the backend accepts */
+    uint64_t           max_mem_slots;
+    /* With VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS, the regions that
+     * the backend currently has mapped.
+     */
+    VhostUserMemoryRegion *shadow_regions;
+    int                num_shadow_regions;
+
+    /* Notification areas handed over by the backend, by queue index */
+    VhostUserHostNotifier notifier[VIRTIO_QUEUE_MAX];
 };
 
 static bool ioeventfd_enabled(void)
@@ -272,6 +330,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_SET_OWNER:
     case VHOST_USER_RESET_OWNER:
     case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
     case VHOST_USER_GET_QUEUE_NUM:
     case VHOST_USER_NET_SET_MTU:
         return true;
@@ -370,6 +430,12 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
         .hdr.flags = VHOST_USER_VERSION,
     };
 
+    if (dev->mem->nregions > VHOST_MEMORY_MAX_NREGIONS) {
+        error_report("%s: postcopy supports at most %d memory regions",
+                     __func__, VHOST_MEMORY_MAX_NREGIONS);
+        return -1;
+    }
+
     if (reply_supported) {
         msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
     }
@@ -496,14 +562,186 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
     return 0;
 }
 
+/* Fill @regions, and @fds if not NULL, with the memory regions that can
+ * be shared with the backend.  Returns the number of regions, or -1 if
+ * there are more than @max of them.
+ */
+static int vhost_user_fill_mem_regions(struct vhost_dev *dev,
+                                       VhostUserMemoryRegion *regions,
+                                       int *fds, int max)
+{
+    int i, fd, n = 0;
+
+    for (i = 0; i < dev->mem->nregions; ++i) {
+        struct vhost_memory_region *reg = dev->mem->regions + i;
+        ram_addr_t offset;
+        MemoryRegion *mr;
+
+        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
+        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
+                                     &offset);
+        fd = memory_region_get_fd(mr);
+        if (fd > 0) {
+            if (n == max) {
+                return -1;
+            }
+            regions[n].userspace_addr = reg->userspace_addr;
+            regions[n].memory_size  = reg->memory_size;
+            regions[n].guest_phys_addr = reg->guest_phys_addr;
+            regions[n].mmap_offset = offset;
+            if (fds) {
+                fds[n] = fd;
+            }
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static bool vhost_user_find_mem_region(const VhostUserMemoryRegion *regions,
+                                       int nregions,
+                                       const VhostUserMemoryRegion *reg)
+{
+    int i;
+
+    for (i = 0; i < nregions; i++) {
+        if (regions[i].guest_phys_addr == reg->guest_phys_addr &&
+            regions[i].memory_size == reg->memory_size &&
+            regions[i].userspace_addr == reg->userspace_addr &&
+            regions[i].mmap_offset == reg->mmap_offset) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Returns -1 on error, 1 if a reply has to be read, 0 otherwise */
+static int vhost_user_send_mem_reg(struct vhost_dev *dev,
+                                   VhostUserRequest request,
+                                   const VhostUserMemoryRegion *reg, int fd)
+{
+    VhostUserMsg msg = {
+        .hdr.request = request,
+        .hdr.flags = VHOST_USER_VERSION,
+        .hdr.size = sizeof(msg.payload.mem_reg),
+        .payload.mem_reg.region = *reg,
+    };
+
+    if (virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_REPLY_ACK)) {
+        msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+    }
+
+    if (vhost_user_write(dev, &msg, fd >= 0 ? &fd : NULL, fd >= 0) < 0) {
+        return -1;
+    }
+
+    return !!(msg.hdr.flags & VHOST_USER_NEED_REPLY_MASK);
+}
+
+/* With VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS only the regions that
+ * changed since the last update are sent, so that the backend does not
+ * have to remap the whole guest memory on every hotplug.  Stale regions are
+ * removed first, then new ones are added.  The messages are sent back to
+ * back and the REPLY_ACK replies, if any, are collected at the end.
+ */
+static int vhost_user_update_mem_regions(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion *regions, *reg;
+    VhostUserMsg msg;
+    int *fds;
+    int nregions, nr_rem_replies = 0, nr_replies = 0;
+    bool failed = false;
+    int i, j, r, ret = -1;
+
+    regions = g_new(VhostUserMemoryRegion, u->max_mem_slots);
+    fds = g_new(int, u->max_mem_slots);
+
+    nregions = vhost_user_fill_mem_regions(dev, regions, fds,
+                                           u->max_mem_slots);
+    if (nregions < 0) {
+        error_report("vhost-user backend supports at most %" PRIu64
+                     " memory regions", u->max_mem_slots);
+        goto out;
+    }
+    if (!nregions) {
+        error_report("Failed initializing vhost-user memory map, "
+                     "consider using -object memory-backend-file share=on");
+        goto out;
+    }
+
+    for (i = 0, j = 0; i < u->num_shadow_regions; i++) {
+        reg = &u->shadow_regions[i];
+        if (!failed && !vhost_user_find_mem_region(regions, nregions, reg)) {
+            trace_vhost_user_rem_mem_reg(reg->guest_phys_addr,
+                                         reg->memory_size,
+                                         reg->userspace_addr);
+            r = vhost_user_send_mem_reg(dev, VHOST_USER_REM_MEM_REG, reg, -1);
+            if (r >= 0) {
+                nr_rem_replies += r;
+                continue;
+            }
+            failed = true;
+        }
+        /* Still mapped by the backend */
+        u->shadow_regions[j++] = *reg;
+    }
+    u->num_shadow_regions = j;
+    if (failed) {
+        goto replies;
+    }
+
+    for (i = 0; i < nregions; i++) {
+        reg = &regions[i];
+        if (vhost_user_find_mem_region(u->shadow_regions,
+                                       u->num_shadow_regions, reg)) {
+            continue;
+        }
+        trace_vhost_user_add_mem_reg(reg->guest_phys_addr, reg->memory_size,
+                                     reg->userspace_addr, reg->mmap_offset);
+        r = vhost_user_send_mem_reg(dev, VHOST_USER_ADD_MEM_REG, reg, fds[i]);
+        if (r < 0) {
+            goto replies;
+        }
+        nr_replies += r;
+        u->shadow_regions[u->num_shadow_regions++] = *reg;
+    }
+    ret = 0;
+
+replies:
+    /* Collect all replies even after an error, so that they are not taken
+     * for replies to later requests.
+     */
+    nr_replies += nr_rem_replies;
+    for (i = 0; i < nr_replies; i++) {
+        msg.hdr.request = i < nr_rem_replies ? VHOST_USER_REM_MEM_REG :
+                                               VHOST_USER_ADD_MEM_REG;
+        msg.hdr.flags = VHOST_USER_VERSION | VHOST_USER_NEED_REPLY_MASK;
+        if (process_message_reply(dev, &msg) < 0) {
+            ret = -1;
+        }
+    }
+
+out:
+    g_free(fds);
+    g_free(regions);
+    return ret;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
     struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
     int fds[VHOST_MEMORY_MAX_NREGIONS];
-    int i, fd;
-    size_t fd_num = 0;
+    int fd_num;
     bool do_postcopy = u->postcopy_listen && u->postcopy_fd.handler;
+    bool config_mem_slots =
+        virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS);
     bool reply_supported = virtio_has_feature(dev->protocol_features,
                                           VHOST_USER_PROTOCOL_F_REPLY_ACK) &&
                                           !do_postcopy;
@@ -512,7 +750,20 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         /* Postcopy has enough differences that it's best done in it's own
          * version
          */
-        return vhost_user_set_mem_table_postcopy(dev, mem);
+        if (vhost_user_set_mem_table_postcopy(dev, mem) < 0) {
+            return -1;
+        }
+        if (config_mem_slots) {
+            /* The backend now has exactly the regions of the full table */
+            fd_num = vhost_user_fill_mem_regions(dev, u->shadow_regions,
+                                                 NULL, u->max_mem_slots);
+            u->num_shadow_regions = MAX(fd_num, 0);
+        }
+        return 0;
+    }
+
+    if (config_mem_slots) {
+        return vhost_user_update_mem_regions(dev);
     }
 
     VhostUserMsg msg = {
@@ -524,30 +775,14 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
     }
 
-    for (i = 0; i < dev->mem->nregions; ++i) {
-        struct vhost_memory_region *reg = dev->mem->regions + i;
-        ram_addr_t offset;
-        MemoryRegion *mr;
-
-        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
-        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
-                                     &offset);
-        fd = memory_region_get_fd(mr);
-        if (fd > 0) {
-            if (fd_num == VHOST_MEMORY_MAX_NREGIONS) {
-                error_report("Failed preparing vhost-user memory table msg");
-                return -1;
-            }
-            msg.payload.memory.regions[fd_num].userspace_addr =
-                reg->userspace_addr;
-            msg.payload.memory.regions[fd_num].memory_size  = reg->memory_size;
-            msg.payload.memory.regions[fd_num].guest_phys_addr =
-                reg->guest_phys_addr;
-            msg.payload.memory.regions[fd_num].mmap_offset = offset;
-            fds[fd_num++] = fd;
-        }
+    fd_num = vhost_user_fill_mem_regions(dev, regions, fds,
+                                         VHOST_MEMORY_MAX_NREGIONS);
+    if (fd_num < 0) {
+        error_report("Failed preparing vhost-user memory table msg");
+        return -1;
     }
 
+    memcpy(msg.payload.memory.regions, regions, fd_num * sizeof(regions[0]));
     msg.payload.memory.nregions = fd_num;
 
     if (!fd_num) {
@@ -662,6 +897,25 @@ static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
     return 0;
 }
 
+static void vhost_user_host_notifier_remove(struct vhost_dev *dev,
+                                            int queue_idx)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserHostNotifier *n = &u->notifier[queue_idx];
+
+    if (!n->set) {
+        return;
+    }
+
+    if (dev->vdev) {
+        virtio_queue_set_host_notifier_mr(dev->vdev, queue_idx, &n->mr, false);
+    }
+    object_unparent(OBJECT(&n->mr));
+    munmap(n->addr, qemu_real_host_page_size);
+    n->addr = NULL;
+    n->set = false;
+}
+
 static int vhost_user_get_vring_base(struct vhost_dev *dev,
                                      struct vhost_vring_state *ring)
 {
@@ -672,6 +926,9 @@ static int vhost_user_get_vring_base(struct vhost_dev *dev,
         .hdr.size = sizeof(msg.payload.state),
     };
 
+    /* The queue is stopping, guest notifications go through QEMU again */
+    vhost_user_host_notifier_remove(dev, ring->index);
+
     if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
         return -1;
     }
@@ -818,6 +1075,7 @@ static int vhost_user_set_owner(struct vhost_dev *dev)
 
 static int vhost_user_reset_device(struct vhost_dev *dev)
 {
+    struct vhost_user *u = dev->opaque;
     VhostUserMsg msg = {
         .hdr.request = VHOST_USER_RESET_OWNER,
         .hdr.flags = VHOST_USER_VERSION,
@@ -827,6 +1085,8 @@ static int vhost_user_reset_device(struct vhost_dev *dev)
         return -1;
     }
 
+    /* The backend drops its memory table, send all regions next time */
+    u->num_shadow_regions = 0;
     return 0;
 }
 
@@ -845,6 +1105,62 @@ static int vhost_user_slave_handle_config_change(struct vhost_dev *dev)
     return ret;
 }
 
+static int vhost_user_slave_handle_vring_host_notifier(struct vhost_dev *dev,
+                                                       VhostUserVringArea *area,
+                                                       int fd)
+{
+    int queue_idx = area->u64 & VHOST_USER_VRING_IDX_MASK;
+    size_t page_size = qemu_real_host_page_size;
+    struct vhost_user *u = dev->opaque;
+    VhostUserHostNotifier *n;
+    char *name;
+    void *addr;
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_HOST_NOTIFIER) ||
+        dev->vdev == NULL ||
+        queue_idx >= virtio_get_num_queues(dev->vdev)) {
+        return -1;
+    }
+
+    n = &u->notifier[queue_idx];
+    vhost_user_host_notifier_remove(dev, queue_idx);
+
+    if (area->u64 & VHOST_USER_VRING_NOFD_MASK) {
+        return 0;
+    }
+
+    /* Sanity check. */
+    if (area->size != page_size) {
+        return -1;
+    }
+
+    addr = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, area->offset);
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+
+    name = g_strdup_printf("vhost-user/host-notifier@%p mmaps[%d]",
+                           u, queue_idx);
+    memory_region_init_ram_device_ptr(&n->mr, OBJECT(dev->vdev), name,
+                                      page_size, addr);
+    g_free(name);
+
+    if (virtio_queue_set_host_notifier_mr(dev->vdev, queue_idx,
+                                          &n->mr, true)) {
+        object_unparent(OBJECT(&n->mr));
+        munmap(addr, page_size);
+        return -1;
+    }
+
+    n->addr = addr;
+    n->set = true;
+    trace_vhost_user_host_notifier(queue_idx, page_size);
+
+    return 0;
+}
+
 static void slave_read(void *opaque)
 {
     struct vhost_dev *dev = opaque;
@@ -852,14 +1168,49 @@ static void slave_read(void *opaque)
     VhostUserHeader hdr = { 0, };
     VhostUserPayload payload = { 0, };
     int size, ret = 0;
+    struct iovec iov;
+    struct msghdr msgh;
+    int fd[VHOST_USER_SLAVE_MAX_FDS];
+    char control[CMSG_SPACE(sizeof(fd))];
+    struct cmsghdr *cmsg;
+    int i, fdsize = 0;
+
+    memset(&msgh, 0, sizeof(msgh));
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = control;
+    msgh.msg_controllen = sizeof(control);
+
+    memset(fd, -1, sizeof(fd));
+
+    /* Read header, along with any file descriptors sent with it */
+    iov.iov_base = &hdr;
+    iov.iov_len = VHOST_USER_HDR_SIZE;
+
+    do {
+        size = recvmsg(u->slave_fd, &msgh, 0);
+    } while (size < 0 && (errno == EINTR || errno == EAGAIN));
 
-    /* Read header */
-    size = read(u->slave_fd, &hdr, VHOST_USER_HDR_SIZE);
     if (size != VHOST_USER_HDR_SIZE) {
         error_report("Failed to read from slave.");
         goto err;
     }
 
+    if (msgh.msg_flags & MSG_CTRUNC) {
+        error_report("Truncated message.");
+        goto err;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msgh); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            fdsize = cmsg->cmsg_len - CMSG_LEN(0);
+            memcpy(fd, CMSG_DATA(cmsg), fdsize);
+            break;
+        }
+    }
+
     if (hdr.size > VHOST_USER_PAYLOAD_SIZE) {
         error_report("Failed to read msg header."
                 " Size %d exceeds the maximum %zu.", hdr.size,
@@ -868,7 +1219,10 @@ static void slave_read(void *opaque)
     }
 
     /* Read payload */
-    size = read(u->slave_fd, &payload, hdr.size);
+    do {
+        size = read(u->slave_fd, &payload, hdr.size);
+    } while (size < 0 && (errno == EINTR || errno == EAGAIN));
+
     if (size != hdr.size) {
         error_report("Failed to read payload from slave.");
         goto err;
@@ -881,6 +1235,10 @@ static void slave_read(void *opaque)
     case VHOST_USER_SLAVE_CONFIG_CHANGE_MSG :
         ret = vhost_user_slave_handle_config_change(dev);
         break;
+    case VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG:
+        ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
+                                                          fd[0]);
+        break;
     default:
         error_report("Received unexpected msg type.");
         ret = -EINVAL;
@@ -905,19 +1263,29 @@ static void slave_read(void *opaque)
         iovec[1].iov_base = &payload;
         iovec[1].iov_len = hdr.size;
 
-        size = writev(u->slave_fd, iovec, ARRAY_SIZE(iovec));
+        do {
+            size = writev(u->slave_fd, iovec, ARRAY_SIZE(iovec));
+        } while (size < 0 && (errno == EINTR || errno == EAGAIN));
+
         if (size != VHOST_USER_HDR_SIZE + hdr.size) {
             error_report("Failed to send msg reply to slave.");
             goto err;
         }
     }
 
-    return;
+    goto fdcleanup;
 
 err:
     qemu_set_fd_handler(u->slave_fd, NULL, NULL, NULL);
     close(u->slave_fd);
     u->slave_fd = -1;
+
+fdcleanup:
+    for (i = 0; i < fdsize / sizeof(int); i++) {
+        if (fd[i] != -1) {
+            close(fd[i]);
+        }
+    }
     return;
 }
 
@@ -1194,6 +1562,7 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
     u->chr = opaque;
     u->slave_fd = -1;
     u->dev = dev;
+    u->max_mem_slots = VHOST_MEMORY_MAX_NREGIONS;
     dev->opaque = u;
 
     err = vhost_user_get_features(dev, &features);
@@ -1237,6 +1606,22 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
             }
         }
 
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_MAX_MEM_SLOTS,
+                                     &u->max_mem_slots);
+            if (err < 0) {
+                return err;
+            }
+            if (!u->max_mem_slots) {
+                error_report("vhost-user backend supports no memory regions");
+                return -1;
+            }
+            u->max_mem_slots = MIN(u->max_mem_slots, VHOST_USER_MAX_RAM_SLOTS);
+            u->shadow_regions = g_new0(VhostUserMemoryRegion,
+                                       u->max_mem_slots);
+        }
+
         if (virtio_has_feature(features, VIRTIO_F_IOMMU_PLATFORM) &&
                 !(virtio_has_feature(dev->protocol_features,
                     VHOST_USER_PROTOCOL_F_SLAVE_REQ) &&
@@ -1270,10 +1655,14 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
 static int vhost_user_cleanup(struct vhost_dev *dev)
 {
     struct vhost_user *u;
+    int i;
 
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
     u = dev->opaque;
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        vhost_user_host_notifier_remove(dev, i);
+    }
     if (u->postcopy_notifier.notify) {
         postcopy_remove_notifier(&u->postcopy_notifier);
         u->postcopy_notifier.notify = NULL;
@@ -1288,12 +1677,106 @@ static int vhost_user_cleanup(struct vhost_dev *dev)
     g_free(u->region_rb_offset);
     u->region_rb_offset = NULL;
     u->region_rb_len = 0;
+    g_free(u->shadow_regions);
     g_free(u);
     dev->opaque = 0;
 
     return 0;
 }
 
+static int vhost_user_get_inflight_fd(struct vhost_dev *dev,
+                                      uint16_t queue_size,
+                                      struct vhost_inflight *inflight)
+{
+    struct vhost_user *u = dev->opaque;
+    void *addr;
+    int fd;
+    VhostUserMsg msg = {
+        .hdr.request = VHOST_USER_GET_INFLIGHT_FD,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.inflight.num_queues = dev->nvqs,
+        .payload.inflight.queue_size = queue_size,
+        .hdr.size = sizeof(msg.payload.inflight),
+    };
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD)) {
+        return 0;
+    }
+
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+        return -1;
+    }
+
+    if (vhost_user_read(dev, &msg) < 0) {
+        return -1;
+    }
+
+    if (msg.hdr.request != VHOST_USER_GET_INFLIGHT_FD) {
+        error_report("Received unexpected msg type. "
+                     "Expected %d received %d",
+                     VHOST_USER_GET_INFLIGHT_FD, msg.hdr.request);
+        return -1;
+    }
+
+    if (msg.hdr.size != sizeof(msg.payload.inflight)) {
+        error_report("Received bad msg size.");
+        return -1;
+    }
+
+    /* The backend does not need a buffer for this device */
+    if (!msg.payload.inflight.mmap_size) {
+        return 0;
+    }
+
+    fd = qemu_chr_fe_get_msgfd(u->chr);
+    if (fd < 0) {
+        error_report("Failed to get inflight buffer fd");
+        return -1;
+    }
+
+    addr = mmap(0, msg.payload.inflight.mmap_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, msg.payload.inflight.mmap_offset);
+    if (addr == MAP_FAILED) {
+        error_report("Failed to mmap inflight buffer");
+        close(fd);
+        return -1;
+    }
+
+    inflight->addr = addr;
+    inflight->fd = fd;
+    inflight->size = msg.payload.inflight.mmap_size;
+    inflight->offset = msg.payload.inflight.mmap_offset;
+    inflight->queue_size = queue_size;
+
+    return 0;
+}
+
+static int vhost_user_set_inflight_fd(struct vhost_dev *dev,
+                                      struct vhost_inflight *inflight)
+{
+    VhostUserMsg msg = {
+        .hdr.request = VHOST_USER_SET_INFLIGHT_FD,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.inflight.mmap_size = inflight->size,
+        .payload.inflight.mmap_offset = inflight->offset,
+        .payload.inflight.num_queues = dev->nvqs,
+        .payload.inflight.queue_size = inflight->queue_size,
+        .hdr.size = sizeof(msg.payload.inflight),
+    };
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD)) {
+        return 0;
+    }
+
+    if (vhost_user_write(dev, &msg, &inflight->fd, 1) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
 static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 {
     assert(idx >= dev->vq_index && idx < dev->vq_index + dev->nvqs);
@@ -1303,7 +1786,9 @@ static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 
 static int vhost_user_memslots_limit(struct vhost_dev *dev)
 {
-    return VHOST_MEMORY_MAX_NREGIONS;
+    struct vhost_user *u = dev->opaque;
+
+    return u->max_mem_slots;
 }
 
 static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
@@ -1611,4 +2096,6 @@ const VhostOps user_ops = {
         .vhost_set_config = vhost_user_set_config,
         .vhost_crypto_create_session = vhost_user_crypto_create_session,
         .vhost_crypto_close_session = vhost_user_crypto_close_session,
+        .vhost_get_inflight_fd = vhost_user_get_inflight_fd,
+        .vhost_set_inflight_fd = vhost_user_set_inflight_fd,
 };
@@ -1463,6 +1463,50 @@ void vhost_dev_set_config_notifier(struct vhost_dev *hdev,
     hdev->config_ops = ops;
 }
 
+void vhost_dev_free_inflight(struct vhost_inflight *inflight)
+{
+    if (inflight && inflight->addr) {
+        qemu_memfd_free(inflight->addr, inflight->size, inflight->fd);
+        inflight->addr = NULL;
+        inflight->fd = -1;
+    }
+}
+
+/* Leaves @inflight untouched if the backend does not track in-flight
+ * requests.
+ */
+int vhost_dev_get_inflight(struct vhost_dev *hdev, uint16_t queue_size,
+                           struct vhost_inflight *inflight)
+{
+    int r;
+
+    if (hdev->vhost_ops->vhost_get_inflight_fd) {
+        r = hdev->vhost_ops->vhost_get_inflight_fd(hdev, queue_size, inflight);
+        if (r) {
+            VHOST_OPS_DEBUG("vhost_get_inflight_fd failed");
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+int vhost_dev_set_inflight(struct vhost_dev *hdev,
+                           struct vhost_inflight *inflight)
+{
+    int r;
+
+    if (hdev->vhost_ops->vhost_set_inflight_fd && inflight->addr) {
+        r = hdev->vhost_ops->vhost_set_inflight_fd(hdev, inflight);
+        if (r) {
+            VHOST_OPS_DEBUG("vhost_set_inflight_fd failed");
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
 /* Host notifiers must be enabled at this point. */
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
 {
@@ -22,26 +22,22 @@
 #include "sysemu/balloon.h"
 #include "hw/virtio/virtio-balloon.h"
 #include "sysemu/kvm.h"
+#include "sysemu/sysemu.h"
 #include "exec/address-spaces.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-misc.h"
 #include "qapi/visitor.h"
 #include "trace.h"
 #include "qemu/error-report.h"
+#include "migration/misc.h"
 
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
 #define BALLOON_PAGE_SIZE  (1 << VIRTIO_BALLOON_PFN_SHIFT)
 
-static void balloon_page(void *addr, int deflate)
-{
-    if (!qemu_balloon_is_inhibited() && (!kvm_enabled() ||
-                                         kvm_has_sync_mmu())) {
-        qemu_madvise(addr, BALLOON_PAGE_SIZE,
-                deflate ? QEMU_MADV_WILLNEED : QEMU_MADV_DONTNEED);
-    }
-}
+/* Elements processed in one go by a balloon queue */
+#define BALLOON_BATCH_MAX 32
 
 static const char *balloon_stat_names[] = {
    [VIRTIO_BALLOON_S_SWAP_IN] = "stat-swap-in",
@@ -207,55 +203,352 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
-static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
+typedef struct VirtIOBalloonRange {
+    MemoryRegion *mr;   /* referenced until the batch is released */
+    uint8_t *host;
+    ram_addr_t offset;
+    size_t len;
+} VirtIOBalloonRange;
+
+/*
+ * The inflate, deflate and reporting queues pop their elements in
+ * batches.  A batch is processed by the iothread if the device has one,
+ * so that the madvise() and fallocate() calls do not stall the main
+ * loop, and then handed back to the guest from the main loop.
+ */
+static void virtio_balloon_batch_release(VirtIOBalloonBatch *b, bool push)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(b->balloon);
+    unsigned i;
+
+    for (i = 0; i < b->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(b->elems, i);
+
+        /* Nothing was written: zero length keeps the pages clean */
+        if (push) {
+            virtqueue_push(b->vq, elem, 0);
+        } else {
+            virtqueue_detach_element(b->vq, elem, 0);
+        }
+        g_free(elem);
+    }
+    g_ptr_array_set_size(b->elems, 0);
+
+    for (i = 0; i < b->ranges->len; i++) {
+        memory_region_unref(g_array_index(b->ranges, VirtIOBalloonRange,
+                                          i).mr);
+    }
+    g_array_set_size(b->ranges, 0);
+    if (push) {
+        virtio_notify(vdev, b->vq);
+    }
+}
+
+static void virtio_balloon_batch_run(VirtIOBalloonBatch *b)
 {
-    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
-    MemoryRegionSection section;
 
-    for (;;) {
-        size_t offset = 0;
-        uint32_t pfn;
-        elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
-        if (!elem) {
+    /* A batch is in flight; the queue is scanned again when it is done */
+    while (!b->elems->len) {
+        while (b->elems->len < BALLOON_BATCH_MAX) {
+            elem = virtqueue_pop(b->vq, sizeof(VirtQueueElement));
+            if (!elem) {
+                break;
+            }
+            g_ptr_array_add(b->elems, elem);
+        }
+        if (!b->elems->len) {
             return;
         }
 
-        while (iov_to_buf(elem->out_sg, elem->out_num, offset, &pfn, 4) == 4) {
-            ram_addr_t pa;
-            ram_addr_t addr;
-            int p = virtio_ldl_p(vdev, &pfn);
-
-            pa = (ram_addr_t) p << VIRTIO_BALLOON_PFN_SHIFT;
-            offset += 4;
-
-            /* FIXME: remove get_system_memory(), but how? */
-            section = memory_region_find(get_system_memory(), pa, 1);
-            if (!int128_nz(section.size) ||
-                !memory_region_is_ram(section.mr) ||
-                memory_region_is_rom(section.mr) ||
-                memory_region_is_romd(section.mr)) {
-                trace_virtio_balloon_bad_addr(pa);
-                memory_region_unref(section.mr);
-                continue;
+        b->discard = !qemu_balloon_is_inhibited() &&
+                     (!kvm_enabled() || kvm_has_sync_mmu());
+        if (b->prepare) {
+            b->prepare(b->balloon, b);
+        }
+        if (b->work_bh) {
+            b->done = false;
+            qemu_event_reset(&b->work_done);
+            qemu_bh_schedule(b->work_bh);
+            return;
+        }
+        b->work(b->balloon, b);
+        virtio_balloon_batch_release(b, true);
+    }
+}
+
+static void virtio_balloon_batch_work_bh(void *opaque)
+{
+    VirtIOBalloonBatch *b = opaque;
+
+    b->work(b->balloon, b);
+    atomic_mb_set(&b->done, true);
+    /*
+     * Once work_done is set the main loop may delete complete_bh, so it
+     * must be scheduled first.
+     */
+    qemu_bh_schedule(b->complete_bh);
+    qemu_event_set(&b->work_done);
+}
+
+static void virtio_balloon_batch_complete_bh(void *opaque)
+{
+    VirtIOBalloonBatch *b = opaque;
+
+    /* The batch may have been flushed or dropped since the BH was queued */
+    if (atomic_mb_read(&b->done) && b->elems->len) {
+        virtio_balloon_batch_release(b, true);
+        virtio_balloon_batch_run(b);
+    }
+}
+
+/*
+ * Wait for the iothread to be done with the batch, then give it back to
+ * the guest if @push, else drop it.
+ */
+static void virtio_balloon_batch_finish(VirtIOBalloonBatch *b, bool push)
+{
+    if (b->elems && b->elems->len) {
+        if (b->work_bh) {
+            qemu_event_wait(&b->work_done);
+        }
+        b->done = false;
+        virtio_balloon_batch_release(b, push);
+    }
+}
+
+static void virtio_balloon_batch_drain(VirtIOBalloonBatch *b)
+{
+    virtio_balloon_batch_finish(b, false);
+}
+
+static void virtio_balloon_batch_init(VirtIOBalloon *s, VirtIOBalloonBatch *b,
+                                      VirtQueue *vq,
+                                      void (*prepare)(VirtIOBalloon *s,
+                                                      VirtIOBalloonBatch *b),
+                                      void (*work)(VirtIOBalloon *s,
+                                                   VirtIOBalloonBatch *b))
+{
+    b->balloon = s;
+    b->vq = vq;
+    b->prepare = prepare;
+    b->work = work;
+    b->elems = g_ptr_array_new();
+    b->ranges = g_array_new(false, false, sizeof(VirtIOBalloonRange));
+    if (s->iothread) {
+        b->work_bh = aio_bh_new(iothread_get_aio_context(s->iothread),
+                                virtio_balloon_batch_work_bh, b);
+        b->complete_bh = qemu_bh_new(virtio_balloon_batch_complete_bh, b);
+        qemu_event_init(&b->work_done, true);
+    }
+}
+
+static void virtio_balloon_batch_cleanup(VirtIOBalloonBatch *b)
+{
+    if (!b->elems) {
+        return;
+    }
+    virtio_balloon_batch_drain(b);
+    if (b->work_bh) {
+        qemu_bh_delete(b->work_bh);
+        qemu_bh_delete(b->complete_bh);
+        qemu_event_destroy(&b->work_done);
+    }
+    g_ptr_array_free(b->elems, true);
+    b->elems = NULL;
+    g_array_free(b->ranges, true);
+    b->ranges = NULL;
+}
+
+/*
+ * Huge host pages can only be discarded whole, so remember which of their
+ * sub-pages are in the balloon until all of them are.
+ */
+static void balloon_partial_page(VirtIOBalloon *s, RAMBlock *rb,
+                                 uint8_t *host, ram_addr_t offset,
+                                 size_t len, bool deflate)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    ram_addr_t page = QEMU_ALIGN_DOWN(offset, pagesize);
+    void *key = host - (offset - page);
+    long nbits = pagesize / BALLOON_PAGE_SIZE;
+    long first = (offset - page) / BALLOON_PAGE_SIZE;
+    unsigned long *bitmap = g_hash_table_lookup(s->partial_pages, key);
+
+    if (deflate) {
+        if (bitmap) {
+            bitmap_clear(bitmap, first, len / BALLOON_PAGE_SIZE);
+            if (bitmap_empty(bitmap, nbits)) {
+                g_hash_table_remove(s->partial_pages, key);
             }
+        }
+        return;
+    }
+
+    if (!bitmap) {
+        bitmap = bitmap_new(nbits);
+        g_hash_table_insert(s->partial_pages, key, bitmap);
+    }
+    bitmap_set(bitmap, first, len / BALLOON_PAGE_SIZE);
+    if (bitmap_full(bitmap, nbits)) {
+        g_hash_table_remove(s->partial_pages, key);
+        ram_block_discard_range(rb, page, pagesize);
+    }
+}
+
+static void balloon_ram_range(VirtIOBalloon *s, RAMBlock *rb, uint8_t *host,
+                              ram_addr_t offset, size_t len, bool deflate)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
 
-            trace_virtio_balloon_handle_output(memory_region_name(section.mr),
-                                               pa);
-            /* Using memory_region_get_ram_ptr is bending the rules a bit, but
-               should be OK because we only want a single page.  */
-            addr = section.offset_within_region;
-            balloon_page(memory_region_get_ram_ptr(section.mr) + addr,
-                         !!(vq == s->dvq));
+    if (pagesize <= BALLOON_PAGE_SIZE) {
+        if (deflate) {
+            qemu_madvise(host, len, QEMU_MADV_WILLNEED);
+        } else {
+            ram_block_discard_range(rb, offset, len);
+        }
+        return;
+    }
+
+    while (len) {
+        size_t chunk = MIN(len, QEMU_ALIGN_DOWN(offset, pagesize) + pagesize -
+                                offset);
+
+        if (chunk < pagesize) {
+            balloon_partial_page(s, rb, host, offset, chunk, deflate);
+        } else {
+            /* A run of whole huge pages goes in one call */
+            size_t i;
+
+            chunk = QEMU_ALIGN_DOWN(len, pagesize);
+            for (i = 0; g_hash_table_size(s->partial_pages) && i < chunk;
+                 i += pagesize) {
+                g_hash_table_remove(s->partial_pages, host + i);
+            }
+            if (!deflate) {
+                ram_block_discard_range(rb, offset, chunk);
+            }
+        }
+        host += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+}
+
+/*
+ * Look up the RAM behind [pa, pa + len) and add it to the batch.  The
+ * memory regions stay referenced until the batch is released, so the
+ * iothread never touches the address space or the region refcounts.
+ */
+static void balloon_resolve_range(VirtIOBalloonBatch *b, hwaddr pa,
+                                  hwaddr len, bool deflate)
+{
+    while (len) {
+        /* FIXME: remove get_system_memory(), but how? */
+        MemoryRegionSection section = memory_region_find(get_system_memory(),
+                                                         pa, len);
+        VirtIOBalloonRange range;
+        hwaddr skip, size;
+
+        if (!section.mr) {
+            trace_virtio_balloon_bad_addr(pa);
+            return;
+        }
+        skip = section.offset_within_address_space - pa;
+        size = int128_get64(section.size);
+        if (skip) {
+            trace_virtio_balloon_bad_addr(pa);
+        }
+
+        if (!memory_region_is_ram(section.mr) ||
+            memory_region_is_rom(section.mr) ||
+            memory_region_is_romd(section.mr)) {
+            trace_virtio_balloon_bad_addr(section.offset_within_address_space);
             memory_region_unref(section.mr);
+        } else {
+            trace_virtio_balloon_range(memory_region_name(section.mr),
+                                       section.offset_within_address_space,
+                                       size, deflate);
+            range.mr = section.mr;
+            /* Using memory_region_get_ram_ptr is bending the rules a bit,
+             * but should be OK because the range stays within the region. */
+            range.host = (uint8_t *)memory_region_get_ram_ptr(section.mr) +
+                         section.offset_within_region;
+            range.offset = section.offset_within_region;
+            range.len = size;
+            g_array_append_val(b->ranges, range);
         }
+        pa += skip + size;
+        len -= skip + size;
+    }
+}
 
-        virtqueue_push(vq, elem, offset);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+static int balloon_pfn_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sort the PFNs of each element and resolve them as contiguous ranges */
+static void virtio_balloon_pfn_prepare(VirtIOBalloon *s,
+                                       VirtIOBalloonBatch *b)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    bool deflate = b == &s->deflate;
+    unsigned e;
+
+    if (!b->discard) {
+        return;
+    }
+
+    for (e = 0; e < b->elems->len; e++) {
+        VirtQueueElement *elem = g_ptr_array_index(b->elems, e);
+        size_t n = iov_size(elem->out_sg, elem->out_num) / sizeof(uint32_t);
+        uint32_t *pfns = g_new(uint32_t, n);
+        size_t i, j;
+
+        iov_to_buf(elem->out_sg, elem->out_num, 0, pfns,
+                   n * sizeof(uint32_t));
+        for (i = 0; i < n; i++) {
+            pfns[i] = virtio_ldl_p(vdev, &pfns[i]);
+        }
+        qsort(pfns, n, sizeof(uint32_t), balloon_pfn_cmp);
+
+        for (i = 0; i < n; i = j) {
+            for (j = i + 1; j < n && pfns[j] - pfns[j - 1] <= 1; j++) {
+                /* duplicates and consecutive PFNs extend the range */
+            }
+            balloon_resolve_range(b,
+                                  (hwaddr)pfns[i] << VIRTIO_BALLOON_PFN_SHIFT,
+                                  (hwaddr)(pfns[j - 1] - pfns[i] + 1) <<
+                                  VIRTIO_BALLOON_PFN_SHIFT, deflate);
+        }
+        g_free(pfns);
     }
 }
 
+static void virtio_balloon_pfn_work(VirtIOBalloon *s, VirtIOBalloonBatch *b)
+{
+    bool deflate = b == &s->deflate;
+    unsigned i;
+
+    for (i = 0; i < b->ranges->len; i++) {
+        VirtIOBalloonRange *r = &g_array_index(b->ranges, VirtIOBalloonRange,
+                                               i);
+
+        balloon_ram_range(s, r->mr->ram_block, r->host, r->offset, r->len,
+                          deflate);
+    }
+}
+
+static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+
+    virtio_balloon_batch_run(vq == s->dvq ? &s->deflate : &s->inflate);
+}
+
 static void virtio_balloon_receive_stats(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
@@ -308,16 +601,234 @@ out:
     }
 }
 
+static bool virtio_balloon_free_page_support(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    return virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT);
+}
+
+static void virtio_balloon_free_page_set_status(VirtIOBalloon *s,
+                                                uint32_t status)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    s->free_page_hint_status = status;
+    trace_virtio_balloon_free_page_hint_status(status,
+                                               s->free_page_hint_cmd_id);
+    virtio_notify_config(vdev);
+}
+
+/*
+ * Ask the guest for a new round of hints.  Hints carry the command id
+ * they answer, so the ones sent for an earlier round are ignored.
+ */
+static void virtio_balloon_free_page_start(VirtIOBalloon *s)
+{
+    if (s->free_page_hint_cmd_id == UINT_MAX) {
+        s->free_page_hint_cmd_id = VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN;
+    } else {
+        s->free_page_hint_cmd_id++;
+    }
+    virtio_balloon_free_page_set_status(s, FREE_PAGE_HINT_S_REQUESTED);
+}
+
+static void virtio_balloon_free_page_stop(VirtIOBalloon *s)
+{
+    if (s->free_page_hint_status == FREE_PAGE_HINT_S_REQUESTED ||
+        s->free_page_hint_status == FREE_PAGE_HINT_S_START) {
+        virtio_balloon_free_page_set_status(s, FREE_PAGE_HINT_S_STOP);
+    }
+}
+
+/* Let the guest reuse the pages it has been holding back as hints */
+static void virtio_balloon_free_page_done(VirtIOBalloon *s)
+{
+    if (s->free_page_hint_status != FREE_PAGE_HINT_S_DONE) {
+        virtio_balloon_free_page_set_status(s, FREE_PAGE_HINT_S_DONE);
+    }
+}
+
+static int virtio_balloon_free_page_hint_notify(NotifierWithReturn *n,
+                                                void *data)
+{
+    VirtIOBalloon *s = container_of(n, VirtIOBalloon, free_page_hint_notify);
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    PrecopyNotifyData *pnd = data;
+
+    if (!virtio_balloon_free_page_support(s) ||
+        !(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        return 0;
+    }
+
+    switch (pnd->reason) {
+    case PRECOPY_NOTIFY_SETUP:
+        precopy_enable_free_page_optimization();
+        break;
+    case PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC:
+        virtio_balloon_free_page_stop(s);
+        break;
+    case PRECOPY_NOTIFY_AFTER_BITMAP_SYNC:
+        /* A stopped guest cannot free pages before the final sync */
+        if (vdev->vm_running) {
+            virtio_balloon_free_page_start(s);
+        } else {
+            virtio_balloon_free_page_done(s);
+        }
+        break;
+    case PRECOPY_NOTIFY_COMPLETE:
+    case PRECOPY_NOTIFY_CLEANUP:
+        virtio_balloon_free_page_done(s);
+        break;
+    }
+    return 0;
+}
+
+/*
+ * The guest sends the command id it is answering in an output buffer,
+ * then each free page block as an input buffer.  The blocks are only
+ * read through their mapping here; they are pushed back with a length
+ * of zero so that unmapping them does not mark them dirty.
+ */
+static void virtio_balloon_handle_free_page_vq(VirtIODevice *vdev,
+                                               VirtQueue *vq)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+    VirtQueueElement *elem;
+    unsigned i;
+
+    for (;;) {
+        elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+        if (!elem) {
+            break;
+        }
+
+        if (elem->out_num) {
+            uint32_t id;
+
+            if (iov_to_buf(elem->out_sg, elem->out_num, 0, &id,
+                           sizeof(id)) != sizeof(id)) {
+                virtio_error(vdev, "virtio-balloon: short free page "
+                             "hint command");
+                virtqueue_detach_element(vq, elem, 0);
+                g_free(elem);
+                break;
+            }
+            id = virtio_ldl_p(vdev, &id);
+            trace_virtio_balloon_free_page_hint_cmd(id,
+                                                    s->free_page_hint_status);
+
+            if (id == VIRTIO_BALLOON_CMD_ID_STOP) {
+                /* The guest has no more hints for this round */
+                if (s->free_page_hint_status == FREE_PAGE_HINT_S_START) {
+                    s->free_page_hint_status = FREE_PAGE_HINT_S_STOP;
+                }
+            } else if (s->free_page_hint_status ==
+                       FREE_PAGE_HINT_S_REQUESTED &&
+                       id == s->free_page_hint_cmd_id) {
+                s->free_page_hint_status = FREE_PAGE_HINT_S_START;
+            }
+        }
+
+        if (s->free_page_hint_status == FREE_PAGE_HINT_S_START) {
+            for (i = 0; i < elem->in_num; i++) {
+                qemu_guest_free_page_hint(elem->in_sg[i].iov_base,
+                                          elem->in_sg[i].iov_len);
+            }
+        }
+
+        virtqueue_push(vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, vq);
+}
+
+/*
+ * Free page reporting: the guest hands out blocks of memory it has freed
+ * as input buffers and does not reuse them until they come back.
+ */
+static void virtio_balloon_report_work(VirtIOBalloon *s, VirtIOBalloonBatch *b)
+{
+    uint64_t reported = 0, discarded = 0;
+    unsigned i, j;
+
+    rcu_read_lock();
+    for (i = 0; i < b->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(b->elems, i);
+
+        for (j = 0; j < elem->in_num; j++) {
+            size_t len = elem->in_sg[j].iov_len;
+            ram_addr_t offset, start, end;
+            size_t pagesize;
+            RAMBlock *rb;
+
+            reported += len;
+            if (!b->discard) {
+                continue;
+            }
+            rb = qemu_ram_block_from_host(elem->in_sg[j].iov_base, false,
+                                          &offset);
+            if (!rb) {
+                continue;
+            }
+
+            /* Huge pages can only be given back whole */
+            pagesize = qemu_ram_pagesize(rb);
+            start = QEMU_ALIGN_UP(offset, pagesize);
+            end = QEMU_ALIGN_DOWN(offset + len, pagesize);
+            if (end > start && !ram_block_discard_range(rb, start,
+                                                        end - start)) {
+                discarded += end - start;
+            }
+        }
+    }
+    rcu_read_unlock();
+
+    atomic_add(&s->reported_bytes, reported);
+    atomic_add(&s->discarded_bytes, discarded);
+    trace_virtio_balloon_report_discard(b->elems->len, reported, discarded);
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
+{
+    virtio_balloon_batch_run(&VIRTIO_BALLOON(vdev)->report);
+}
+
+static size_t virtio_balloon_config_size(VirtIOBalloon *s)
+{
+    if (virtio_has_feature(s->host_features,
+                           VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+        return offsetof(struct virtio_balloon_config, poison_val);
+    }
+    return offsetof(struct virtio_balloon_config, free_page_report_cmd_id);
+}
+
 static void virtio_balloon_get_config(VirtIODevice *vdev, uint8_t *config_data)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
-    struct virtio_balloon_config config;
+    struct virtio_balloon_config config = {};
 
     config.num_pages = cpu_to_le32(dev->num_pages);
     config.actual = cpu_to_le32(dev->actual);
 
+    switch (dev->free_page_hint_status) {
+    case FREE_PAGE_HINT_S_REQUESTED:
+    case FREE_PAGE_HINT_S_START:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(dev->free_page_hint_cmd_id);
+        break;
+    case FREE_PAGE_HINT_S_STOP:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(VIRTIO_BALLOON_CMD_ID_STOP);
+        break;
+    case FREE_PAGE_HINT_S_DONE:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(VIRTIO_BALLOON_CMD_ID_DONE);
+        break;
+    }
+
     trace_virtio_balloon_get_config(config.num_pages, config.actual);
-    memcpy(config_data, &config, sizeof(struct virtio_balloon_config));
+    memcpy(config_data, &config, virtio_balloon_config_size(dev));
 }
 
 static int build_dimm_list(Object *obj, void *opaque)
@@ -361,7 +872,7 @@ static void virtio_balloon_set_config(VirtIODevice *vdev,
     uint32_t oldactual = dev->actual;
     ram_addr_t vm_ram_size = get_current_ram_size();
 
-    memcpy(&config, config_data, sizeof(struct virtio_balloon_config));
+    memcpy(&config, config_data, virtio_balloon_config_size(dev));
     dev->actual = le32_to_cpu(config.actual);
     if (dev->actual != oldactual) {
         qapi_event_send_balloon_change(vm_ram_size -
@@ -385,6 +896,12 @@ static void virtio_balloon_stat(void *opaque, BalloonInfo *info)
     VirtIOBalloon *dev = opaque;
     info->actual = get_current_ram_size() - ((uint64_t) dev->actual <<
                                              VIRTIO_BALLOON_PFN_SHIFT);
+    if (dev->reporting_vq) {
+        info->has_free_page_reported = true;
+        info->free_page_reported = atomic_read(&dev->reported_bytes);
+        info->has_free_page_discarded = true;
+        info->free_page_discarded = atomic_read(&dev->discarded_bytes);
+    }
 }
 
 static void virtio_balloon_to_target(void *opaque, ram_addr_t target)
@@ -425,6 +942,31 @@ static const VMStateDescription vmstate_virtio_balloon_device = {
     },
 };
 
+/*
+ * Complete the batches in flight when the VM stops, so that they are not
+ * migrated as in use: the destination would never hand them back.  The
+ * guest may have queued more requests meanwhile, so look at the queues
+ * again when the VM resumes.
+ */
+static void virtio_balloon_vm_state_change(void *opaque, int running,
+                                           RunState state)
+{
+    VirtIOBalloon *s = opaque;
+
+    if (!running) {
+        virtio_balloon_batch_finish(&s->inflate, true);
+        virtio_balloon_batch_finish(&s->deflate, true);
+        virtio_balloon_batch_finish(&s->report, true);
+        return;
+    }
+
+    virtio_balloon_batch_run(&s->inflate);
+    virtio_balloon_batch_run(&s->deflate);
+    if (s->reporting_vq) {
+        virtio_balloon_batch_run(&s->report);
+    }
+}
+
 static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -432,7 +974,7 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     int ret;
 
     virtio_init(vdev, "virtio-balloon", VIRTIO_ID_BALLOON,
-                sizeof(struct virtio_balloon_config));
+                virtio_balloon_config_size(s));
 
     ret = qemu_add_balloon_handler(virtio_balloon_to_target,
                                    virtio_balloon_stat, s);
@@ -443,9 +985,44 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (s->iothread) {
+        object_ref(OBJECT(s->iothread));
+    }
+    s->partial_pages = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, g_free);
+
     s->ivq = virtio_add_queue(vdev, 128, virtio_balloon_handle_output);
     s->dvq = virtio_add_queue(vdev, 128, virtio_balloon_handle_output);
     s->svq = virtio_add_queue(vdev, 128, virtio_balloon_receive_stats);
+    virtio_balloon_batch_init(s, &s->inflate, s->ivq,
+                              virtio_balloon_pfn_prepare,
+                              virtio_balloon_pfn_work);
+    virtio_balloon_batch_init(s, &s->deflate, s->dvq,
+                              virtio_balloon_pfn_prepare,
+                              virtio_balloon_pfn_work);
+
+    if (virtio_has_feature(s->host_features,
+                           VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+        s->free_page_vq = virtio_add_queue(vdev, 128,
+                                           virtio_balloon_handle_free_page_vq);
+        s->free_page_hint_status = FREE_PAGE_HINT_S_STOP;
+        s->free_page_hint_cmd_id = VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN;
+        s->free_page_hint_notify.notify =
+            virtio_balloon_free_page_hint_notify;
+        precopy_add_notifier(&s->free_page_hint_notify);
+    }
+
+    if (virtio_has_feature(s->host_features, VIRTIO_BALLOON_F_REPORTING)) {
+        s->reporting_vq = virtio_add_queue(vdev, 32,
+                                           virtio_balloon_handle_report);
+        virtio_balloon_batch_init(s, &s->report, s->reporting_vq, NULL,
+                                  virtio_balloon_report_work);
+    }
+
+    if (s->iothread) {
+        s->vmstate = qemu_add_vm_change_state_handler(
+            virtio_balloon_vm_state_change, s);
+    }
 
     reset_stats(s);
 }
@@ -455,6 +1032,19 @@ static void virtio_balloon_device_unrealize(DeviceState *dev, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    if (s->free_page_vq) {
+        precopy_remove_notifier(&s->free_page_hint_notify);
+    }
+    if (s->vmstate) {
+        qemu_del_vm_change_state_handler(s->vmstate);
+    }
+    virtio_balloon_batch_cleanup(&s->inflate);
+    virtio_balloon_batch_cleanup(&s->deflate);
+    virtio_balloon_batch_cleanup(&s->report);
+    g_hash_table_destroy(s->partial_pages);
+    if (s->iothread) {
+        object_unref(OBJECT(s->iothread));
+    }
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
     virtio_cleanup(vdev);
@@ -469,6 +1059,11 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         g_free(s->stats_vq_elem);
         s->stats_vq_elem = NULL;
     }
+    s->free_page_hint_status = FREE_PAGE_HINT_S_STOP;
+    virtio_balloon_batch_drain(&s->inflate);
+    virtio_balloon_batch_drain(&s->deflate);
+    virtio_balloon_batch_drain(&s->report);
+    g_hash_table_remove_all(s->partial_pages);
 }
 
 static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
@@ -509,6 +1104,12 @@ static const VMStateDescription vmstate_virtio_balloon = {
 static Property virtio_balloon_properties[] = {
     DEFINE_PROP_BIT("deflate-on-oom", VirtIOBalloon, host_features,
                     VIRTIO_BALLOON_F_DEFLATE_ON_OOM, false),
+    DEFINE_PROP_BIT("free-page-hint", VirtIOBalloon, host_features,
+                    VIRTIO_BALLOON_F_FREE_PAGE_HINT, false),
+    DEFINE_PROP_BIT("free-page-reporting", VirtIOBalloon, host_features,
+                    VIRTIO_BALLOON_F_REPORTING, false),
+    DEFINE_PROP_LINK("iothread", VirtIOBalloon, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -26,6 +26,9 @@
 #include "qemu/host-utils.h"
 #include "sysemu/kvm.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/pci/msi.h"
+#include "exec/address-spaces.h"
+#include "qapi/error.h"
 #include "qemu/error-report.h"
 
 /* #define DEBUG_VIRTIO_MMIO */
@@ -57,6 +60,37 @@ do { printf("virtio_mmio: " fmt , ## __VA_ARGS__); } while (0)
 #define VIRT_VERSION 1
 #define VIRT_VENDOR 0x554D4551 /* 'QEMU' */
 
+/*
+ * MSI extension, see docs/specs/virtio-mmio-msi.txt.  The registers sit
+ * between the queue registers and the device configuration space.
+ */
+#define VIRTIO_MMIO_MSI_VEC_NUM         0x0c0
+#define VIRTIO_MMIO_MSI_STATE           0x0c4
+#define VIRTIO_MMIO_MSI_COMMAND         0x0c8
+#define VIRTIO_MMIO_MSI_VEC_SEL         0x0d0
+#define VIRTIO_MMIO_MSI_ADDRESS_LOW     0x0d4
+#define VIRTIO_MMIO_MSI_ADDRESS_HIGH    0x0d8
+#define VIRTIO_MMIO_MSI_DATA            0x0dc
+
+#define VIRTIO_MMIO_MSI_ENABLED         (1u << 31)
+
+#define VIRTIO_MMIO_MSI_CMD_ENABLE      0x1
+#define VIRTIO_MMIO_MSI_CMD_DISABLE     0x2
+#define VIRTIO_MMIO_MSI_CMD_CONFIGURE   0x3
+#define VIRTIO_MMIO_MSI_CMD_MASK        0x4
+#define VIRTIO_MMIO_MSI_CMD_UNMASK      0x5
+#define VIRTIO_MMIO_MSI_CMD_MAP_CONFIG  0x6
+#define VIRTIO_MMIO_MSI_CMD_MAP_QUEUE   0x7
+
+typedef struct VirtIOMMIOMSIVector {
+    MSIMessage msg;
+    bool masked;
+    bool pending;
+    /* KVM route while guest notifiers use irqfd, and how many queues use it */
+    int virq;
+    unsigned int users;
+} VirtIOMMIOMSIVector;
+
 typedef struct {
     /* Generic */
     SysBusDevice parent_obj;
@@ -66,9 +100,19 @@ typedef struct {
     uint32_t host_features_sel;
     uint32_t guest_features_sel;
     uint32_t guest_page_shift;
+    bool msi_enabled;
+    uint32_t msi_vec_sel;
+    uint32_t msi_address_low;
+    uint32_t msi_address_high;
+    uint32_t msi_data;
+    VirtIOMMIOMSIVector *msi_vectors;
+    /* Number of queues whose guest notifiers are wired to KVM MSI routes */
+    int msi_irqfd_nvqs;
     /* virtio-bus */
     VirtioBusState bus;
     bool format_transport_address;
+    uint32_t nvectors;
+    uint16_t msi_requester_id;
 } VirtIOMMIOProxy;
 
 static bool virtio_mmio_ioeventfd_enabled(DeviceState *d)
@@ -102,6 +146,202 @@ static void virtio_mmio_stop_ioeventfd(VirtIOMMIOProxy *proxy)
     virtio_bus_stop_ioeventfd(&proxy->bus);
 }
 
+static void virtio_mmio_msi_send(VirtIOMMIOProxy *proxy, uint16_t vector)
+{
+    VirtIOMMIOMSIVector *v = &proxy->msi_vectors[vector];
+    MemTxAttrs attrs = { .requester_id = proxy->msi_requester_id };
+
+    /* Like MSI-X, an unprogrammed vector behaves as if it were masked */
+    if (v->masked || !v->msg.address) {
+        v->pending = true;
+        return;
+    }
+
+    address_space_stl_le(&address_space_memory, v->msg.address, v->msg.data,
+                         attrs, NULL);
+}
+
+/* Called on the first queue that uses @vector with irqfd */
+static int virtio_mmio_msi_vector_use(VirtIOMMIOProxy *proxy, uint16_t vector)
+{
+    VirtIOMMIOMSIVector *v = &proxy->msi_vectors[vector];
+    int ret;
+
+    if (v->users == 0) {
+        ret = kvm_irqchip_add_msi_route_devid(kvm_state, v->msg,
+                                              proxy->msi_requester_id);
+        if (ret < 0) {
+            return ret;
+        }
+        v->virq = ret;
+    }
+    v->users++;
+    return 0;
+}
+
+static void virtio_mmio_msi_vector_release(VirtIOMMIOProxy *proxy,
+                                           uint16_t vector)
+{
+    VirtIOMMIOMSIVector *v = &proxy->msi_vectors[vector];
+
+    if (--v->users == 0) {
+        kvm_irqchip_release_virq(kvm_state, v->virq);
+        v->virq = -1;
+    }
+}
+
+/*
+ * A masked vector has its irqfds detached.  Notifications accumulate in
+ * the eventfds meanwhile, and KVM delivers them when they are attached
+ * again.
+ */
+static int virtio_mmio_irqfd_use(VirtIOMMIOProxy *proxy, int n)
+{
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    uint16_t vector = virtio_queue_vector(vdev, n);
+    VirtQueue *vq = virtio_get_queue(vdev, n);
+    EventNotifier *notifier = virtio_queue_get_guest_notifier(vq);
+    VirtIOMMIOMSIVector *v;
+    int ret;
+
+    if (vector >= proxy->nvectors) {
+        return 0;
+    }
+
+    ret = virtio_mmio_msi_vector_use(proxy, vector);
+    if (ret < 0) {
+        return ret;
+    }
+
+    v = &proxy->msi_vectors[vector];
+    if (!v->masked) {
+        ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, notifier, NULL,
+                                                 v->virq);
+        if (ret < 0) {
+            virtio_mmio_msi_vector_release(proxy, vector);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void virtio_mmio_irqfd_release(VirtIOMMIOProxy *proxy, int n)
+{
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    uint16_t vector = virtio_queue_vector(vdev, n);
+    VirtQueue *vq = virtio_get_queue(vdev, n);
+    EventNotifier *notifier = virtio_queue_get_guest_notifier(vq);
+    VirtIOMMIOMSIVector *v;
+
+    if (vector >= proxy->nvectors) {
+        return;
+    }
+
+    v = &proxy->msi_vectors[vector];
+    if (!v->masked) {
+        kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, notifier, v->virq);
+    }
+    virtio_mmio_msi_vector_release(proxy, vector);
+}
+
+static void virtio_mmio_msi_mask(VirtIOMMIOProxy *proxy, uint16_t vector,
+                                 bool mask)
+{
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIOMMIOMSIVector *v = &proxy->msi_vectors[vector];
+    EventNotifier *notifier;
+    int n;
+
+    if (v->masked == mask) {
+        return;
+    }
+    v->masked = mask;
+
+    for (n = 0; v->users && n < proxy->msi_irqfd_nvqs; n++) {
+        if (virtio_queue_vector(vdev, n) != vector) {
+            continue;
+        }
+        notifier = virtio_queue_get_guest_notifier(virtio_get_queue(vdev, n));
+        if (mask) {
+            kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, notifier,
+                                                  v->virq);
+        } else {
+            kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, notifier, NULL,
+                                               v->virq);
+        }
+    }
+
+    if (!mask && v->pending) {
+        v->pending = false;
+        virtio_mmio_msi_send(proxy, vector);
+    }
+}
+
+static void virtio_mmio_msi_command(VirtIOMMIOProxy *proxy,
+                                    VirtIODevice *vdev, uint32_t cmd)
+{
+    uint32_t vector = proxy->msi_vec_sel;
+    bool running = vdev->status & VIRTIO_CONFIG_S_DRIVER_OK;
+    VirtIOMMIOMSIVector *v;
+
+    switch (cmd) {
+    case VIRTIO_MMIO_MSI_CMD_ENABLE:
+    case VIRTIO_MMIO_MSI_CMD_DISABLE:
+        if (running) {
+            DPRINTF("MSI enabled or disabled after DRIVER_OK\n");
+            return;
+        }
+        proxy->msi_enabled = cmd == VIRTIO_MMIO_MSI_CMD_ENABLE;
+        qemu_set_irq(proxy->irq,
+                     !proxy->msi_enabled && atomic_read(&vdev->isr) != 0);
+        break;
+    case VIRTIO_MMIO_MSI_CMD_CONFIGURE:
+        if (vector >= proxy->nvectors) {
+            DPRINTF("bad MSI vector %u\n", vector);
+            return;
+        }
+        v = &proxy->msi_vectors[vector];
+        v->msg.address = ((uint64_t)proxy->msi_address_high << 32) |
+                         proxy->msi_address_low;
+        v->msg.data = proxy->msi_data;
+        if (v->users) {
+            kvm_irqchip_update_msi_route_devid(kvm_state, v->virq, v->msg,
+                                               proxy->msi_requester_id);
+            kvm_irqchip_commit_routes(kvm_state);
+        }
+        if (!v->masked && v->pending) {
+            v->pending = false;
+            virtio_mmio_msi_send(proxy, vector);
+        }
+        break;
+    case VIRTIO_MMIO_MSI_CMD_MASK:
+    case VIRTIO_MMIO_MSI_CMD_UNMASK:
+        if (vector >= proxy->nvectors) {
+            DPRINTF("bad MSI vector %u\n", vector);
+            return;
+        }
+        virtio_mmio_msi_mask(proxy, vector, cmd == VIRTIO_MMIO_MSI_CMD_MASK);
+        break;
+    case VIRTIO_MMIO_MSI_CMD_MAP_CONFIG:
+    case VIRTIO_MMIO_MSI_CMD_MAP_QUEUE:
+        if (vector >= proxy->nvectors && vector != VIRTIO_NO_VECTOR) {
+            DPRINTF("bad MSI vector %u\n", vector);
+            return;
+        }
+        if (cmd == VIRTIO_MMIO_MSI_CMD_MAP_CONFIG) {
+            vdev->config_vector = vector;
+        } else if (running) {
+            /* Queue vectors may be wired to irqfds by now */
+            DPRINTF("queue vector mapped after DRIVER_OK\n");
+        } else {
+            virtio_queue_set_vector(vdev, vdev->queue_sel, vector);
+        }
+        break;
+    default:
+        DPRINTF("bad MSI command %u\n", cmd);
+    }
+}
+
 static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
 {
     VirtIOMMIOProxy *proxy = (VirtIOMMIOProxy *)opaque;
@@ -173,6 +413,12 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
         return atomic_read(&vdev->isr);
     case VIRTIO_MMIO_STATUS:
         return vdev->status;
+    case VIRTIO_MMIO_MSI_VEC_NUM:
+        return proxy->nvectors;
+    case VIRTIO_MMIO_MSI_STATE:
+        return proxy->msi_enabled ? VIRTIO_MMIO_MSI_ENABLED : 0;
+    case VIRTIO_MMIO_MSI_VEC_SEL:
+        return proxy->nvectors ? proxy->msi_vec_sel : 0;
     case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
     case VIRTIO_MMIO_DRIVER_FEATURES:
     case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
@@ -182,6 +428,10 @@ static uint64_t virtio_mmio_read(void *opaque, hwaddr offset, unsigned size)
     case VIRTIO_MMIO_QUEUE_ALIGN:
     case VIRTIO_MMIO_QUEUE_NOTIFY:
     case VIRTIO_MMIO_INTERRUPT_ACK:
+    case VIRTIO_MMIO_MSI_COMMAND:
+    case VIRTIO_MMIO_MSI_ADDRESS_LOW:
+    case VIRTIO_MMIO_MSI_ADDRESS_HIGH:
+    case VIRTIO_MMIO_MSI_DATA:
         DPRINTF("read of write-only register\n");
         return 0;
     default:
@@ -296,6 +546,27 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
             virtio_reset(vdev);
         }
         break;
+    case VIRTIO_MMIO_MSI_VEC_SEL:
+    case VIRTIO_MMIO_MSI_ADDRESS_LOW:
+    case VIRTIO_MMIO_MSI_ADDRESS_HIGH:
+    case VIRTIO_MMIO_MSI_DATA:
+    case VIRTIO_MMIO_MSI_COMMAND:
+        if (!proxy->nvectors) {
+            DPRINTF("MSI register written with MSI disabled\n");
+            break;
+        }
+        if (offset == VIRTIO_MMIO_MSI_VEC_SEL) {
+            proxy->msi_vec_sel = value;
+        } else if (offset == VIRTIO_MMIO_MSI_ADDRESS_LOW) {
+            proxy->msi_address_low = value;
+        } else if (offset == VIRTIO_MMIO_MSI_ADDRESS_HIGH) {
+            proxy->msi_address_high = value;
+        } else if (offset == VIRTIO_MMIO_MSI_DATA) {
+            proxy->msi_data = value;
+        } else {
+            virtio_mmio_msi_command(proxy, vdev, value);
+        }
+        break;
     case VIRTIO_MMIO_MAGIC_VALUE:
     case VIRTIO_MMIO_VERSION:
     case VIRTIO_MMIO_DEVICE_ID:
@@ -303,6 +574,8 @@ static void virtio_mmio_write(void *opaque, hwaddr offset, uint64_t value,
     case VIRTIO_MMIO_DEVICE_FEATURES:
     case VIRTIO_MMIO_QUEUE_NUM_MAX:
     case VIRTIO_MMIO_INTERRUPT_STATUS:
+    case VIRTIO_MMIO_MSI_VEC_NUM:
+    case VIRTIO_MMIO_MSI_STATE:
         DPRINTF("write to readonly register\n");
         break;
 
@@ -326,6 +599,13 @@ static void virtio_mmio_update_irq(DeviceState *opaque, uint16_t vector)
     if (!vdev) {
         return;
     }
+    if (proxy->msi_enabled) {
+        /* Interrupts for unmapped queues are dropped, as with MSI-X */
+        if (vector < proxy->nvectors) {
+            virtio_mmio_msi_send(proxy, vector);
+        }
+        return;
+    }
     level = (atomic_read(&vdev->isr) != 0);
     DPRINTF("virtio_mmio setting IRQ %d\n", level);
     qemu_set_irq(proxy->irq, level);
@@ -338,6 +618,24 @@ static int virtio_mmio_load_config(DeviceState *opaque, QEMUFile *f)
     proxy->host_features_sel = qemu_get_be32(f);
     proxy->guest_features_sel = qemu_get_be32(f);
     proxy->guest_page_shift = qemu_get_be32(f);
+
+    if (proxy->nvectors) {
+        VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+        int i;
+
+        proxy->msi_enabled = qemu_get_byte(f);
+        proxy->msi_vec_sel = qemu_get_be32(f);
+        proxy->msi_address_low = qemu_get_be32(f);
+        proxy->msi_address_high = qemu_get_be32(f);
+        proxy->msi_data = qemu_get_be32(f);
+        for (i = 0; i < proxy->nvectors; i++) {
+            proxy->msi_vectors[i].msg.address = qemu_get_be64(f);
+            proxy->msi_vectors[i].msg.data = qemu_get_be32(f);
+            proxy->msi_vectors[i].masked = qemu_get_byte(f);
+            proxy->msi_vectors[i].pending = qemu_get_byte(f);
+        }
+        vdev->config_vector = qemu_get_be16(f);
+    }
     return 0;
 }
 
@@ -348,17 +646,85 @@ static void virtio_mmio_save_config(DeviceState *opaque, QEMUFile *f)
     qemu_put_be32(f, proxy->host_features_sel);
     qemu_put_be32(f, proxy->guest_features_sel);
     qemu_put_be32(f, proxy->guest_page_shift);
+
+    if (proxy->nvectors) {
+        VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+        int i;
+
+        qemu_put_byte(f, proxy->msi_enabled);
+        qemu_put_be32(f, proxy->msi_vec_sel);
+        qemu_put_be32(f, proxy->msi_address_low);
+        qemu_put_be32(f, proxy->msi_address_high);
+        qemu_put_be32(f, proxy->msi_data);
+        for (i = 0; i < proxy->nvectors; i++) {
+            qemu_put_be64(f, proxy->msi_vectors[i].msg.address);
+            qemu_put_be32(f, proxy->msi_vectors[i].msg.data);
+            qemu_put_byte(f, proxy->msi_vectors[i].masked);
+            qemu_put_byte(f, proxy->msi_vectors[i].pending);
+        }
+        qemu_put_be16(f, vdev->config_vector);
+    }
+}
+
+static int virtio_mmio_load_queue(DeviceState *opaque, int n, QEMUFile *f)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    uint16_t vector;
+
+    if (!proxy->nvectors) {
+        return 0;
+    }
+
+    vector = qemu_get_be16(f);
+    if (vector >= proxy->nvectors && vector != VIRTIO_NO_VECTOR) {
+        error_report("virtio-mmio: bad MSI vector %u for queue %d",
+                     vector, n);
+        return -EINVAL;
+    }
+    virtio_queue_set_vector(vdev, n, vector);
+    return 0;
+}
+
+static void virtio_mmio_save_queue(DeviceState *opaque, int n, QEMUFile *f)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+
+    if (proxy->nvectors) {
+        qemu_put_be16(f, virtio_queue_vector(vdev, n));
+    }
+}
+
+static int virtio_mmio_query_nvectors(DeviceState *opaque)
+{
+    VirtIOMMIOProxy *proxy = VIRTIO_MMIO(opaque);
+
+    return proxy->nvectors;
 }
 
 static void virtio_mmio_reset(DeviceState *d)
 {
     VirtIOMMIOProxy *proxy = VIRTIO_MMIO(d);
+    int i;
 
     virtio_mmio_stop_ioeventfd(proxy);
     virtio_bus_reset(&proxy->bus);
     proxy->host_features_sel = 0;
     proxy->guest_features_sel = 0;
     proxy->guest_page_shift = 0;
+
+    proxy->msi_enabled = false;
+    proxy->msi_vec_sel = 0;
+    proxy->msi_address_low = 0;
+    proxy->msi_address_high = 0;
+    proxy->msi_data = 0;
+    for (i = 0; i < proxy->nvectors; i++) {
+        proxy->msi_vectors[i].msg.address = 0;
+        proxy->msi_vectors[i].msg.data = 0;
+        proxy->msi_vectors[i].masked = false;
+        proxy->msi_vectors[i].pending = false;
+    }
 }
 
 static int virtio_mmio_set_guest_notifier(DeviceState *d, int n, bool assign,
@@ -393,12 +759,19 @@ static int virtio_mmio_set_guest_notifiers(DeviceState *d, int nvqs,
 {
     VirtIOMMIOProxy *proxy = VIRTIO_MMIO(d);
     VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
-    /* TODO: need to check if kvm-arm supports irqfd */
-    bool with_irqfd = false;
+    /* Only MSIs can be routed to irqfds, the legacy interrupt needs the ISR */
+    bool with_irqfd = proxy->msi_enabled && kvm_msi_via_irqfd_enabled();
     int r, n;
 
     nvqs = MIN(nvqs, VIRTIO_QUEUE_MAX);
 
+    if (!assign) {
+        for (n = 0; n < proxy->msi_irqfd_nvqs; n++) {
+            virtio_mmio_irqfd_release(proxy, n);
+        }
+        proxy->msi_irqfd_nvqs = 0;
+    }
+
     for (n = 0; n < nvqs; n++) {
         if (!virtio_queue_get_num(vdev, n)) {
             break;
@@ -409,14 +782,31 @@ static int virtio_mmio_set_guest_notifiers(DeviceState *d, int nvqs,
             goto assign_error;
         }
     }
+    nvqs = n;
+
+    if (assign && with_irqfd) {
+        for (n = 0; n < nvqs; n++) {
+            r = virtio_mmio_irqfd_use(proxy, n);
+            if (r < 0) {
+                goto irqfd_error;
+            }
+        }
+        proxy->msi_irqfd_nvqs = nvqs;
+    }
 
     return 0;
 
+irqfd_error:
+    while (--n >= 0) {
+        virtio_mmio_irqfd_release(proxy, n);
+    }
+    n = nvqs;
+
 assign_error:
     /* We get here on assignment failure. Recover by undoing for VQs 0 .. n. */
     assert(assign);
     while (--n >= 0) {
-        virtio_mmio_set_guest_notifier(d, n, !assign, false);
+        virtio_mmio_set_guest_notifier(d, n, !assign, with_irqfd);
     }
     return r;
 }
@@ -426,6 +816,9 @@ assign_error:
 static Property virtio_mmio_properties[] = {
     DEFINE_PROP_BOOL("format_transport_address", VirtIOMMIOProxy,
                      format_transport_address, true),
+    DEFINE_PROP_UINT32("vectors", VirtIOMMIOProxy, nvectors, 0),
+    DEFINE_PROP_UINT16("msi-requester-id", VirtIOMMIOProxy,
+                       msi_requester_id, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -433,6 +826,17 @@ static void virtio_mmio_realizefn(DeviceState *d, Error **errp)
 {
     VirtIOMMIOProxy *proxy = VIRTIO_MMIO(d);
     SysBusDevice *sbd = SYS_BUS_DEVICE(d);
+    int i;
+
+    if (proxy->nvectors > VIRTIO_QUEUE_MAX) {
+        error_setg(errp, "virtio-mmio supports at most %d MSI vectors",
+                   VIRTIO_QUEUE_MAX);
+        return;
+    }
+    proxy->msi_vectors = g_new0(VirtIOMMIOMSIVector, proxy->nvectors);
+    for (i = 0; i < proxy->nvectors; i++) {
+        proxy->msi_vectors[i].virq = -1;
+    }
 
     qbus_create_inplace(&proxy->bus, sizeof(proxy->bus), TYPE_VIRTIO_MMIO_BUS,
                         d, NULL);
@@ -509,6 +913,9 @@ static void virtio_mmio_bus_class_init(ObjectClass *klass, void *data)
     k->notify = virtio_mmio_update_irq;
     k->save_config = virtio_mmio_save_config;
     k->load_config = virtio_mmio_load_config;
+    k->save_queue = virtio_mmio_save_queue;
+    k->load_queue = virtio_mmio_load_queue;
+    k->query_nvectors = virtio_mmio_query_nvectors;
     k->set_guest_notifiers = virtio_mmio_set_guest_notifiers;
     k->ioeventfd_enabled = virtio_mmio_ioeventfd_enabled;
     k->ioeventfd_assign = virtio_mmio_ioeventfd_assign;
@@ -23,6 +23,7 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
+#include "qapi/qapi-commands-misc.h"
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -31,6 +32,16 @@
  */
 #define VIRTIO_PCI_VRING_ALIGN         4096
 
+/*
+ * Adaptive interrupt coalescing: below RATE_LOW completions per second
+ * interrupts are not delayed, above RATE_HIGH they are delayed by the full
+ * intr-coalesce-usecs.  The rate is sampled over WINDOW_NS.
+ */
+#define VIRTIO_COALESCE_WINDOW_NS      (1 * SCALE_MS)
+#define VIRTIO_COALESCE_RATE_LOW       10000
+#define VIRTIO_COALESCE_RATE_HIGH      200000
+#define VIRTIO_COALESCE_MAX_USECS      10000
+
 typedef struct VRingDesc
 {
     uint64_t addr;
@@ -59,6 +70,29 @@ typedef struct VRingUsed
     VRingUsedElem ring[0];
 } VRingUsed;
 
+typedef struct VRingPackedDesc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} VRingPackedDesc;
+
+typedef struct VRingPackedDescEvent {
+    uint16_t off_wrap;
+    uint16_t flags;
+} VRingPackedDescEvent;
+
+/* A buffer completed on a packed ring, waiting for virtqueue_flush() */
+typedef struct VRingPackedUsedElem {
+    unsigned int index;
+    unsigned int len;
+    unsigned int ndescs;
+} VRingPackedUsedElem;
+
+/*
+ * For packed rings, avail and used are the driver and device event
+ * suppression areas respectively.
+ */
 typedef struct VRingMemoryRegionCaches {
     struct rcu_head rcu;
     MemoryRegionCache desc;
@@ -77,17 +111,83 @@ typedef struct VRing
     VRingMemoryRegionCaches *caches;
 } VRing;
 
+#define VIRTQUEUE_LATENCY_BINS 20
+
+/*
+ * Instrumentation for query-virtio-queue-status.  It is only written by
+ * the thread that processes the queue and read without synchronization,
+ * so the values reported may be slightly out of date.
+ */
+typedef struct VirtQueueStats {
+    uint64_t kicks;
+    uint64_t interrupts;
+    uint64_t popped;
+    uint64_t completed;
+    int64_t last_kick;
+    int64_t last_interrupt;
+    /* Bin 0 counts pop to fill times below 1 us, bin i up to 2^i us */
+    uint64_t latency_bins[VIRTQUEUE_LATENCY_BINS];
+} VirtQueueStats;
+
+/*
+ * Cache of elements for one VirtQueue.  The free list belongs to the
+ * thread that pops from the queue, while virtqueue_element_free may run
+ * anywhere and pushes elements onto the returned list.  virtqueue_flush
+ * and virtqueue_pop take the whole returned list at once.
+ *
+ * An element popped from the pool is owned by the device until it calls
+ * virtqueue_element_free, which hands it back exactly once.  The queue
+ * holds a reference to the pool, and so does every slot.  When the queue
+ * goes away, the cached slots are freed after an RCU grace period, and
+ * those still in flight are freed when they come back.
+ */
+struct VirtQueueElementPool {
+    struct rcu_head rcu;
+    size_t sz;
+    size_t slot_size;
+    unsigned int max_sg;
+    unsigned int nr_slots;
+    QSLIST_HEAD(, VirtQueueElement) free;
+    QSLIST_HEAD(, VirtQueueElement) returned;
+    int refcnt;
+    bool dead;
+};
+
 struct VirtQueue
 {
     VRing vring;
 
     /* Next head to pop */
     uint16_t last_avail_idx;
+    bool last_avail_wrap_counter;
 
     /* Last avail_idx read from VQ. */
     uint16_t shadow_avail_idx;
+    bool shadow_avail_wrap_counter;
 
     uint16_t used_idx;
+    bool used_wrap_counter;
+
+    /* Packed ring buffers filled but not flushed yet */
+    VRingPackedUsedElem *used_elems;
+
+    VirtQueueElementPool *element_pool;
+
+    /* Interrupt coalescing, see virtio_queue_coalesce() */
+    QEMUTimer *coalesce_timer;
+    AioContext *coalesce_ctx;
+    bool coalesce_pending;
+    bool coalesce_irqfd;
+    unsigned int coalesce_frames;
+    uint32_t coalesce_cur_usecs;
+    int64_t coalesce_window_start;
+    unsigned int coalesce_window_frames;
+
+    /* Host notifier polling: calls that found requests and calls that did not */
+    uint64_t poll_hits;
+    uint64_t poll_misses;
+
+    VirtQueueStats *stats;
 
     /* Last used index value we have signalled on */
     uint16_t signalled_used;
@@ -111,6 +211,9 @@ struct VirtQueue
     QLIST_ENTRY(VirtQueue) node;
 };
 
+static void virtio_queue_coalesce_flush(VirtQueue *vq);
+static void virtio_queue_coalesce_cancel(VirtQueue *vq);
+
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
 {
     if (!caches) {
@@ -131,8 +234,11 @@ static void virtio_init_region_cache(VirtIODevice *vdev, int n)
     hwaddr addr, size;
     int event_size;
     int64_t len;
+    bool packed;
 
-    event_size = virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+    packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+    event_size = !packed &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
     addr = vq->vring.desc;
     if (!addr) {
@@ -140,8 +246,9 @@ static void virtio_init_region_cache(VirtIODevice *vdev, int n)
     }
     new = g_new0(VRingMemoryRegionCaches, 1);
     size = virtio_queue_get_desc_size(vdev, n);
+    /* Used descriptors are written back into a packed ring */
     len = address_space_cache_init(&new->desc, vdev->dma_as,
-                                   addr, size, false);
+                                   addr, size, packed);
     if (len < size) {
         virtio_error(vdev, "Cannot map desc");
         goto err_desc;
@@ -205,6 +312,89 @@ static void vring_desc_read(VirtIODevice *vdev, VRingDesc *desc,
     virtio_tswap16s(vdev, &desc->next);
 }
 
+/* Called within rcu_read_lock().  */
+static void vring_packed_desc_read_flags(VirtIODevice *vdev, uint16_t *flags,
+                                         MemoryRegionCache *cache, int i)
+{
+    hwaddr off = i * sizeof(VRingPackedDesc) + offsetof(VRingPackedDesc, flags);
+
+    *flags = virtio_lduw_phys_cached(vdev, cache, off);
+}
+
+/* Called within rcu_read_lock().  */
+static void vring_packed_desc_read(VirtIODevice *vdev, VRingPackedDesc *desc,
+                                   MemoryRegionCache *cache, int i,
+                                   bool strict_order)
+{
+    hwaddr off = i * sizeof(VRingPackedDesc);
+
+    vring_packed_desc_read_flags(vdev, &desc->flags, cache, i);
+
+    if (strict_order) {
+        /* Make sure flags is read before the rest fields. */
+        smp_rmb();
+    }
+
+    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, addr),
+                              &desc->addr, sizeof(desc->addr));
+    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, id),
+                              &desc->id, sizeof(desc->id));
+    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, len),
+                              &desc->len, sizeof(desc->len));
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap16s(vdev, &desc->id);
+    virtio_tswap32s(vdev, &desc->len);
+}
+
+/* Called within rcu_read_lock().  */
+static void vring_packed_desc_write(VirtIODevice *vdev, VRingPackedDesc *desc,
+                                    MemoryRegionCache *cache, int i,
+                                    bool strict_order)
+{
+    hwaddr off = i * sizeof(VRingPackedDesc);
+    hwaddr off_id = off + offsetof(VRingPackedDesc, id);
+    hwaddr off_len = off + offsetof(VRingPackedDesc, len);
+    hwaddr off_flags = off + offsetof(VRingPackedDesc, flags);
+
+    virtio_tswap16s(vdev, &desc->id);
+    virtio_tswap32s(vdev, &desc->len);
+    address_space_write_cached(cache, off_id, &desc->id, sizeof(desc->id));
+    address_space_cache_invalidate(cache, off_id, sizeof(desc->id));
+    address_space_write_cached(cache, off_len, &desc->len, sizeof(desc->len));
+    address_space_cache_invalidate(cache, off_len, sizeof(desc->len));
+
+    if (strict_order) {
+        /* Make sure id and len are written before flags. */
+        smp_wmb();
+    }
+
+    virtio_stw_phys_cached(vdev, cache, off_flags, desc->flags);
+    address_space_cache_invalidate(cache, off_flags, sizeof(desc->flags));
+}
+
+/* Called within rcu_read_lock().  */
+static void vring_packed_event_read(VirtIODevice *vdev,
+                                    MemoryRegionCache *cache,
+                                    VRingPackedDescEvent *e)
+{
+    e->flags = virtio_lduw_phys_cached(vdev, cache,
+                                       offsetof(VRingPackedDescEvent, flags));
+    /* Make sure flags is seen before off_wrap */
+    smp_rmb();
+    e->off_wrap = virtio_lduw_phys_cached(vdev, cache,
+                                          offsetof(VRingPackedDescEvent,
+                                                   off_wrap));
+}
+
+/* Called within rcu_read_lock().  */
+static void vring_packed_event_write(VirtIODevice *vdev,
+                                     MemoryRegionCache *cache,
+                                     hwaddr off, uint16_t val)
+{
+    virtio_stw_phys_cached(vdev, cache, off, val);
+    address_space_cache_invalidate(cache, off, sizeof(val));
+}
+
 static VRingMemoryRegionCaches *vring_get_region_caches(struct VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches = atomic_rcu_read(&vq->vring.caches);
@@ -311,6 +501,31 @@ static inline void vring_set_avail_event(VirtQueue *vq, uint16_t val)
     address_space_cache_invalidate(&caches->used, pa, sizeof(val));
 }
 
+/* Called within rcu_read_lock().  */
+static void virtio_queue_packed_set_notification(VirtQueue *vq, int enable)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    uint16_t flags, off_wrap;
+
+    if (!enable) {
+        flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        off_wrap = vq->shadow_avail_idx |
+                   vq->shadow_avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+        vring_packed_event_write(vq->vdev, &caches->used,
+                                 offsetof(VRingPackedDescEvent, off_wrap),
+                                 off_wrap);
+        /* Make sure off_wrap is written before flags */
+        smp_wmb();
+        flags = VRING_PACKED_EVENT_FLAG_DESC;
+    } else {
+        flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+
+    vring_packed_event_write(vq->vdev, &caches->used,
+                             offsetof(VRingPackedDescEvent, flags), flags);
+}
+
 void virtio_queue_set_notification(VirtQueue *vq, int enable)
 {
     vq->notification = enable;
@@ -320,7 +535,9 @@ void virtio_queue_set_notification(VirtQueue *vq, int enable)
     }
 
     rcu_read_lock();
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtio_queue_packed_set_notification(vq, enable);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vring_avail_idx(vq));
     } else if (enable) {
         vring_used_flags_unset_bit(vq, VRING_USED_F_NO_NOTIFY);
@@ -342,7 +559,7 @@ int virtio_queue_ready(VirtQueue *vq)
 /* Fetch avail_idx from VQ memory only when we really need to know if
  * guest has added some buffers.
  * Called within rcu_read_lock().  */
-static int virtio_queue_empty_rcu(VirtQueue *vq)
+static int virtio_queue_split_empty_rcu(VirtQueue *vq)
 {
     if (unlikely(!vq->vring.avail)) {
         return 1;
@@ -355,20 +572,57 @@ static int virtio_queue_empty_rcu(VirtQueue *vq)
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
-int virtio_queue_empty(VirtQueue *vq)
+static bool is_desc_avail(uint16_t flags, bool wrap_counter)
 {
-    bool empty;
+    bool avail, used;
 
-    if (unlikely(!vq->vring.avail)) {
+    avail = !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL));
+    used = !!(flags & (1 << VRING_PACKED_DESC_F_USED));
+    return (avail != used) && (avail == wrap_counter);
+}
+
+/* Called within rcu_read_lock().  */
+static int virtio_queue_packed_empty_rcu(VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches;
+    uint16_t flags;
+
+    if (unlikely(!vq->vring.desc)) {
         return 1;
     }
 
-    if (vq->shadow_avail_idx != vq->last_avail_idx) {
-        return 0;
+    caches = vring_get_region_caches(vq);
+    vring_packed_desc_read_flags(vq->vdev, &flags, &caches->desc,
+                                 vq->last_avail_idx);
+
+    return !is_desc_avail(flags, vq->last_avail_wrap_counter);
+}
+
+/* Called within rcu_read_lock().  */
+static int virtio_queue_empty_rcu(VirtQueue *vq)
+{
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtio_queue_packed_empty_rcu(vq);
+    }
+    return virtio_queue_split_empty_rcu(vq);
+}
+
+int virtio_queue_empty(VirtQueue *vq)
+{
+    bool empty;
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        if (unlikely(!vq->vring.avail)) {
+            return 1;
+        }
+
+        if (vq->shadow_avail_idx != vq->last_avail_idx) {
+            return 0;
+        }
     }
 
     rcu_read_lock();
-    empty = vring_avail_idx(vq) == vq->last_avail_idx;
+    empty = virtio_queue_empty_rcu(vq);
     rcu_read_unlock();
     return empty;
 }
@@ -410,10 +664,20 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len)
 {
-    vq->inuse--;
+    vq->inuse -= elem->ndescs;
     virtqueue_unmap_sg(vq, elem, len);
 }
 
+static void virtqueue_packed_rewind(VirtQueue *vq, unsigned int num)
+{
+    if (vq->last_avail_idx < num) {
+        vq->last_avail_idx = vq->vring.num + vq->last_avail_idx - num;
+        vq->last_avail_wrap_counter ^= 1;
+    } else {
+        vq->last_avail_idx -= num;
+    }
+}
+
 /* virtqueue_unpop:
  * @vq: The #VirtQueue
  * @elem: The #VirtQueueElement
@@ -425,7 +689,11 @@ void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
 void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
                      unsigned int len)
 {
-    vq->last_avail_idx--;
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_rewind(vq, elem->ndescs);
+    } else {
+        vq->last_avail_idx--;
+    }
     virtqueue_detach_element(vq, elem, len);
 }
 
@@ -439,31 +707,86 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
  * Use virtqueue_unpop() instead if you have a VirtQueueElement.
  *
  * Returns: true on success, false if @num is greater than the number of in use
- * elements.
+ * elements.  On a packed ring every element must consist of one descriptor.
  */
 bool virtqueue_rewind(VirtQueue *vq, unsigned int num)
 {
     if (num > vq->inuse) {
         return false;
     }
-    vq->last_avail_idx -= num;
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_rewind(vq, num);
+    } else {
+        vq->last_avail_idx -= num;
+    }
     vq->inuse -= num;
     return true;
 }
 
-/* Called within rcu_read_lock().  */
-void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
-                    unsigned int len, unsigned int idx)
+/*
+ * The stats of a queue are freed by virtio_del_queue(), but its notifiers
+ * may still fire, so every helper checks for them.
+ */
+static void virtqueue_stats_kick(VirtQueue *vq)
 {
-    VRingUsedElem uelem;
+    if (!vq->stats) {
+        return;
+    }
+    vq->stats->kicks++;
+    vq->stats->last_kick = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
 
-    trace_virtqueue_fill(vq, elem, len, idx);
+static void virtqueue_stats_interrupt(VirtQueue *vq)
+{
+    if (!vq->stats) {
+        return;
+    }
+    vq->stats->interrupts++;
+    vq->stats->last_interrupt = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
 
-    virtqueue_unmap_sg(vq, elem, len);
+/* A batch shares a single timestamp, to keep the clock off the fast path */
+static void virtqueue_stats_popped(VirtQueue *vq, void **elems, unsigned int n)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    unsigned int i;
 
-    if (unlikely(vq->vdev->broken)) {
+    if (!vq->stats) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        ((VirtQueueElement *)elems[i])->pop_time = now;
+    }
+    vq->stats->popped += n;
+}
+
+static void virtqueue_stats_completed(VirtQueue *vq,
+                                      const VirtQueueElement *elem, int64_t now)
+{
+    uint64_t us;
+    int bin = 0;
+
+    if (!vq->stats) {
         return;
     }
+    vq->stats->completed++;
+    if (!elem->pop_time) {
+        /* e.g. in flight at migration time */
+        return;
+    }
+
+    us = (now - elem->pop_time) / SCALE_US;
+    if (us) {
+        bin = MIN(64 - clz64(us), VIRTQUEUE_LATENCY_BINS - 1);
+    }
+    vq->stats->latency_bins[bin]++;
+}
+
+/* Called within rcu_read_lock().  */
+static void virtqueue_split_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                 unsigned int len, unsigned int idx)
+{
+    VRingUsedElem uelem;
 
     if (unlikely(!vq->vring.used)) {
         return;
@@ -476,16 +799,52 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
     vring_used_write(vq, &uelem, idx);
 }
 
+/*
+ * On a packed ring the used descriptors overwrite the available ones, so
+ * nothing is written to the guest until virtqueue_flush().
+ */
+static void virtqueue_packed_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                  unsigned int len, unsigned int idx)
+{
+    vq->used_elems[idx].index = elem->index;
+    vq->used_elems[idx].len = len;
+    vq->used_elems[idx].ndescs = elem->ndescs;
+}
+
 /* Called within rcu_read_lock().  */
-void virtqueue_flush(VirtQueue *vq, unsigned int count)
+static void virtqueue_fill_at(VirtQueue *vq, const VirtQueueElement *elem,
+                              unsigned int len, unsigned int idx, int64_t now)
 {
-    uint16_t old, new;
+    trace_virtqueue_fill(vq, elem, len, idx);
+
+    virtqueue_unmap_sg(vq, elem, len);
 
     if (unlikely(vq->vdev->broken)) {
-        vq->inuse -= count;
         return;
     }
 
+    virtqueue_stats_completed(vq, elem, now);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_fill(vq, elem, len, idx);
+    } else {
+        virtqueue_split_fill(vq, elem, len, idx);
+    }
+}
+
+/* Called within rcu_read_lock().  */
+void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                    unsigned int len, unsigned int idx)
+{
+    virtqueue_fill_at(vq, elem, len, idx,
+                      qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+}
+
+/* Called within rcu_read_lock().  */
+static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
+{
+    uint16_t old, new;
+
     if (unlikely(!vq->vring.used)) {
         return;
     }
@@ -501,6 +860,105 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         vq->signalled_used_valid = false;
 }
 
+/* Called within rcu_read_lock().  */
+static void virtqueue_packed_fill_desc(VirtQueue *vq,
+                                       const VRingPackedUsedElem *uelem,
+                                       unsigned int offset, bool strict_order)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VRingPackedDesc desc = {
+        .id = uelem->index,
+        .len = uelem->len,
+    };
+    bool wrap_counter = vq->used_wrap_counter;
+    unsigned int head = vq->used_idx + offset;
+
+    if (head >= vq->vring.num) {
+        head -= vq->vring.num;
+        wrap_counter ^= 1;
+    }
+    if (wrap_counter) {
+        desc.flags = (1 << VRING_PACKED_DESC_F_AVAIL) |
+                     (1 << VRING_PACKED_DESC_F_USED);
+    }
+
+    vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head,
+                            strict_order);
+}
+
+/* Called within rcu_read_lock().  */
+static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
+{
+    unsigned int i, ndescs;
+
+    if (unlikely(!vq->vring.desc) || !count) {
+        return;
+    }
+
+    trace_virtqueue_flush(vq, count);
+
+    /*
+     * Each buffer takes the slots of all its descriptors, but only the
+     * first slot is written.  The first buffer is made visible last, so
+     * that the guest never sees a partially written batch.
+     */
+    ndescs = vq->used_elems[0].ndescs;
+    for (i = 1; i < count; i++) {
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
+        ndescs += vq->used_elems[i].ndescs;
+    }
+    /* Make sure the rest of the batch is written before the first flags. */
+    smp_wmb();
+    virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
+}
+
+/* Move elements released since the last call back to the free list */
+static void virtqueue_element_pool_reclaim(VirtQueueElementPool *pool)
+{
+    QSLIST_HEAD(, VirtQueueElement) returned;
+    VirtQueueElement *elem;
+
+    if (!atomic_read(&pool->returned.slh_first)) {
+        return;
+    }
+
+    QSLIST_MOVE_ATOMIC(&returned, &pool->returned);
+    while ((elem = QSLIST_FIRST(&returned))) {
+        QSLIST_REMOVE_HEAD(&returned, pool_next);
+        QSLIST_INSERT_HEAD(&pool->free, elem, pool_next);
+    }
+}
+
+/* Called within rcu_read_lock().  */
+void virtqueue_flush(VirtQueue *vq, unsigned int count)
+{
+    if (unlikely(vq->vdev->broken)) {
+        vq->inuse -= count;
+        return;
+    }
+
+    if (vq->element_pool) {
+        virtqueue_element_pool_reclaim(vq->element_pool);
+    }
+
+    vq->coalesce_frames += count;
+    vq->coalesce_window_frames += count;
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_flush(vq, count);
+    } else {
+        virtqueue_split_flush(vq, count);
+    }
+}
+
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len)
 {
@@ -510,6 +968,24 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     rcu_read_unlock();
 }
 
+/*
+ * Return @count elements to the guest and publish them with a single used
+ * index update.  @lens may be NULL if nothing was written to the buffers.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement * const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    unsigned int i;
+
+    rcu_read_lock();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill_at(vq, elems[i], lens ? lens[i] : 0, i, now);
+    }
+    virtqueue_flush(vq, count);
+    rcu_read_unlock();
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -576,9 +1052,11 @@ static int virtqueue_read_next_desc(VirtIODevice *vdev, VRingDesc *desc,
     return VIRTQUEUE_READ_DESC_MORE;
 }
 
-void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
-                               unsigned int *out_bytes,
-                               unsigned max_in_bytes, unsigned max_out_bytes)
+static void virtqueue_split_get_avail_bytes(VirtQueue *vq,
+                                            unsigned int *in_bytes,
+                                            unsigned int *out_bytes,
+                                            unsigned max_in_bytes,
+                                            unsigned max_out_bytes)
 {
     VirtIODevice *vdev = vq->vdev;
     unsigned int max, idx;
@@ -588,16 +1066,6 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
     int64_t len = 0;
     int rc;
 
-    if (unlikely(!vq->vring.desc)) {
-        if (in_bytes) {
-            *in_bytes = 0;
-        }
-        if (out_bytes) {
-            *out_bytes = 0;
-        }
-        return;
-    }
-
     rcu_read_lock();
     idx = vq->last_avail_idx;
     total_bufs = in_total = out_total = 0;
@@ -701,14 +1169,183 @@ err:
     goto done;
 }
 
-int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
-                          unsigned int out_bytes)
+static int virtqueue_packed_read_next_desc(VirtQueue *vq,
+                                           VRingPackedDesc *desc,
+                                           MemoryRegionCache *desc_cache,
+                                           unsigned int max,
+                                           unsigned int *next,
+                                           bool indirect)
 {
-    unsigned int in_total, out_total;
+    /* If this descriptor says it doesn't chain, we're done. */
+    if (!indirect && !(desc->flags & VRING_DESC_F_NEXT)) {
+        return VIRTQUEUE_READ_DESC_DONE;
+    }
 
-    virtqueue_get_avail_bytes(vq, &in_total, &out_total, in_bytes, out_bytes);
-    return in_bytes <= in_total && out_bytes <= out_total;
-}
+    ++*next;
+    if (*next == max) {
+        if (indirect) {
+            return VIRTQUEUE_READ_DESC_DONE;
+        } else {
+            (*next) -= vq->vring.num;
+        }
+    }
+
+    vring_packed_desc_read(vq->vdev, desc, desc_cache, *next, false);
+    return VIRTQUEUE_READ_DESC_MORE;
+}
+
+static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
+                                             unsigned int *in_bytes,
+                                             unsigned int *out_bytes,
+                                             unsigned max_in_bytes,
+                                             unsigned max_out_bytes)
+{
+    VirtIODevice *vdev = vq->vdev;
+    unsigned int max, idx;
+    unsigned int total_bufs, in_total, out_total;
+    MemoryRegionCache *desc_cache;
+    VRingMemoryRegionCaches *caches;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
+    int64_t len = 0;
+    VRingPackedDesc desc;
+    bool wrap_counter;
+
+    rcu_read_lock();
+    idx = vq->last_avail_idx;
+    wrap_counter = vq->last_avail_wrap_counter;
+    total_bufs = in_total = out_total = 0;
+
+    caches = vring_get_region_caches(vq);
+    if (caches->desc.len < vq->vring.num * sizeof(VRingPackedDesc)) {
+        virtio_error(vdev, "Cannot map descriptor ring");
+        goto err;
+    }
+
+    for (;;) {
+        unsigned int num_bufs = total_bufs;
+        unsigned int i = idx;
+        int rc;
+
+        max = vq->vring.num;
+        desc_cache = &caches->desc;
+        vring_packed_desc_read(vdev, &desc, desc_cache, idx, true);
+        if (!is_desc_avail(desc.flags, wrap_counter)) {
+            break;
+        }
+
+        if (desc.flags & VRING_DESC_F_INDIRECT) {
+            if (desc.len % sizeof(VRingPackedDesc)) {
+                virtio_error(vdev, "Invalid size for indirect buffer table");
+                goto err;
+            }
+
+            /* If we've got too many, that implies a descriptor loop. */
+            if (num_bufs >= max) {
+                virtio_error(vdev, "Looped descriptor");
+                goto err;
+            }
+
+            /* loop over the indirect descriptor table */
+            len = address_space_cache_init(&indirect_desc_cache,
+                                           vdev->dma_as,
+                                           desc.addr, desc.len, false);
+            desc_cache = &indirect_desc_cache;
+            if (len < desc.len) {
+                virtio_error(vdev, "Cannot map indirect buffer");
+                goto err;
+            }
+
+            max = desc.len / sizeof(VRingPackedDesc);
+            num_bufs = i = 0;
+            vring_packed_desc_read(vdev, &desc, desc_cache, i, false);
+        }
+
+        do {
+            /* If we've got too many, that implies a descriptor loop. */
+            if (++num_bufs > max) {
+                virtio_error(vdev, "Looped descriptor");
+                goto err;
+            }
+
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                in_total += desc.len;
+            } else {
+                out_total += desc.len;
+            }
+            if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
+                goto done;
+            }
+
+            rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max,
+                                                 &i, desc_cache ==
+                                                 &indirect_desc_cache);
+        } while (rc == VIRTQUEUE_READ_DESC_MORE);
+
+        if (desc_cache == &indirect_desc_cache) {
+            address_space_cache_destroy(&indirect_desc_cache);
+            total_bufs++;
+            idx++;
+        } else {
+            idx += num_bufs - total_bufs;
+            total_bufs = num_bufs;
+        }
+
+        if (idx >= vq->vring.num) {
+            idx -= vq->vring.num;
+            wrap_counter ^= 1;
+        }
+    }
+
+    /* Record the index and wrap counter for a kick we want */
+    vq->shadow_avail_idx = idx;
+    vq->shadow_avail_wrap_counter = wrap_counter;
+done:
+    address_space_cache_destroy(&indirect_desc_cache);
+    if (in_bytes) {
+        *in_bytes = in_total;
+    }
+    if (out_bytes) {
+        *out_bytes = out_total;
+    }
+    rcu_read_unlock();
+    return;
+
+err:
+    in_total = out_total = 0;
+    goto done;
+}
+
+void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
+                               unsigned int *out_bytes,
+                               unsigned max_in_bytes, unsigned max_out_bytes)
+{
+    if (unlikely(!vq->vring.desc)) {
+        if (in_bytes) {
+            *in_bytes = 0;
+        }
+        if (out_bytes) {
+            *out_bytes = 0;
+        }
+        return;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        virtqueue_packed_get_avail_bytes(vq, in_bytes, out_bytes,
+                                         max_in_bytes, max_out_bytes);
+    } else {
+        virtqueue_split_get_avail_bytes(vq, in_bytes, out_bytes,
+                                        max_in_bytes, max_out_bytes);
+    }
+}
+
+int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
+                          unsigned int out_bytes)
+{
+    unsigned int in_total, out_total;
+
+    virtqueue_get_avail_bytes(vq, &in_total, &out_total, in_bytes, out_bytes);
+    return in_bytes <= in_total && out_bytes <= out_total;
+}
 
 static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
@@ -803,29 +1440,180 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
     virtqueue_map_iovec(vdev, elem->out_sg, elem->out_addr, &elem->out_num, 0);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * The arrays follow the caller's structure in a single allocation.  Their
+ * total size only depends on in_num + out_num, which is what allows pool
+ * slots of a fixed size.
+ */
+static size_t virtqueue_element_size(size_t sz, unsigned int nr_sg)
 {
     VirtQueueElement *elem;
+    size_t addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t addr_end = addr_ofs + nr_sg * sizeof(elem->in_addr[0]);
+    size_t sg_ofs = QEMU_ALIGN_UP(addr_end, __alignof__(elem->in_sg[0]));
+
+    return sg_ofs + nr_sg * sizeof(elem->in_sg[0]);
+}
+
+static void *virtqueue_init_element(void *mem, size_t sz,
+                                    unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = mem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
-    size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
-    assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->ndescs = 1;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
     elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->pool = NULL;
+    elem->pop_time = 0;
     return elem;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    assert(sz >= sizeof(VirtQueueElement));
+    return virtqueue_init_element(g_malloc(virtqueue_element_size(sz,
+                                                   out_num + in_num)),
+                                  sz, out_num, in_num);
+}
+
+static void *virtqueue_pool_alloc_element(VirtQueue *vq, size_t sz,
+                                          unsigned out_num, unsigned in_num)
+{
+    VirtQueueElementPool *pool = vq->element_pool;
+    VirtQueueElement *elem;
+
+    if (!pool || sz != pool->sz || out_num + in_num > pool->max_sg) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    if (QSLIST_EMPTY(&pool->free)) {
+        virtqueue_element_pool_reclaim(pool);
+    }
+
+    elem = QSLIST_FIRST(&pool->free);
+    if (elem) {
+        QSLIST_REMOVE_HEAD(&pool->free, pool_next);
+    } else if (pool->nr_slots < vq->vring.num) {
+        elem = g_malloc(pool->slot_size);
+        pool->nr_slots++;
+        atomic_inc(&pool->refcnt);
+    } else {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    virtqueue_init_element(elem, sz, out_num, in_num);
+    elem->pool = pool;
+    return elem;
+}
+
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    int old = atomic_fetch_dec(&pool->refcnt);
+
+    assert(old > 0);
+    if (old == 1) {
+        g_free(pool);
+    }
+}
+
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueueElementPool *pool;
+
+    if (!elem) {
+        return;
+    }
+
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+
+    /*
+     * While the queue is alive the element goes back to it.  Afterwards
+     * this is the last user of the slot.  The pool cannot be retired
+     * while we are in the read side critical section, so an element that
+     * was returned to it is never missed.
+     */
+    rcu_read_lock();
+    if (unlikely(atomic_read(&pool->dead))) {
+        g_free(elem);
+        virtqueue_element_pool_unref(pool);
+    } else {
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->returned, elem, pool_next);
+    }
+    rcu_read_unlock();
+}
+
+void virtio_queue_set_element_pool(VirtQueue *vq, size_t sz,
+                                   unsigned int max_sg)
+{
+    VirtQueueElementPool *pool;
+
+    assert(sz >= sizeof(VirtQueueElement));
+    assert(!vq->element_pool);
+
+    pool = g_new0(VirtQueueElementPool, 1);
+    pool->sz = sz;
+    pool->max_sg = MIN(max_sg, VIRTQUEUE_MAX_SIZE);
+    pool->slot_size = virtqueue_element_size(sz, pool->max_sg);
+    pool->refcnt = 1;
+    vq->element_pool = pool;
+}
+
+/*
+ * Runs once every virtqueue_element_free that saw a live pool is done, so
+ * the free and returned lists hold all the slots that are not in flight.
+ */
+static void virtqueue_element_pool_retire_rcu(VirtQueueElementPool *pool)
+{
+    VirtQueueElement *elem;
+    unsigned int freed = 0;
+
+    virtqueue_element_pool_reclaim(pool);
+    while ((elem = QSLIST_FIRST(&pool->free))) {
+        QSLIST_REMOVE_HEAD(&pool->free, pool_next);
+        g_free(elem);
+        freed++;
+    }
+    assert(freed < atomic_read(&pool->refcnt));
+    atomic_sub(&pool->refcnt, freed);
+
+    /* The reference of the queue */
+    virtqueue_element_pool_unref(pool);
+}
+
+static void virtio_queue_free_element_pool(VirtQueue *vq)
+{
+    VirtQueueElementPool *pool = vq->element_pool;
+
+    if (!pool) {
+        return;
+    }
+    vq->element_pool = NULL;
+
+    atomic_set(&pool->dead, true);
+    call_rcu(pool, virtqueue_element_pool_retire_rcu, rcu);
+}
+
+/*
+ * Called within rcu_read_lock(), after checking that the ring is not
+ * empty.  The caller takes care of the avail event if @set_avail_event
+ * is false.
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     bool set_avail_event)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -840,17 +1628,6 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    if (unlikely(vdev->broken)) {
-        return NULL;
-    }
-    rcu_read_lock();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -865,7 +1642,8 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -935,7 +1713,7 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
@@ -951,7 +1729,6 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
 done:
     address_space_cache_destroy(&indirect_desc_cache);
-    rcu_read_unlock();
 
     return elem;
 
@@ -960,23 +1737,263 @@ err_undo_map:
     goto done;
 }
 
-/* virtqueue_drop_all:
- * @vq: The #VirtQueue
- * Drops all queued buffers and indicates them to the guest
- * as if they are done. Useful when buffers can not be
- * processed but must be returned to the guest.
- */
-unsigned int virtqueue_drop_all(VirtQueue *vq)
+/* Called within rcu_read_lock(), after checking that the ring is not empty */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz)
+{
+    unsigned int i, max;
+    VRingMemoryRegionCaches *caches;
+    MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
+    MemoryRegionCache *desc_cache;
+    int64_t len;
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueElement *elem = NULL;
+    unsigned out_num, in_num, elem_entries;
+    hwaddr addr[VIRTQUEUE_MAX_SIZE];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+    VRingPackedDesc desc;
+    uint16_t id;
+    int rc;
+
+    /* When we start there are none of either input nor output. */
+    out_num = in_num = elem_entries = 0;
+
+    max = vq->vring.num;
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        goto done;
+    }
+
+    i = vq->last_avail_idx;
+
+    caches = vring_get_region_caches(vq);
+    if (caches->desc.len < max * sizeof(VRingPackedDesc)) {
+        virtio_error(vdev, "Cannot map descriptor ring");
+        goto done;
+    }
+
+    desc_cache = &caches->desc;
+    vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
+    id = desc.id;
+    if (desc.flags & VRING_DESC_F_INDIRECT) {
+        if (desc.len % sizeof(VRingPackedDesc)) {
+            virtio_error(vdev, "Invalid size for indirect buffer table");
+            goto done;
+        }
+
+        /* loop over the indirect descriptor table */
+        len = address_space_cache_init(&indirect_desc_cache, vdev->dma_as,
+                                       desc.addr, desc.len, false);
+        desc_cache = &indirect_desc_cache;
+        if (len < desc.len) {
+            virtio_error(vdev, "Cannot map indirect buffer");
+            goto done;
+        }
+
+        max = desc.len / sizeof(VRingPackedDesc);
+        i = 0;
+        vring_packed_desc_read(vdev, &desc, desc_cache, i, false);
+    }
+
+    /* Collect all the descriptors */
+    do {
+        bool map_ok;
+
+        if (desc.flags & VRING_DESC_F_WRITE) {
+            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+                                        iov + out_num,
+                                        VIRTQUEUE_MAX_SIZE - out_num, true,
+                                        desc.addr, desc.len);
+        } else {
+            if (in_num) {
+                virtio_error(vdev, "Incorrect order for descriptors");
+                goto err_undo_map;
+            }
+            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+                                        VIRTQUEUE_MAX_SIZE, false,
+                                        desc.addr, desc.len);
+        }
+        if (!map_ok) {
+            goto err_undo_map;
+        }
+
+        /* If we've got too many, that implies a descriptor loop. */
+        if (++elem_entries > max) {
+            virtio_error(vdev, "Looped descriptor");
+            goto err_undo_map;
+        }
+
+        rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max, &i,
+                                             desc_cache ==
+                                             &indirect_desc_cache);
+    } while (rc == VIRTQUEUE_READ_DESC_MORE);
+
+    /* The buffer id is in the last descriptor of a chain */
+    if (desc_cache != &indirect_desc_cache) {
+        id = desc.id;
+    }
+
+    /* Now copy what we have collected and mapped */
+    elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    for (i = 0; i < out_num; i++) {
+        elem->out_addr[i] = addr[i];
+        elem->out_sg[i] = iov[i];
+    }
+    for (i = 0; i < in_num; i++) {
+        elem->in_addr[i] = addr[out_num + i];
+        elem->in_sg[i] = iov[out_num + i];
+    }
+
+    elem->index = id;
+    elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    vq->last_avail_idx += elem->ndescs;
+    vq->inuse += elem->ndescs;
+
+    if (vq->last_avail_idx >= vq->vring.num) {
+        vq->last_avail_idx -= vq->vring.num;
+        vq->last_avail_wrap_counter ^= 1;
+    }
+
+    vq->shadow_avail_idx = vq->last_avail_idx;
+    vq->shadow_avail_wrap_counter = vq->last_avail_wrap_counter;
+
+    trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
+done:
+    address_space_cache_destroy(&indirect_desc_cache);
+
+    return elem;
+
+err_undo_map:
+    virtqueue_undo_map_desc(out_num, in_num, iov);
+    goto done;
+}
+
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem = NULL;
+
+    if (unlikely(vq->vdev->broken)) {
+        return NULL;
+    }
+
+    rcu_read_lock();
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        if (!virtio_queue_packed_empty_rcu(vq)) {
+            elem = virtqueue_packed_pop_rcu(vq, sz);
+        }
+    } else if (!virtio_queue_split_empty_rcu(vq)) {
+        /* Needed after virtio_queue_empty(), see comment in
+         * virtqueue_num_heads(). */
+        smp_rmb();
+        elem = virtqueue_split_pop_rcu(vq, sz, true);
+    }
+    rcu_read_unlock();
+
+    if (elem) {
+        virtqueue_stats_popped(vq, &elem, 1);
+    }
+    return elem;
+}
+
+/*
+ * Pop up to @max elements of @sz bytes into @elems, and return how many
+ * were popped.  Unlike a loop around virtqueue_pop, this reads the avail
+ * index of a split ring and updates the avail event only once.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n = 0;
+    int avail;
+
+    if (unlikely(vq->vdev->broken)) {
+        return 0;
+    }
+
+    rcu_read_lock();
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        while (n < max && !virtio_queue_packed_empty_rcu(vq)) {
+            elems[n] = virtqueue_packed_pop_rcu(vq, sz);
+            if (!elems[n]) {
+                break;
+            }
+            n++;
+        }
+    } else if (vq->vring.avail) {
+        /* Includes the barrier against reading descriptors too early */
+        avail = virtqueue_num_heads(vq, vq->last_avail_idx);
+        max = MIN(max, MAX(avail, 0));
+        while (n < max) {
+            elems[n] = virtqueue_split_pop_rcu(vq, sz, false);
+            if (!elems[n]) {
+                break;
+            }
+            n++;
+        }
+        if (n && virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+            vring_set_avail_event(vq, vq->last_avail_idx);
+        }
+    }
+    rcu_read_unlock();
+
+    if (n) {
+        virtqueue_stats_popped(vq, elems, n);
+    }
+    return n;
+}
+
+static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
+{
+    VirtQueueElement elem = {};
+    VirtIODevice *vdev = vq->vdev;
+    VRingMemoryRegionCaches *caches;
+    MemoryRegionCache *desc_cache;
+    VRingPackedDesc desc;
+    unsigned int dropped = 0;
+    unsigned int idx;
+
+    rcu_read_lock();
+    caches = vring_get_region_caches(vq);
+    desc_cache = &caches->desc;
+
+    while (vq->inuse < vq->vring.num) {
+        /* works similar to virtqueue_pop but does not map buffers
+         * and does not allocate any memory */
+        idx = vq->last_avail_idx;
+        vring_packed_desc_read(vdev, &desc, desc_cache, idx, true);
+        if (!is_desc_avail(desc.flags, vq->last_avail_wrap_counter)) {
+            break;
+        }
+        elem.ndescs = 1;
+        while (virtqueue_packed_read_next_desc(vq, &desc, desc_cache,
+                                               vq->vring.num, &idx, false)) {
+            ++elem.ndescs;
+        }
+        elem.index = desc.id;
+
+        vq->inuse += elem.ndescs;
+        vq->last_avail_idx += elem.ndescs;
+        if (vq->last_avail_idx >= vq->vring.num) {
+            vq->last_avail_idx -= vq->vring.num;
+            vq->last_avail_wrap_counter ^= 1;
+        }
+        /* immediately push the element, nothing to unmap
+         * as both in_num and out_num are set to 0 */
+        virtqueue_push(vq, &elem, 0);
+        dropped++;
+    }
+    rcu_read_unlock();
+
+    return dropped;
+}
+
+static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
 {
     unsigned int dropped = 0;
     VirtQueueElement elem = {};
     VirtIODevice *vdev = vq->vdev;
     bool fEventIdx = virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
-    if (unlikely(vdev->broken)) {
-        return 0;
-    }
-
     while (!virtio_queue_empty(vq) && vq->inuse < vq->vring.num) {
         /* works similar to virtqueue_pop but does not map buffers
         * and does not allocate any memory */
@@ -998,6 +2015,25 @@ unsigned int virtqueue_drop_all(VirtQueue *vq)
     return dropped;
 }
 
+/* virtqueue_drop_all:
+ * @vq: The #VirtQueue
+ * Drops all queued buffers and indicates them to the guest
+ * as if they are done. Useful when buffers can not be
+ * processed but must be returned to the guest.
+ */
+unsigned int virtqueue_drop_all(VirtQueue *vq)
+{
+    if (unlikely(vq->vdev->broken)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_packed_drop_all(vq);
+    } else {
+        return virtqueue_split_drop_all(vq);
+    }
+}
+
 /* Reading and writing a structure directly to QEMUFile is *awful*, but
  * it is what QEMU has always done by mistake.  We can change it sooner
  * or later by bumping the version number of the affected vm states.
@@ -1034,6 +2070,11 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
     elem->index = data.index;
 
+    /* A packed ring also needs the number of descriptors of the buffer */
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        qemu_get_be32s(f, &elem->ndescs);
+    }
+
     for (i = 0; i < elem->in_num; i++) {
         elem->in_addr[i] = data.in_addr[i];
     }
@@ -1058,7 +2099,8 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     return elem;
 }
 
-void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
+void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
+                                VirtQueueElement *elem)
 {
     VirtQueueElementOld data;
     int i;
@@ -1087,6 +2129,10 @@ void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
         data.out_sg[i].iov_len = elem->out_sg[i].iov_len;
     }
     qemu_put_buffer(f, (uint8_t *)&data, sizeof(VirtQueueElementOld));
+
+    if (virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        qemu_put_be32s(f, &elem->ndescs);
+    }
 }
 
 /* virtio device */
@@ -1213,6 +2259,9 @@ void virtio_reset(void *opaque)
         vdev->vq[i].last_avail_idx = 0;
         vdev->vq[i].shadow_avail_idx = 0;
         vdev->vq[i].used_idx = 0;
+        vdev->vq[i].last_avail_wrap_counter = true;
+        vdev->vq[i].shadow_avail_wrap_counter = true;
+        vdev->vq[i].used_wrap_counter = true;
         virtio_queue_set_vector(vdev, i, VIRTIO_NO_VECTOR);
         vdev->vq[i].signalled_used = 0;
         vdev->vq[i].signalled_used_valid = false;
@@ -1220,6 +2269,11 @@ void virtio_reset(void *opaque)
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        if (vdev->vq[i].coalesce_timer) {
+            timer_del(vdev->vq[i].coalesce_timer);
+        }
+        vdev->vq[i].coalesce_pending = false;
+        vdev->vq[i].coalesce_frames = 0;
     }
 }
 
@@ -1537,8 +2591,10 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
 
     trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
     if (vq->handle_aio_output) {
+        /* Counted as a kick when the notifier is read */
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        virtqueue_stats_kick(vq);
         vq->handle_output(vdev, vq);
     }
 }
@@ -1584,6 +2640,9 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
     vdev->vq[i].handle_aio_output = NULL;
+    /* The guest may grow the ring up to VIRTQUEUE_MAX_SIZE */
+    vdev->vq[i].used_elems = g_new0(VRingPackedUsedElem, VIRTQUEUE_MAX_SIZE);
+    vdev->vq[i].stats = g_new0(VirtQueueStats, 1);
 
     return &vdev->vq[i];
 }
@@ -1594,8 +2653,18 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
         abort();
     }
 
+    virtio_queue_coalesce_cancel(&vdev->vq[n]);
     vdev->vq[n].vring.num = 0;
     vdev->vq[n].vring.num_default = 0;
+    /* A kick for the deleted queue must not reach its old handler */
+    vdev->vq[n].vring.desc = 0;
+    vdev->vq[n].handle_output = NULL;
+    vdev->vq[n].handle_aio_output = NULL;
+    g_free(vdev->vq[n].used_elems);
+    vdev->vq[n].used_elems = NULL;
+    g_free(vdev->vq[n].stats);
+    vdev->vq[n].stats = NULL;
+    virtio_queue_free_element_pool(&vdev->vq[n]);
 }
 
 static void virtio_set_isr(VirtIODevice *vdev, int value)
@@ -1611,17 +2680,10 @@ static void virtio_set_isr(VirtIODevice *vdev, int value)
 }
 
 /* Called within rcu_read_lock().  */
-static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     uint16_t old, new;
     bool v;
-    /* We need to expose used array entries before checking used event. */
-    smp_mb();
-    /* Always notify when queue is empty (when feature acknowledge) */
-    if (virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
-        !vq->inuse && virtio_queue_empty(vq)) {
-        return true;
-    }
 
     if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         return !(vring_avail_flags(vq) & VRING_AVAIL_F_NO_INTERRUPT);
@@ -1634,7 +2696,63 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     return !v || vring_need_event(vring_get_used_event(vq), new, old);
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+static bool vring_packed_need_event(VirtQueue *vq, bool wrap,
+                                    uint16_t off_wrap, uint16_t new,
+                                    uint16_t old)
+{
+    int off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+
+    if (wrap != off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) {
+        off -= vq->vring.num;
+    }
+
+    return vring_need_event(off, new, old);
+}
+
+/* Called within rcu_read_lock().  */
+static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VRingPackedDescEvent e;
+    uint16_t old, new;
+    bool v;
+
+    vring_packed_event_read(vdev, &caches->avail, &e);
+
+    old = vq->signalled_used;
+    new = vq->signalled_used = vq->used_idx;
+    v = vq->signalled_used_valid;
+    vq->signalled_used_valid = true;
+
+    if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        return false;
+    } else if (e.flags == VRING_PACKED_EVENT_FLAG_ENABLE) {
+        return true;
+    }
+
+    return !v || vring_packed_need_event(vq, vq->used_wrap_counter,
+                                         e.off_wrap, new, old);
+}
+
+/* Called within rcu_read_lock().  */
+static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    /* We need to expose used array entries before checking used event. */
+    smp_mb();
+    /* Always notify when queue is empty (when feature acknowledge) */
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
+        !vq->inuse && virtio_queue_empty(vq)) {
+        return true;
+    }
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return virtio_packed_should_notify(vdev, vq);
+    } else {
+        return virtio_split_should_notify(vdev, vq);
+    }
+}
+
+static void virtio_notify_irqfd_now(VirtIODevice *vdev, VirtQueue *vq)
 {
     bool should_notify;
     rcu_read_lock();
@@ -1646,6 +2764,7 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     trace_virtio_notify_irqfd(vdev, vq);
+    virtqueue_stats_interrupt(vq);
 
     /*
      * virtio spec 1.0 says ISR bit 0 should be ignored with MSI, but
@@ -1672,7 +2791,7 @@ static void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_notify_now(VirtIODevice *vdev, VirtQueue *vq)
 {
     bool should_notify;
     rcu_read_lock();
@@ -1684,9 +2803,182 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     trace_virtio_notify(vdev, vq);
+    virtqueue_stats_interrupt(vq);
     virtio_irq(vq);
 }
 
+/* Called with vq->coalesce_ctx acquired */
+static void virtio_queue_coalesce_fire(VirtQueue *vq)
+{
+    if (!vq->coalesce_pending) {
+        return;
+    }
+
+    trace_virtio_notify_coalesced(vq->vdev, vq, vq->coalesce_frames);
+    vq->coalesce_pending = false;
+    vq->coalesce_frames = 0;
+    if (vq->coalesce_irqfd) {
+        virtio_notify_irqfd_now(vq->vdev, vq);
+    } else {
+        virtio_notify_now(vq->vdev, vq);
+    }
+}
+
+static void virtio_queue_coalesce_timer(void *opaque)
+{
+    VirtQueue *vq = opaque;
+    AioContext *ctx = vq->coalesce_ctx;
+
+    aio_context_acquire(ctx);
+    virtio_queue_coalesce_fire(vq);
+    aio_context_release(ctx);
+}
+
+/*
+ * Deliver a deferred interrupt right away and drop the timer.  This must
+ * happen whenever the thread that handles the queue or the way interrupts
+ * are injected changes, so that the next deferral starts from scratch in
+ * the right AioContext.
+ */
+static void virtio_queue_coalesce_flush(VirtQueue *vq)
+{
+    AioContext *ctx = vq->coalesce_ctx;
+
+    if (!vq->coalesce_timer) {
+        return;
+    }
+
+    aio_context_acquire(ctx);
+    timer_del(vq->coalesce_timer);
+    timer_free(vq->coalesce_timer);
+    vq->coalesce_timer = NULL;
+    vq->coalesce_ctx = NULL;
+    virtio_queue_coalesce_fire(vq);
+    aio_context_release(ctx);
+}
+
+/*
+ * Drop the timer and any deferred interrupt without delivering it, for
+ * queues that are going away: the ring may not be accessible anymore.
+ */
+static void virtio_queue_coalesce_cancel(VirtQueue *vq)
+{
+    AioContext *ctx = vq->coalesce_ctx;
+
+    if (!vq->coalesce_timer) {
+        return;
+    }
+
+    aio_context_acquire(ctx);
+    timer_del(vq->coalesce_timer);
+    timer_free(vq->coalesce_timer);
+    vq->coalesce_timer = NULL;
+    vq->coalesce_ctx = NULL;
+    vq->coalesce_pending = false;
+    vq->coalesce_frames = 0;
+    aio_context_release(ctx);
+}
+
+/*
+ * The delay before an interrupt.  In adaptive mode it scales with the
+ * completion rate measured over the last window: no delay at all for
+ * light, latency sensitive loads, up to intr-coalesce-usecs under heavy
+ * load.
+ */
+static uint32_t virtio_queue_coalesce_usecs(VirtIODevice *vdev, VirtQueue *vq,
+                                            int64_t now)
+{
+    int64_t elapsed = now - vq->coalesce_window_start;
+    uint64_t rate;
+
+    if (!vdev->coalesce_adaptive) {
+        return vdev->coalesce_usecs;
+    }
+
+    if (elapsed >= VIRTIO_COALESCE_WINDOW_NS) {
+        rate = (uint64_t)vq->coalesce_window_frames * NANOSECONDS_PER_SECOND /
+               elapsed;
+        if (rate <= VIRTIO_COALESCE_RATE_LOW) {
+            vq->coalesce_cur_usecs = 0;
+        } else if (rate >= VIRTIO_COALESCE_RATE_HIGH) {
+            vq->coalesce_cur_usecs = vdev->coalesce_usecs;
+        } else {
+            vq->coalesce_cur_usecs = vdev->coalesce_usecs *
+                (rate - VIRTIO_COALESCE_RATE_LOW) /
+                (VIRTIO_COALESCE_RATE_HIGH - VIRTIO_COALESCE_RATE_LOW);
+        }
+        vq->coalesce_window_start = now;
+        vq->coalesce_window_frames = 0;
+    }
+    return vq->coalesce_cur_usecs;
+}
+
+/*
+ * Decide whether the interrupt for @vq can wait.  Returns true if it was
+ * deferred, in which case a timer on the current AioContext delivers it
+ * unless intr-coalesce-frames completions pile up first.  Whether the
+ * guest wants the interrupt at all is only checked when it is delivered.
+ */
+static bool virtio_queue_coalesce(VirtIODevice *vdev, VirtQueue *vq,
+                                  bool irqfd)
+{
+    AioContext *ctx;
+    int64_t now;
+    uint32_t usecs;
+
+    /*
+     * do_vm_stop() drains the block layer after the stop notifiers ran, so
+     * requests may still complete while stopped; nothing would flush an
+     * interrupt deferred then.
+     */
+    if (!vdev->coalesce_usecs || !vdev->vm_running) {
+        return false;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    usecs = virtio_queue_coalesce_usecs(vdev, vq, now);
+    if (!usecs ||
+        (vdev->coalesce_frames && vq->coalesce_frames >= vdev->coalesce_frames)) {
+        if (vq->coalesce_timer) {
+            timer_del(vq->coalesce_timer);
+        }
+        vq->coalesce_pending = false;
+        vq->coalesce_frames = 0;
+        return false;
+    }
+
+    ctx = qemu_get_current_aio_context();
+    if (vq->coalesce_timer && vq->coalesce_ctx != ctx) {
+        virtio_queue_coalesce_flush(vq);
+    }
+    if (!vq->coalesce_timer) {
+        vq->coalesce_timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                           virtio_queue_coalesce_timer, vq);
+        vq->coalesce_ctx = ctx;
+    }
+
+    vq->coalesce_irqfd = irqfd;
+    if (!vq->coalesce_pending) {
+        vq->coalesce_pending = true;
+        timer_mod(vq->coalesce_timer, now + usecs * SCALE_US);
+    }
+    return true;
+}
+
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_queue_coalesce(vdev, vq, true)) {
+        virtio_notify_irqfd_now(vdev, vq);
+    }
+}
+
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_queue_coalesce(vdev, vq, false)) {
+        virtio_notify_now(vdev, vq);
+    }
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -1723,6 +3015,13 @@ static bool virtio_virtqueue_needed(void *opaque)
     return virtio_host_has_feature(vdev, VIRTIO_F_VERSION_1);
 }
 
+static bool virtio_packed_virtqueue_needed(void *opaque)
+{
+    VirtIODevice *vdev = opaque;
+
+    return virtio_host_has_feature(vdev, VIRTIO_F_RING_PACKED);
+}
+
 static bool virtio_ringsize_needed(void *opaque)
 {
     VirtIODevice *vdev = opaque;
@@ -1776,6 +3075,32 @@ static const VMStateDescription vmstate_virtio_virtqueues = {
     }
 };
 
+static const VMStateDescription vmstate_packed_virtqueue = {
+    .name = "packed_virtqueue_state",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT16(last_avail_idx, struct VirtQueue),
+        VMSTATE_BOOL(last_avail_wrap_counter, struct VirtQueue),
+        VMSTATE_UINT16(used_idx, struct VirtQueue),
+        VMSTATE_BOOL(used_wrap_counter, struct VirtQueue),
+        VMSTATE_UINT32(inuse, struct VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_virtio_packed_virtqueues = {
+    .name = "virtio/packed_virtqueues",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = &virtio_packed_virtqueue_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_VARRAY_POINTER_KNOWN(vq, struct VirtIODevice,
+                      VIRTIO_QUEUE_MAX, 0, vmstate_packed_virtqueue, VirtQueue),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_ringsize = {
     .name = "ringsize_state",
     .version_id = 1,
@@ -1894,6 +3219,7 @@ static const VMStateDescription vmstate_virtio = {
         &vmstate_virtio_64bit_features,
         &vmstate_virtio_virtqueues,
         &vmstate_virtio_ringsize,
+        &vmstate_virtio_packed_virtqueues,
         &vmstate_virtio_broken,
         &vmstate_virtio_extra_state,
         NULL
@@ -2157,6 +3483,18 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                 virtio_queue_update_rings(vdev, i);
             }
 
+            /*
+             * A packed ring has no index in guest memory to check against;
+             * its indexes, wrap counters and inuse come from the
+             * packed_virtqueues subsection.
+             */
+            if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+                vdev->vq[i].shadow_avail_idx = vdev->vq[i].last_avail_idx;
+                vdev->vq[i].shadow_avail_wrap_counter =
+                    vdev->vq[i].last_avail_wrap_counter;
+                continue;
+            }
+
             nheads = vring_avail_idx(&vdev->vq[i]) - vdev->vq[i].last_avail_idx;
             /* Check it isn't doing strange things with descriptor numbers. */
             if (nheads > vdev->vq[i].vring.num) {
@@ -2204,8 +3542,17 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && (vdev->status & VIRTIO_CONFIG_S_DRIVER_OK);
+    int i;
+
     vdev->vm_running = running;
 
+    /* Deferred interrupts must not be left behind by migration */
+    if (!running) {
+        for (i = 0; i < VIRTIO_QUEUE_MAX && vdev->vq[i].vring.num; i++) {
+            virtio_queue_coalesce_flush(&vdev->vq[i]);
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -2255,6 +3602,9 @@ void virtio_init(VirtIODevice *vdev, const char *name,
         vdev->vq[i].vector = VIRTIO_NO_VECTOR;
         vdev->vq[i].vdev = vdev;
         vdev->vq[i].queue_index = i;
+        vdev->vq[i].last_avail_wrap_counter = true;
+        vdev->vq[i].shadow_avail_wrap_counter = true;
+        vdev->vq[i].used_wrap_counter = true;
     }
 
     vdev->name = name;
@@ -2292,29 +3642,69 @@ hwaddr virtio_queue_get_desc_size(VirtIODevice *vdev, int n)
 
 hwaddr virtio_queue_get_avail_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
+
     return offsetof(VRingAvail, ring) +
         sizeof(uint16_t) * vdev->vq[n].vring.num;
 }
 
 hwaddr virtio_queue_get_used_size(VirtIODevice *vdev, int n)
 {
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return sizeof(VRingPackedDescEvent);
+    }
+
     return offsetof(VRingUsed, ring) +
         sizeof(VRingUsedElem) * vdev->vq[n].vring.num;
 }
 
-uint16_t virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n)
+/*
+ * For a packed ring the state is encoded the way vhost expects it: the
+ * avail index and wrap counter in the low 16 bits, the used index and
+ * wrap counter in the high 16 bits.
+ */
+unsigned int virtio_queue_get_last_avail_idx(VirtIODevice *vdev, int n)
 {
-    return vdev->vq[n].last_avail_idx;
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return vq->last_avail_idx |
+               (unsigned int)vq->last_avail_wrap_counter << 15 |
+               (unsigned int)vq->used_idx << 16 |
+               (unsigned int)vq->used_wrap_counter << 31;
+    }
+
+    return vq->last_avail_idx;
 }
 
-void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx)
+void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n,
+                                     unsigned int idx)
 {
-    vdev->vq[n].last_avail_idx = idx;
-    vdev->vq[n].shadow_avail_idx = idx;
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        vq->last_avail_idx = idx & 0x7fff;
+        vq->last_avail_wrap_counter = !!(idx & 0x8000);
+        vq->used_idx = (idx >> 16) & 0x7fff;
+        vq->used_wrap_counter = !!(idx & 0x80000000);
+        vq->shadow_avail_idx = vq->last_avail_idx;
+        vq->shadow_avail_wrap_counter = vq->last_avail_wrap_counter;
+        return;
+    }
+
+    vq->last_avail_idx = idx;
+    vq->shadow_avail_idx = idx;
 }
 
 void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n)
 {
+    /* A packed ring has no used index in guest memory to go back to */
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return;
+    }
+
     rcu_read_lock();
     if (vdev->vq[n].vring.desc) {
         vdev->vq[n].last_avail_idx = vring_used_idx(&vdev->vq[n]);
@@ -2325,6 +3715,11 @@ void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n)
 
 void virtio_queue_update_used_idx(VirtIODevice *vdev, int n)
 {
+    /* The used index of a packed ring is part of the vhost ring state */
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
+        return;
+    }
+
     rcu_read_lock();
     if (vdev->vq[n].vring.desc) {
         vdev->vq[n].used_idx = vring_used_idx(&vdev->vq[n]);
@@ -2358,6 +3753,7 @@ static void virtio_queue_guest_notifier_read(EventNotifier *n)
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd)
 {
+    virtio_queue_coalesce_flush(vq);
     if (assign && !with_irqfd) {
         event_notifier_set_handler(&vq->guest_notifier,
                                    virtio_queue_guest_notifier_read);
@@ -2380,6 +3776,7 @@ static void virtio_queue_host_notifier_aio_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
+        virtqueue_stats_kick(vq);
         virtio_queue_notify_aio_vq(vq);
     }
 }
@@ -2398,9 +3795,11 @@ static bool virtio_queue_host_notifier_aio_poll(void *opaque)
     bool progress;
 
     if (!vq->vring.desc || virtio_queue_empty(vq)) {
+        vq->poll_misses++;
         return false;
     }
 
+    vq->poll_hits++;
     progress = virtio_queue_notify_aio_vq(vq);
 
     /* In case the handler function re-enabled notifications */
@@ -2412,6 +3811,8 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    trace_virtio_queue_poll_end(vq->vdev, vq, vq->poll_hits, vq->poll_misses);
+
     /* Caller polls once more after this to catch requests that race with us */
     virtio_queue_set_notification(vq, 1);
 }
@@ -2419,6 +3820,7 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
 void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleAIOOutput handle_output)
 {
+    virtio_queue_coalesce_flush(vq);
     if (handle_output) {
         vq->handle_aio_output = handle_output;
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
@@ -2440,6 +3842,7 @@ void virtio_queue_host_notifier_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
+        virtqueue_stats_kick(vq);
         virtio_queue_notify_vq(vq);
     }
 }
@@ -2449,6 +3852,131 @@ EventNotifier *virtio_queue_get_host_notifier(VirtQueue *vq)
     return &vq->host_notifier;
 }
 
+int virtio_queue_set_host_notifier_mr(VirtIODevice *vdev, int n,
+                                      MemoryRegion *mr, bool assign)
+{
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+    if (k->set_host_notifier_mr) {
+        return k->set_host_notifier_mr(qbus->parent, n, mr, assign);
+    }
+
+    return -1;
+}
+
+static VirtQueueLatencyHistogram *virtio_queue_latency(VirtQueue *vq)
+{
+    VirtQueueLatencyHistogram *hist = g_new0(VirtQueueLatencyHistogram, 1);
+    uint64List *entry;
+    int i;
+
+    /* Bin i is [2^(i-1) us, 2^i us); build both lists back to front */
+    for (i = VIRTQUEUE_LATENCY_BINS - 1; i >= 0; i--) {
+        entry = g_new0(uint64List, 1);
+        entry->value = vq->stats->latency_bins[i];
+        entry->next = hist->bins;
+        hist->bins = entry;
+
+        if (i) {
+            entry = g_new0(uint64List, 1);
+            entry->value = (uint64_t)SCALE_US << (i - 1);
+            entry->next = hist->boundaries;
+            hist->boundaries = entry;
+        }
+    }
+
+    return hist;
+}
+
+static VirtQueueStatus *virtio_queue_status(VirtQueue *vq, int64_t now)
+{
+    VirtQueueStatus *status = g_new0(VirtQueueStatus, 1);
+    VirtQueueStats *stats = vq->stats;
+    VRingMemoryRegionCaches *caches;
+
+    status->queue = vq->queue_index;
+    status->size = vq->vring.num;
+    status->packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+
+    /*
+     * Unlike vring_avail_idx(), this leaves shadow_avail_idx alone.  The
+     * caches are NULL if the guest programmed a ring that cannot be mapped.
+     */
+    if (!status->packed && vq->vring.avail) {
+        rcu_read_lock();
+        caches = atomic_rcu_read(&vq->vring.caches);
+        if (caches) {
+            status->has_avail_idx = true;
+            status->avail_idx =
+                virtio_lduw_phys_cached(vq->vdev, &caches->avail,
+                                        offsetof(VRingAvail, idx));
+        }
+        rcu_read_unlock();
+    }
+    status->shadow_avail_idx = vq->shadow_avail_idx;
+    status->last_avail_idx = vq->last_avail_idx;
+    status->used_idx = vq->used_idx;
+    status->has_signalled_used = vq->signalled_used_valid;
+    status->signalled_used = vq->signalled_used;
+    status->inuse = vq->inuse;
+
+    status->kicks = stats->kicks;
+    status->interrupts = stats->interrupts;
+    status->popped = stats->popped;
+    status->completed = stats->completed;
+    status->poll_hits = vq->poll_hits;
+    status->poll_misses = vq->poll_misses;
+    if (stats->last_kick) {
+        status->has_last_kick_ns = true;
+        status->last_kick_ns = now - stats->last_kick;
+    }
+    if (stats->last_interrupt) {
+        status->has_last_interrupt_ns = true;
+        status->last_interrupt_ns = now - stats->last_interrupt;
+    }
+    status->latency = virtio_queue_latency(vq);
+
+    return status;
+}
+
+VirtQueueStatusList *qmp_query_virtio_queue_status(const char *path,
+                                                   bool has_queue,
+                                                   uint16_t queue,
+                                                   Error **errp)
+{
+    VirtQueueStatusList *head = NULL, **prev = &head, *entry;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    VirtIODevice *vdev;
+    Object *obj;
+    int i, num;
+
+    obj = object_resolve_path(path, NULL);
+    vdev = (VirtIODevice *)object_dynamic_cast(obj, TYPE_VIRTIO_DEVICE);
+    if (!vdev) {
+        error_setg(errp, "Path '%s' is not a virtio device", path);
+        return NULL;
+    }
+
+    num = virtio_get_num_queues(vdev);
+    if (has_queue && queue >= num) {
+        error_setg(errp, "Device '%s' has no virtqueue %u", path, queue);
+        return NULL;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (has_queue && i != queue) {
+            continue;
+        }
+        entry = g_new0(VirtQueueStatusList, 1);
+        entry->value = virtio_queue_status(&vdev->vq[i], now);
+        *prev = entry;
+        prev = &entry->next;
+    }
+
+    return head;
+}
+
 void virtio_device_set_child_bus_name(VirtIODevice *vdev, char *bus_name)
 {
     g_free(vdev->bus_name);
@@ -2493,6 +4021,18 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
     /* Devices should either use vmsd or the load/save methods */
     assert(!vdc->vmsd || !vdc->load);
 
+    if ((vdev->coalesce_frames || vdev->coalesce_adaptive) &&
+        !vdev->coalesce_usecs) {
+        error_setg(errp, "intr-coalesce-frames and intr-coalesce-adaptive "
+                   "require intr-coalesce-usecs");
+        return;
+    }
+    if (vdev->coalesce_usecs > VIRTIO_COALESCE_MAX_USECS) {
+        error_setg(errp, "intr-coalesce-usecs must not exceed %d",
+                   VIRTIO_COALESCE_MAX_USECS);
+        return;
+    }
+
     if (vdc->realize != NULL) {
         vdc->realize(dev, &err);
         if (err != NULL) {
@@ -2543,7 +4083,11 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        virtio_queue_coalesce_cancel(&vdev->vq[i]);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        g_free(vdev->vq[i].used_elems);
+        g_free(vdev->vq[i].stats);
+        virtio_queue_free_element_pool(&vdev->vq[i]);
     }
     g_free(vdev->vq);
 }
@@ -2561,6 +4105,10 @@ static void virtio_device_instance_finalize(Object *obj)
 
 static Property virtio_properties[] = {
     DEFINE_VIRTIO_COMMON_FEATURES(VirtIODevice, host_features),
+    DEFINE_PROP_UINT32("intr-coalesce-usecs", VirtIODevice, coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("intr-coalesce-frames", VirtIODevice, coalesce_frames, 0),
+    DEFINE_PROP_BOOL("intr-coalesce-adaptive", VirtIODevice, coalesce_adaptive,
+                     false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
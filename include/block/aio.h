@@ -140,6 +140,13 @@ struct AioContext {
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /* Poll-forever mode, see aio_context_set_poll_forever() */
+    bool poll_forever;
+    int64_t poll_idle_ns;   /* fall back to fd monitoring after this long */
+    int64_t poll_budget;    /* percentage of each period spent polling */
+    int64_t poll_period_start;
+    int64_t poll_period_ns; /* time spent polling in the current period */
+
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
@@ -567,4 +574,23 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_poll_forever:
+ * @ctx: the aio context
+ * @enable: keep busy polling instead of adapting the polling time
+ * @idle_ns: fall back to monitoring file descriptors after polling for this
+ *           long without progress, 0 to never fall back
+ * @budget: percentage of CPU time that may be spent polling, 1 to 100
+ *
+ * In poll-forever mode the polling time does not depend on poll_max_ns.
+ * Handlers stay in polling mode, for example with virtqueue notifications
+ * suppressed, as long as they keep making progress.  Once @idle_ns pass
+ * without progress, or polling used up @budget percent of the current
+ * 10 millisecond period, the context goes back to waiting for events until
+ * the next one arrives.
+ */
+void aio_context_set_poll_forever(AioContext *ctx, bool enable,
+                                  int64_t idle_ns, int64_t budget,
+                                  Error **errp);
+
 #endif
@@ -37,6 +37,10 @@ bool memory_region_access_valid(MemoryRegion *mr, hwaddr addr,
 
 void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section);
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv);
+AddressSpaceDispatch *address_space_dispatch_clone(AddressSpaceDispatch *old,
+                                                   FlatView *fv);
+void address_space_dispatch_clear(AddressSpaceDispatch *d,
+                                  hwaddr *start, hwaddr *last);
 void address_space_dispatch_compact(AddressSpaceDispatch *d);
 void address_space_dispatch_free(AddressSpaceDispatch *d);
 
@@ -254,6 +254,8 @@ struct MemoryRegion {
     uint8_t vga_logging_count;
     MemoryRegion *alias;
     hwaddr alias_offset;
+    QLIST_HEAD(, MemoryRegion) alias_users;
+    QLIST_ENTRY(MemoryRegion) alias_link;
     int32_t priority;
     QTAILQ_HEAD(subregions, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
@@ -307,6 +309,11 @@ struct MemoryListener {
     QTAILQ_ENTRY(MemoryListener) link_as;
 };
 
+/* Default bounce buffer space available to address_space_map() */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
+typedef struct AddressSpaceMapClient AddressSpaceMapClient;
+
 /**
  * AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
@@ -323,6 +330,20 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(memory_listeners_as, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Bounce buffers handed out by address_space_map(), in bytes */
+    size_t max_bounce_buffer_size;
+    size_t bounce_buffer_size;
+    uint64_t bounce_maps;
+    uint64_t bounce_waits;
+
+    /* Bytes moved by address_space_copy(), to and from this space */
+    uint64_t copy_bytes_to;
+    uint64_t copy_bytes_from;
+
+    /* Waiters for bounce buffer space, woken by address_space_unmap() */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -540,6 +561,8 @@ void memory_region_init_ram_from_file(MemoryRegion *mr,
  * @owner: the object that tracks the region's reference count
  * @name: the name of the region.
  * @size: size of the region.
+ * @align: alignment of the region base address; if 0, the default alignment
+ *         (getpagesize()) will be used.
  * @share: %true if memory must be mmaped with the MAP_SHARED flag
  * @fd: the fd to mmap.
  * @errp: pointer to Error*, to store an error if it happens.
@@ -551,6 +574,7 @@ void memory_region_init_ram_from_fd(MemoryRegion *mr,
                                     struct Object *owner,
                                     const char *name,
                                     uint64_t size,
+                                    uint64_t align,
                                     bool share,
                                     int fd,
                                     Error **errp);
@@ -1658,8 +1682,8 @@ static inline MemoryRegion *address_space_translate(AddressSpace *as,
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -1683,6 +1707,25 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/* address_space_register_map_client: ask to be told when @as has bounce
+ * buffer space again
+ *
+ * @bh is scheduled once, when address_space_unmap() releases a bounce
+ * buffer of @as, or right away if space is already available.
+ *
+ * @as: #AddressSpace on which address_space_map() failed
+ * @bh: bottom half to schedule
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: cancel
+ * address_space_register_map_client()
+ *
+ * @as: #AddressSpace passed to address_space_register_map_client()
+ * @bh: bottom half passed to address_space_register_map_client()
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
@@ -1748,6 +1791,33 @@ MemTxResult address_space_read(AddressSpace *as, hwaddr addr,
     return result;
 }
 
+/* Flags for address_space_copy() */
+#define MEMTX_COPY_NONTEMPORAL  (1U << 0)   /* destination not read back */
+
+/**
+ * address_space_copy: bulk copy between an address space and a buffer
+ *
+ * Like address_space_rw(), but translates once per contiguous RAM run
+ * and copies it with a single memcpy, and accounts the bytes moved in
+ * @as (for PCI devices that is their own bus master address space).
+ * With %MEMTX_COPY_NONTEMPORAL the destination of RAM runs is written
+ * with non-temporal stores; use it for large transfers whose data QEMU
+ * is not going to read again.  MMIO is accessed as by address_space_rw().
+ * @buf may overlap the guest memory that is accessed, for example when it
+ * was returned by address_space_map().
+ *
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @attrs: memory transaction attributes
+ * @buf: buffer with the data transferred
+ * @len: length of the data transferred
+ * @is_write: indicates the transfer direction
+ * @flags: %MEMTX_COPY_* flags
+ */
+MemTxResult address_space_copy(AddressSpace *as, hwaddr addr,
+                               MemTxAttrs attrs, void *buf, hwaddr len,
+                               bool is_write, unsigned flags);
+
 /**
  * address_space_read_cached: read from a cached RAM region
  *
@@ -0,0 +1,84 @@
+/*
+ * Memory Device Interface
+ *
+ * Copyright ProfitBricks GmbH 2012
+ * Copyright (C) 2013-2014 Red Hat Inc
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef MEMORY_DEVICE_H
+#define MEMORY_DEVICE_H
+
+#include "qom/object.h"
+#include "exec/memory.h"
+#include "qapi/qapi-types-misc.h"
+
+#define TYPE_MEMORY_DEVICE "memory-device"
+
+#define MEMORY_DEVICE_CLASS(klass) \
+     OBJECT_CLASS_CHECK(MemoryDeviceClass, (klass), TYPE_MEMORY_DEVICE)
+#define MEMORY_DEVICE_GET_CLASS(obj) \
+    OBJECT_GET_CLASS(MemoryDeviceClass, (obj), TYPE_MEMORY_DEVICE)
+#define MEMORY_DEVICE(obj) \
+     INTERFACE_CHECK(MemoryDeviceState, (obj), TYPE_MEMORY_DEVICE)
+
+typedef Object MemoryDeviceState;
+
+/**
+ * MemoryDeviceClass:
+ * @get_addr: returns the guest physical address where the device is mapped,
+ * 0 if it is not mapped yet.
+ * @set_addr: assigns the guest physical address of the device.
+ * @get_region_size: returns the size of the guest physical address range
+ * the device occupies.
+ * @get_plugged_size: returns how much memory the device actually provides
+ * to the guest, which is less than @get_region_size for devices that can
+ * resize themselves.
+ * @get_memory_region: returns the #MemoryRegion to map at @get_addr.
+ * @get_min_alignment: optional, returns the alignment the guest physical
+ * address of the device needs on top of the one of its memory region.
+ * @fill_device_info: fills in the query-memory-devices information.
+ *
+ * Devices implementing this interface share the hotplug memory area of the
+ * machine.
+ */
+typedef struct MemoryDeviceClass {
+    /* private */
+    InterfaceClass parent_class;
+
+    /* public */
+    uint64_t (*get_addr)(const MemoryDeviceState *md);
+    void (*set_addr)(MemoryDeviceState *md, uint64_t addr, Error **errp);
+    uint64_t (*get_region_size)(const MemoryDeviceState *md);
+    uint64_t (*get_plugged_size)(const MemoryDeviceState *md);
+    MemoryRegion *(*get_memory_region)(MemoryDeviceState *md, Error **errp);
+    uint64_t (*get_min_alignment)(const MemoryDeviceState *md);
+    void (*fill_device_info)(const MemoryDeviceState *md,
+                             MemoryDeviceInfo *info);
+} MemoryDeviceClass;
+
+/**
+ * MemoryHotplugState:
+ * @base: address in guest physical address space where hotplug memory
+ * address space begins.
+ * @mr: hotplug memory address space container
+ */
+typedef struct MemoryHotplugState {
+    hwaddr base;
+    MemoryRegion mr;
+} MemoryHotplugState;
+
+MemoryDeviceInfoList *qmp_memory_device_list(void);
+uint64_t memory_device_get_region_size_total(void);
+uint64_t get_plugged_memory_size(void);
+uint64_t memory_device_get_free_addr(uint64_t address_space_start,
+                                     uint64_t address_space_size,
+                                     uint64_t *hint, uint64_t align,
+                                     uint64_t size, Error **errp);
+void memory_device_plug(MemoryDeviceState *md, MemoryHotplugState *hpms,
+                        uint64_t align, Error **errp);
+void memory_device_unplug(MemoryDeviceState *md, MemoryHotplugState *hpms);
+
+#endif
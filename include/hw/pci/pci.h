@@ -289,6 +289,8 @@ struct PCIDevice {
     char name[64];
     PCIIORegion io_regions[PCI_NUM_REGIONS];
     AddressSpace bus_master_as;
+    /* Bounce buffer space for DMA to non-RAM memory, in bytes */
+    uint64_t max_bounce_buffer_size;
     MemoryRegion bus_master_container_region;
     MemoryRegion bus_master_enable_region;
 
@@ -36,6 +36,13 @@ typedef struct VHostUserBlk {
     uint32_t config_wce;
     uint32_t config_ro;
     struct vhost_dev dev;
+    struct vhost_inflight *inflight;
+    /* vhost_dev_cleanup() clears dev, so the virtqueues are kept here */
+    struct vhost_virtqueue *vqs;
+    guint watch;
+    bool connected;
+    /* Runs the disconnect outside of the vhost-user message exchange */
+    QEMUBH *closed_bh;
 } VHostUserBlk;
 
 #endif
@@ -84,6 +84,18 @@ struct vhost_dev {
     const VhostDevConfigOps *config_ops;
 };
 
+/* Shared memory area in which the backend tracks in-flight requests, see
+ * VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD.  It outlives the backend, so that
+ * a restarted backend can resubmit the requests.
+ */
+struct vhost_inflight {
+    int fd;
+    void *addr;
+    uint64_t size;
+    uint64_t offset;
+    uint16_t queue_size;
+};
+
 int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
                    VhostBackendType backend_type,
                    uint32_t busyloop_timeout);
@@ -120,4 +132,10 @@ int vhost_dev_set_config(struct vhost_dev *dev, const uint8_t *data,
  */
 void vhost_dev_set_config_notifier(struct vhost_dev *dev,
                                    const VhostDevConfigOps *ops);
+
+void vhost_dev_free_inflight(struct vhost_inflight *inflight);
+int vhost_dev_get_inflight(struct vhost_dev *dev, uint16_t queue_size,
+                           struct vhost_inflight *inflight);
+int vhost_dev_set_inflight(struct vhost_dev *dev,
+                           struct vhost_inflight *inflight);
 #endif
@@ -18,6 +18,7 @@
 #include "standard-headers/linux/virtio_balloon.h"
 #include "hw/virtio/virtio.h"
 #include "hw/pci/pci.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_BALLOON "virtio-balloon-device"
 #define VIRTIO_BALLOON(obj) \
@@ -31,9 +32,42 @@ typedef struct virtio_balloon_stat_modern {
        uint64_t val;
 } VirtIOBalloonStatModern;
 
-typedef struct VirtIOBalloon {
+#define VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN 0x80000000
+
+enum virtio_balloon_free_page_hint_status {
+    FREE_PAGE_HINT_S_STOP = 0,
+    FREE_PAGE_HINT_S_REQUESTED = 1,
+    FREE_PAGE_HINT_S_START = 2,
+    FREE_PAGE_HINT_S_DONE = 3,
+};
+
+typedef struct VirtIOBalloon VirtIOBalloon;
+
+/*
+ * Elements popped from one queue and processed together, by the iothread
+ * if the device has one, then given back to the guest from the main loop.
+ */
+typedef struct VirtIOBalloonBatch {
+    VirtIOBalloon *balloon;
+    VirtQueue *vq;
+    GPtrArray *elems;
+    bool discard;       /* ballooning was allowed when the batch was popped */
+    /* Guest memory the batch covers, resolved in the main loop */
+    GArray *ranges;
+    void (*prepare)(VirtIOBalloon *s, struct VirtIOBalloonBatch *b);
+    void (*work)(VirtIOBalloon *s, struct VirtIOBalloonBatch *b);
+    QEMUBH *work_bh;
+    QEMUBH *complete_bh;
+    QemuEvent work_done;
+    bool done;          /* the iothread has processed the batch */
+} VirtIOBalloonBatch;
+
+struct VirtIOBalloon {
     VirtIODevice parent_obj;
-    VirtQueue *ivq, *dvq, *svq;
+    VirtQueue *ivq, *dvq, *svq, *free_page_vq, *reporting_vq;
+    uint32_t free_page_hint_status;
+    uint32_t free_page_hint_cmd_id;
+    NotifierWithReturn free_page_hint_notify;
     uint32_t num_pages;
     uint32_t actual;
     uint64_t stats[VIRTIO_BALLOON_S_NR];
@@ -43,6 +77,15 @@ typedef struct VirtIOBalloon {
     int64_t stats_last_update;
     int64_t stats_poll_interval;
     uint32_t host_features;
-} VirtIOBalloon;
+
+    IOThread *iothread;
+    VirtIOBalloonBatch inflate, deflate, report;
+    VMChangeStateEntry *vmstate;
+    /* Huge host pages partly in the balloon, by address */
+    GHashTable *partial_pages;
+    /* Free page reporting: bytes reported and discarded so far */
+    uint64_t reported_bytes;
+    uint64_t discarded_bytes;
+};
 
 #endif
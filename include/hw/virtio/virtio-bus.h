@@ -82,6 +82,13 @@ typedef struct VirtioBusClass {
      */
     int (*ioeventfd_assign)(DeviceState *d, EventNotifier *notifier,
                             int n, bool assign);
+    /*
+     * Maps/unmaps @mr over the notification area of queue number n, so
+     * that guest notifications go straight to the memory behind it.
+     * Returns an error value if the transport cannot do that.
+     */
+    int (*set_host_notifier_mr)(DeviceState *d, int n,
+                                MemoryRegion *mr, bool assign);
     /*
      * Does the transport have variable vring alignment?
      * (ie can it ever call virtio_queue_set_align()?)
@@ -0,0 +1,79 @@
+/*
+ * Virtio MEM device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_VIRTIO_MEM_H
+#define HW_VIRTIO_MEM_H
+
+#include "standard-headers/linux/virtio_mem.h"
+#include "hw/virtio/virtio.h"
+#include "qapi/qapi-types-misc.h"
+#include "sysemu/hostmem.h"
+
+#define TYPE_VIRTIO_MEM "virtio-mem"
+
+#define VIRTIO_MEM(obj) \
+        OBJECT_CHECK(VirtIOMEM, (obj), TYPE_VIRTIO_MEM)
+#define VIRTIO_MEM_CLASS(oc) \
+        OBJECT_CLASS_CHECK(VirtIOMEMClass, (oc), TYPE_VIRTIO_MEM)
+#define VIRTIO_MEM_GET_CLASS(obj) \
+        OBJECT_GET_CLASS(VirtIOMEMClass, (obj), TYPE_VIRTIO_MEM)
+
+#define VIRTIO_MEM_MEMDEV_PROP "memdev"
+#define VIRTIO_MEM_NODE_PROP "node"
+#define VIRTIO_MEM_SIZE_PROP "size"
+#define VIRTIO_MEM_REQUESTED_SIZE_PROP "requested-size"
+#define VIRTIO_MEM_BLOCK_SIZE_PROP "block-size"
+#define VIRTIO_MEM_ADDR_PROP "memaddr"
+
+/**
+ * VirtIOMEM:
+ * @addr: guest physical address of the memory region, 0 if not assigned
+ * @memdev: backend providing the whole memory region
+ * @node: numa node the memory is assigned to
+ * @block_size: granularity of plug and unplug requests
+ * @requested_size: how much memory the guest should have plugged
+ * @size: how much memory the guest has plugged
+ * @usable_region_size: part of the region the guest may plug memory in
+ * @bitmap: one bit per block, set if the block is plugged
+ */
+typedef struct VirtIOMEM {
+    VirtIODevice parent_obj;
+
+    VirtQueue *vq;
+
+    uint64_t addr;
+    HostMemoryBackend *memdev;
+    uint32_t node;
+    uint64_t block_size;
+    uint64_t requested_size;
+    uint64_t size;
+    uint64_t usable_region_size;
+
+    int32_t bitmap_size;
+    unsigned long *bitmap;
+
+    NotifierWithReturn precopy_notifier;
+} VirtIOMEM;
+
+/**
+ * VirtIOMEMClass:
+ * @fill_device_info: fills in the query-memory-devices information.
+ * @get_memory_region: returns the #MemoryRegion of the whole device.
+ *
+ * The transports use these instead of calling into virtio-mem.c, which is
+ * only built for targets with memory hotplug.
+ */
+typedef struct VirtIOMEMClass {
+    /* private */
+    VirtioDeviceClass parent;
+
+    /* public */
+    void (*fill_device_info)(const VirtIOMEM *vmem, VirtioMEMDeviceInfo *vi);
+    MemoryRegion *(*get_memory_region)(VirtIOMEM *vmem, Error **errp);
+} VirtIOMEMClass;
+
+#endif
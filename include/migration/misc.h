@@ -18,6 +18,27 @@
 
 /* migration/ram.c */
 
+typedef enum PrecopyNotifyReason {
+    PRECOPY_NOTIFY_SETUP,
+    PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC,
+    PRECOPY_NOTIFY_AFTER_BITMAP_SYNC,
+    PRECOPY_NOTIFY_COMPLETE,
+    PRECOPY_NOTIFY_CLEANUP,
+} PrecopyNotifyReason;
+
+typedef struct PrecopyNotifyData {
+    PrecopyNotifyReason reason;
+} PrecopyNotifyData;
+
+/*
+ * Precopy notifiers run with the iothread lock held, at the start and end
+ * of a RAM migration and around each sync of the dirty bitmap.
+ */
+void precopy_add_notifier(NotifierWithReturn *n);
+void precopy_remove_notifier(NotifierWithReturn *n);
+void precopy_enable_free_page_optimization(void);
+void qemu_guest_free_page_hint(void *addr, size_t len);
+
 void ram_mig_init(void);
 
 /* migration/block.c */
@@ -142,6 +142,18 @@ int qemu_strtosz_metric(const char *nptr, char **end, uint64_t *result);
 #define STR_OR_NULL(str) ((str) ? (str) : "null")
 
 bool buffer_is_zero(const void *buf, size_t len);
+
+/* Copies at least this large are worth bypassing the cache for, if the
+ * destination is not going to be read back soon.
+ */
+#define QEMU_NONTEMPORAL_COPY_MIN (256 * 1024)
+
+/**
+ * qemu_memcpy_nontemporal:
+ * Like memcpy(), but write @dst with non-temporal stores where the host
+ * supports them, so that a large copy does not evict the cache.
+ */
+void qemu_memcpy_nontemporal(void *dst, const void *src, size_t len);
 bool test_buffer_is_zero_next_accel(void);
 
 /*
@@ -9,4 +9,14 @@ void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared);
 
 void qemu_ram_munmap(void *ptr, size_t size);
 
+/**
+ * qemu_ram_thp_size:
+ * @ptr: start of a RAM mapping
+ * @size: size of the mapping
+ *
+ * Returns: how many bytes of [@ptr, @ptr + @size) the host currently maps
+ * with transparent huge pages, or -1 if the host does not report it.
+ */
+int64_t qemu_ram_thp_size(void *ptr, size_t size);
+
 #endif
@@ -442,6 +442,48 @@ char *qemu_get_exec_dir(void);
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
                      Error **errp);
 
+typedef struct MemPrealloc MemPrealloc;
+
+/**
+ * os_mem_prealloc_start:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: upper bound for the number of preallocation threads
+ * @host_nodes: if not NULL, bitmap of host NUMA nodes whose CPUs should
+ *              run the preallocation threads
+ * @max_node: number of bits in @host_nodes
+ * @errp: error object
+ *
+ * Start preallocating @area in background threads.  The caller must
+ * collect the result with os_mem_prealloc_finish() before anything else
+ * writes to @area, and must serialize calls to the os_mem_prealloc
+ * functions.
+ *
+ * Returns: the preallocation job, or NULL on failure.
+ */
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t sz,
+                                   int max_threads,
+                                   const unsigned long *host_nodes,
+                                   unsigned long max_node, Error **errp);
+
+/**
+ * os_mem_prealloc_progress:
+ * @job: a job returned by os_mem_prealloc_start()
+ * @done: set to the number of bytes preallocated so far
+ * @total: set to the number of bytes to preallocate
+ */
+void os_mem_prealloc_progress(MemPrealloc *job, size_t *done, size_t *total);
+
+/**
+ * os_mem_prealloc_finish:
+ * @job: a job returned by os_mem_prealloc_start()
+ * @errp: set if some pages could not be preallocated
+ *
+ * Wait for @job to complete and free it.
+ */
+void os_mem_prealloc_finish(MemPrealloc *job, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
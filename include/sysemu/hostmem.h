@@ -29,6 +29,7 @@
 
 typedef struct HostMemoryBackend HostMemoryBackend;
 typedef struct HostMemoryBackendClass HostMemoryBackendClass;
+typedef struct HostMemoryRebind HostMemoryRebind;
 
 /**
  * HostMemoryBackendClass:
@@ -56,10 +57,16 @@ struct HostMemoryBackend {
     uint64_t size;
     bool merge, dump;
     bool prealloc, force_prealloc, is_mapped, share;
+    bool prealloc_async, pin;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
+    bool host_nodes_follow;
+    OnOffAuto thp;
 
     MemoryRegion mr;
+    MemPrealloc *prealloc_job;
+    QLIST_ENTRY(HostMemoryBackend) prealloc_next;
+    HostMemoryRebind *rebind;
 };
 
 bool host_memory_backend_mr_inited(HostMemoryBackend *backend);
@@ -68,4 +75,49 @@ MemoryRegion *host_memory_backend_get_memory(HostMemoryBackend *backend,
 
 void host_memory_backend_set_mapped(HostMemoryBackend *backend, bool mapped);
 bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
+
+/**
+ * host_memory_backend_thp_size:
+ * @backend: the memory backend
+ * @errp: set if the host does not report transparent huge page usage
+ *
+ * Returns: the amount of the backend's memory that is currently mapped
+ * with transparent huge pages.
+ */
+uint64_t host_memory_backend_thp_size(HostMemoryBackend *backend,
+                                      Error **errp);
+
+/**
+ * host_memory_backend_rebind:
+ * @backend: the memory backend
+ * @host_nodes: bitmap of host nodes for the new policy
+ * @policy: the new policy
+ * @errp: error object
+ *
+ * Apply @policy and @host_nodes to the backend's memory and start moving
+ * the pages it has already allocated in background threads.  The
+ * progress is available from host_memory_backend_rebind_info().
+ */
+void host_memory_backend_rebind(HostMemoryBackend *backend,
+                                const unsigned long *host_nodes,
+                                HostMemPolicy policy, Error **errp);
+
+/**
+ * host_memory_backend_rebind_info:
+ * @backend: the memory backend
+ *
+ * Returns: the progress of the last host_memory_backend_rebind() call,
+ * or NULL if there was none.
+ */
+MemdevRebindInfo *host_memory_backend_rebind_info(HostMemoryBackend *backend);
+
+/**
+ * host_memory_backend_prealloc_wait_all:
+ * @errp: error object
+ *
+ * Wait for the backends created with prealloc-async=on to finish
+ * preallocating their memory.  Must be called after cold-plugged
+ * devices are created and before anything writes to guest memory.
+ */
+void host_memory_backend_prealloc_wait_all(Error **errp);
 #endif
@@ -37,6 +37,11 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* AioContext poll-forever parameters */
+    bool poll_forever;
+    int64_t poll_idle_ns;
+    int64_t poll_budget;
 } IOThread;
 
 #define IOTHREAD(obj) \
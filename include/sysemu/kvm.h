@@ -219,6 +219,21 @@ int kvm_has_pit_state2(void);
 int kvm_has_many_ioeventfds(void);
 int kvm_has_gsi_routing(void);
 
+typedef struct KVMHaltPollStats {
+    int64_t halt_poll_ns;
+    uint64_t successful;
+    uint64_t failed;
+} KVMHaltPollStats;
+
+/**
+ * kvm_get_halt_poll_stats:
+ * @stats: filled with the halt-polling limit and poll counters
+ *
+ * Returns: false if KVM is disabled or the host does not expose the
+ * per-VM counters (debugfs not mounted or not accessible).
+ */
+bool kvm_get_halt_poll_stats(KVMHaltPollStats *stats);
+
 int kvm_init_vcpu(CPUState *cpu);
 int kvm_cpu_exec(CPUState *cpu);
 int kvm_destroy_vcpu(CPUState *cpu);
@@ -476,6 +491,20 @@ void kvm_init_cpu_signals(CPUState *cpu);
 int kvm_irqchip_add_msi_route(KVMState *s, int vector, PCIDevice *dev);
 int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg,
                                  PCIDevice *dev);
+
+/**
+ * kvm_irqchip_add_msi_route_devid - Add MSI route for a non-PCI device
+ * @s:      KVM state
+ * @msg:    MSI message, as programmed by the guest
+ * @devid:  device ID to pass to interrupt controllers that need one,
+ *          such as the GICv3 ITS; this is what the requester ID is for
+ *          PCI devices
+ * @return: virq (>=0) when success, errno (<0) when failed.
+ */
+int kvm_irqchip_add_msi_route_devid(KVMState *s, MSIMessage msg,
+                                    uint32_t devid);
+int kvm_irqchip_update_msi_route_devid(KVMState *s, int virq, MSIMessage msg,
+                                       uint32_t devid);
 void kvm_irqchip_commit_routes(KVMState *s);
 void kvm_irqchip_release_virq(KVMState *s, int virq);
 
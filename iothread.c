@@ -37,6 +37,11 @@ typedef ObjectClass IOThreadClass;
  */
 #define IOTHREAD_POLL_MAX_NS_DEFAULT 32768ULL
 
+/* In poll-forever mode, go back to waiting for notifications after 1 ms of
+ * polling without finding work.
+ */
+#define IOTHREAD_POLL_IDLE_NS_DEFAULT 1000000
+
 static __thread IOThread *my_iothread;
 
 AioContext *qemu_get_current_aio_context(void)
@@ -106,6 +111,8 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->poll_idle_ns = IOTHREAD_POLL_IDLE_NS_DEFAULT;
+    iothread->poll_budget = 100;
 }
 
 static void iothread_instance_finalize(Object *obj)
@@ -135,6 +142,27 @@ static void iothread_instance_finalize(Object *obj)
     qemu_mutex_destroy(&iothread->init_done_lock);
 }
 
+static void iothread_set_aio_context_params(IOThread *iothread, Error **errp)
+{
+    Error *local_err = NULL;
+
+    aio_context_set_poll_params(iothread->ctx,
+                                iothread->poll_max_ns,
+                                iothread->poll_grow,
+                                iothread->poll_shrink,
+                                &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    aio_context_set_poll_forever(iothread->ctx,
+                                 iothread->poll_forever,
+                                 iothread->poll_idle_ns,
+                                 iothread->poll_budget,
+                                 errp);
+}
+
 static void iothread_complete(UserCreatable *obj, Error **errp)
 {
     Error *local_error = NULL;
@@ -150,11 +178,7 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
-    aio_context_set_poll_params(iothread->ctx,
-                                iothread->poll_max_ns,
-                                iothread->poll_grow,
-                                iothread->poll_shrink,
-                                &local_error);
+    iothread_set_aio_context_params(iothread, &local_error);
     if (local_error) {
         error_propagate(errp, local_error);
         aio_context_unref(iothread->ctx);
@@ -188,16 +212,24 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    int64_t min;
+    int64_t max;
 } PollParamInfo;
 
 static PollParamInfo poll_max_ns_info = {
-    "poll-max-ns", offsetof(IOThread, poll_max_ns),
+    "poll-max-ns", offsetof(IOThread, poll_max_ns), 0, INT64_MAX,
 };
 static PollParamInfo poll_grow_info = {
-    "poll-grow", offsetof(IOThread, poll_grow),
+    "poll-grow", offsetof(IOThread, poll_grow), 0, INT64_MAX,
 };
 static PollParamInfo poll_shrink_info = {
-    "poll-shrink", offsetof(IOThread, poll_shrink),
+    "poll-shrink", offsetof(IOThread, poll_shrink), 0, INT64_MAX,
+};
+static PollParamInfo poll_idle_ns_info = {
+    "poll-idle-ns", offsetof(IOThread, poll_idle_ns), 0, INT64_MAX,
+};
+static PollParamInfo poll_budget_info = {
+    "poll-budget", offsetof(IOThread, poll_budget), 1, 100,
 };
 
 static void iothread_get_poll_param(Object *obj, Visitor *v,
@@ -224,26 +256,40 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
         goto out;
     }
 
-    if (value < 0) {
-        error_setg(&local_err, "%s value must be in range [0, %"PRId64"]",
-                   info->name, INT64_MAX);
+    if (value < info->min || value > info->max) {
+        error_setg(&local_err, "%s value must be in range [%"PRId64", %"
+                   PRId64"]", info->name, info->min, info->max);
         goto out;
     }
 
     *field = value;
 
     if (iothread->ctx) {
-        aio_context_set_poll_params(iothread->ctx,
-                                    iothread->poll_max_ns,
-                                    iothread->poll_grow,
-                                    iothread->poll_shrink,
-                                    &local_err);
+        iothread_set_aio_context_params(iothread, &local_err);
     }
 
 out:
     error_propagate(errp, local_err);
 }
 
+static bool iothread_get_poll_forever(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->poll_forever;
+}
+
+static void iothread_set_poll_forever(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_forever = value;
+
+    if (iothread->ctx) {
+        iothread_set_aio_context_params(iothread, errp);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -261,6 +307,18 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add_bool(klass, "poll-forever",
+                                   iothread_get_poll_forever,
+                                   iothread_set_poll_forever,
+                                   &error_abort);
+    object_class_property_add(klass, "poll-idle-ns", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_idle_ns_info, &error_abort);
+    object_class_property_add(klass, "poll-budget", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_budget_info, &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -311,6 +369,9 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_forever = iothread->poll_forever;
+    info->poll_idle_ns = iothread->poll_idle_ns;
+    info->poll_budget = iothread->poll_budget;
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
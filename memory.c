@@ -103,6 +103,62 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+/* A change to the layout of @mr within @range, expressed in the coordinates
+ * of @mr itself (i.e. before adding mr->addr).  Changes are collected during
+ * a transaction so that the commit only renders again the parts of each
+ * FlatView that they can affect.
+ */
+typedef struct MemoryRegionUpdate {
+    MemoryRegion *mr;
+    AddrRange range;
+} MemoryRegionUpdate;
+
+/* Past this many changes in a transaction, rebuild everything */
+#define MEMORY_REGION_UPDATES_MAX 64
+/* Upper bound on the regions visited while mapping changes to FlatViews */
+#define MEMORY_REGION_UPDATE_BUDGET 1024
+
+static GArray *memory_region_updates;
+static bool memory_region_update_full;
+
+static void memory_region_update_range(MemoryRegion *mr,
+                                       Int128 start, Int128 size)
+{
+    MemoryRegionUpdate update = {
+        .mr = mr,
+        .range = addrrange_make(start, size),
+    };
+
+    memory_region_update_pending = true;
+    if (memory_region_update_full || !int128_nz(size)) {
+        return;
+    }
+    if (!memory_region_updates) {
+        memory_region_updates = g_array_new(false, false,
+                                            sizeof(MemoryRegionUpdate));
+    }
+    if (memory_region_updates->len == MEMORY_REGION_UPDATES_MAX) {
+        memory_region_update_full = true;
+        return;
+    }
+    memory_region_ref(mr);
+    g_array_append_val(memory_region_updates, update);
+}
+
+static void memory_region_updates_clear(void)
+{
+    unsigned i;
+
+    for (i = 0; memory_region_updates && i < memory_region_updates->len; i++) {
+        memory_region_unref(g_array_index(memory_region_updates,
+                                          MemoryRegionUpdate, i).mr);
+    }
+    if (memory_region_updates) {
+        g_array_set_size(memory_region_updates, 0);
+    }
+    memory_region_update_full = false;
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -776,6 +832,280 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     return view;
 }
 
+/* Map the changes recorded in the current transaction to the FlatViews
+ * that can see them.  @mr changed within @range (in its own coordinates);
+ * walk up through containers and aliases, adding a clip to every FlatView
+ * root that is met on the way.
+ */
+static bool memory_region_update_propagate(GHashTable *clips,
+                                           MemoryRegion *mr,
+                                           AddrRange range,
+                                           unsigned *budget)
+{
+    GArray *view_clips;
+    MemoryRegion *alias;
+    AddrRange r;
+
+    if (!*budget) {
+        return false;
+    }
+    --*budget;
+
+    view_clips = g_hash_table_lookup(clips, mr);
+    if (view_clips) {
+        AddrRange all = addrrange_make(int128_zero(), int128_2_64());
+
+        r = addrrange_shift(range, int128_make64(mr->addr));
+        if (addrrange_intersects(r, all)) {
+            r = addrrange_intersection(r, all);
+            g_array_append_val(view_clips, r);
+        }
+    }
+
+    QLIST_FOREACH(alias, &mr->alias_users, alias_link) {
+        AddrRange window = addrrange_make(int128_make64(alias->alias_offset),
+                                          alias->size);
+
+        if (!addrrange_intersects(range, window)) {
+            continue;
+        }
+        r = addrrange_intersection(range, window);
+        int128_subfrom(&r.start, int128_make64(alias->alias_offset));
+        if (!memory_region_update_propagate(clips, alias, r, budget)) {
+            return false;
+        }
+    }
+
+    if (mr->container) {
+        r = addrrange_shift(range, int128_make64(mr->addr));
+        return memory_region_update_propagate(clips, mr->container, r, budget);
+    }
+    return true;
+}
+
+/* Returns a table from each root in @views to the array of ranges of its
+ * FlatView that must be rendered again, or NULL if everything must be.
+ */
+static GHashTable *memory_region_update_clips(GHashTable *views)
+{
+    GHashTable *clips;
+    GHashTableIter iter;
+    gpointer key;
+    unsigned budget = MEMORY_REGION_UPDATE_BUDGET;
+    unsigned i;
+
+    if (memory_region_update_full || !memory_region_updates) {
+        return NULL;
+    }
+
+    clips = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                  (GDestroyNotify) g_array_unref);
+    g_hash_table_iter_init(&iter, views);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (key) {
+            g_hash_table_insert(clips, key,
+                                g_array_new(false, false, sizeof(AddrRange)));
+        }
+    }
+
+    for (i = 0; i < memory_region_updates->len; i++) {
+        MemoryRegionUpdate *update = &g_array_index(memory_region_updates,
+                                                    MemoryRegionUpdate, i);
+
+        if (!memory_region_update_propagate(clips, update->mr, update->range,
+                                            &budget)) {
+            g_hash_table_unref(clips);
+            return NULL;
+        }
+    }
+    return clips;
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_eq(r1->start, r2->start) ? 0 : 1;
+}
+
+/* Sort @clips and merge overlapping or adjacent ranges */
+static void flatview_clips_normalize(GArray *clips)
+{
+    AddrRange *r = (AddrRange *)clips->data;
+    unsigned i, n = 0;
+
+    g_array_sort(clips, addrrange_compare);
+    for (i = 1; i < clips->len; i++) {
+        if (int128_le(r[i].start, addrrange_end(r[n]))) {
+            Int128 end = int128_max(addrrange_end(r[n]), addrrange_end(r[i]));
+            r[n].size = int128_sub(end, r[n].start);
+        } else {
+            r[++n] = r[i];
+        }
+    }
+    g_array_set_size(clips, clips->len ? n + 1 : 0);
+}
+
+/* Append the part of @fr between @start and @end to @view */
+static void flatview_append_range(FlatView *view, FlatRange *fr,
+                                  Int128 start, Int128 end)
+{
+    FlatRange piece = *fr;
+
+    piece.offset_in_region += int128_get64(int128_sub(start, fr->addr.start));
+    piece.addr = addrrange_make(start, int128_sub(end, start));
+    flatview_insert(view, view->nr, &piece);
+}
+
+/* Update the dispatch copied from @old_view for the pages in @clips */
+static void flatview_update_dispatch(FlatView *view, FlatView *old_view,
+                                     GArray *clips)
+{
+    GArray *areas = g_array_sized_new(false, false, sizeof(AddrRange),
+                                      clips->len);
+    unsigned i, j = 0;
+
+    /* Sections of the old dispatch must either survive whole or go away
+     * whole, because lookups trust their size.  Widen each clip to the old
+     * ranges it touches.
+     */
+    for (i = 0; i < clips->len; i++) {
+        AddrRange area = g_array_index(clips, AddrRange, i);
+        Int128 start = area.start, end = addrrange_end(area);
+        unsigned k;
+
+        while (j < old_view->nr &&
+               int128_le(addrrange_end(old_view->ranges[j].addr), start)) {
+            j++;
+        }
+        for (k = j; k < old_view->nr; k++) {
+            AddrRange *r = &old_view->ranges[k].addr;
+
+            if (int128_ge(r->start, addrrange_end(area))) {
+                break;
+            }
+            start = int128_min(start, r->start);
+            end = int128_max(end, addrrange_end(*r));
+        }
+        area = addrrange_make(start, int128_sub(end, start));
+        g_array_append_val(areas, area);
+    }
+    flatview_clips_normalize(areas);
+
+    j = 0;
+    view->dispatch = address_space_dispatch_clone(old_view->dispatch, view);
+    for (i = 0; i < areas->len; i++) {
+        AddrRange *clip = &g_array_index(areas, AddrRange, i);
+        hwaddr start = int128_get64(clip->start);
+        hwaddr last = int128_get64(int128_sub(addrrange_end(*clip),
+                                              int128_one()));
+        AddrRange pages;
+
+        address_space_dispatch_clear(view->dispatch, &start, &last);
+        pages = addrrange_make(int128_make64(start),
+                               int128_add(int128_make64(last - start),
+                                          int128_one()));
+
+        /* Clips are sorted, but widened to pages they may overlap */
+        while (j && int128_gt(addrrange_end(view->ranges[j - 1].addr),
+                              pages.start)) {
+            j--;
+        }
+        for (; j < view->nr; j++) {
+            FlatRange *fr = &view->ranges[j];
+            MemoryRegionSection mrs;
+            AddrRange r;
+
+            if (int128_ge(fr->addr.start, addrrange_end(pages))) {
+                break;
+            }
+            if (!addrrange_intersects(fr->addr, pages)) {
+                continue;
+            }
+            r = addrrange_intersection(fr->addr, pages);
+            mrs = section_from_flat_range(fr, view);
+            mrs.offset_within_region +=
+                int128_get64(int128_sub(r.start, fr->addr.start));
+            mrs.offset_within_address_space = int128_get64(r.start);
+            mrs.size = r.size;
+            flatview_add_to_dispatch(view, &mrs);
+        }
+    }
+    address_space_dispatch_compact(view->dispatch);
+    g_array_free(areas, true);
+}
+
+/* Render again the parts of @old_view covered by @clips, keeping the rest
+ * of its ranges (and of its dispatch tree) as they are.
+ */
+static FlatView *flatview_update(FlatView *old_view, GArray *clips)
+{
+    MemoryRegion *mr = old_view->root;
+    FlatView *view;
+    FlatRange *fr;
+    unsigned i, j = 0, dirty = 0;
+
+    if (!clips->len) {
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
+    flatview_clips_normalize(clips);
+    view = flatview_new(mr);
+    trace_flatview_update(view, old_view, clips->len);
+
+    FOR_EACH_FLAT_RANGE(fr, old_view) {
+        Int128 start = fr->addr.start;
+        Int128 end = addrrange_end(fr->addr);
+
+        while (j < clips->len &&
+               int128_le(addrrange_end(g_array_index(clips, AddrRange, j)),
+                         start)) {
+            j++;
+        }
+        for (i = j; i < clips->len; i++) {
+            AddrRange *clip = &g_array_index(clips, AddrRange, i);
+
+            if (int128_ge(clip->start, end)) {
+                break;
+            }
+            if (int128_lt(start, clip->start)) {
+                flatview_append_range(view, fr, start, clip->start);
+            }
+            start = int128_max(start, addrrange_end(*clip));
+        }
+        if (int128_lt(start, end)) {
+            flatview_append_range(view, fr, start, end);
+        }
+        dirty += i > j;
+    }
+
+    for (i = 0; i < clips->len; i++) {
+        render_memory_region(view, mr, int128_zero(),
+                             g_array_index(clips, AddrRange, i), false);
+    }
+    flatview_simplify(view);
+
+    if (dirty < old_view->nr / 2) {
+        flatview_update_dispatch(view, old_view, clips);
+    } else {
+        view->dispatch = address_space_dispatch_new(view);
+        for (i = 0; i < view->nr; i++) {
+            MemoryRegionSection mrs =
+                section_from_flat_range(&view->ranges[i], view);
+            flatview_add_to_dispatch(view, &mrs);
+        }
+        address_space_dispatch_compact(view->dispatch);
+    }
+    g_hash_table_replace(flat_views, mr, view);
+
+    return view;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -964,22 +1294,39 @@ static void flatviews_init(void)
 static void flatviews_reset(void)
 {
     AddressSpace *as;
+    GHashTable *old_views = flat_views;
+    GHashTable *clips = NULL;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    if (old_views) {
+        clips = memory_region_update_clips(old_views);
+    }
+
+    /* Render unique FVs, starting from the old ones when possible */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        GArray *view_clips;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        view_clips = clips ? g_hash_table_lookup(clips, physmr) : NULL;
+        if (view_clips && view_clips->len <= MEMORY_REGION_UPDATES_MAX) {
+            flatview_update(g_hash_table_lookup(old_views, physmr),
+                            view_clips);
+        } else {
+            generate_memory_topology(physmr);
+        }
+    }
+
+    if (clips) {
+        g_hash_table_unref(clips);
+    }
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1064,6 +1411,7 @@ void memory_region_transaction_commit(void)
                 address_space_update_ioeventfds(as);
             }
             memory_region_update_pending = false;
+            memory_region_updates_clear();
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
         } else if (ioeventfd_update_pending) {
@@ -1219,6 +1567,7 @@ static void memory_region_initfn(Object *obj)
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
+    QLIST_INIT(&mr->alias_users);
 
     op = object_property_add(OBJECT(mr), "container",
                              "link<" TYPE_MEMORY_REGION ">",
@@ -1571,6 +1920,7 @@ void memory_region_init_ram_from_fd(MemoryRegion *mr,
                                     struct Object *owner,
                                     const char *name,
                                     uint64_t size,
+                                    uint64_t align,
                                     bool share,
                                     int fd,
                                     Error **errp)
@@ -1579,6 +1929,7 @@ void memory_region_init_ram_from_fd(MemoryRegion *mr,
     mr->ram = true;
     mr->terminates = true;
     mr->destructor = memory_region_destructor_ram;
+    mr->align = align;
     mr->ram_block = qemu_ram_alloc_from_fd(size, mr, share, fd, errp);
     mr->dirty_log_mask = 0;
 }
@@ -1622,6 +1973,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QLIST_INSERT_HEAD(&orig->alias_users, mr, alias_link);
 }
 
 void memory_region_init_rom_nomigrate(MemoryRegion *mr,
@@ -1696,6 +2048,16 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias && mr->alias_link.le_prev) {
+        QLIST_REMOVE(mr, alias_link);
+    }
+    while (!QLIST_EMPTY(&mr->alias_users)) {
+        MemoryRegion *alias = QLIST_FIRST(&mr->alias_users);
+
+        QLIST_REMOVE(alias, alias_link);
+        alias->alias_link.le_prev = NULL;
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1954,7 +2316,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_range(mr, int128_zero(), mr->size);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -1964,7 +2328,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_range(mr, int128_zero(), mr->size);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2195,7 +2561,10 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, int128_make64(subregion->addr),
+                                   subregion->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2233,8 +2602,11 @@ void memory_region_del_subregion(MemoryRegion *mr,
     assert(subregion->container == mr);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, int128_make64(subregion->addr),
+                                   subregion->size);
+    }
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2245,7 +2617,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_range(mr, int128_zero(), mr->size);
     memory_region_transaction_commit();
 }
 
@@ -2260,8 +2632,8 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_update_range(mr, int128_zero(), int128_max(s, mr->size));
     mr->size = s;
-    memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
 
@@ -2283,8 +2655,17 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        if (mr->enabled) {
+            /* Cover the old placement too, seen from the new one */
+            memory_region_update_range(mr, int128_sub(int128_make64(mr->addr),
+                                                      int128_make64(addr)),
+                                       mr->size);
+            memory_region_update_range(mr, int128_zero(), mr->size);
+        }
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2408,6 +2789,7 @@ void memory_global_dirty_log_start(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_full = true;
     memory_region_transaction_commit();
 }
 
@@ -2418,6 +2800,7 @@ static void memory_global_dirty_log_do_stop(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_full = true;
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2573,6 +2956,14 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    as->bounce_maps = 0;
+    as->bounce_waits = 0;
+    as->copy_bytes_to = 0;
+    as->copy_bytes_from = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -2580,6 +2971,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(atomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -2859,6 +3254,19 @@ void mtree_info(fprintf_function mon_printf, void *f, bool flatview,
 
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         mon_printf(f, "address-space: %s\n", as->name);
+        if (as->bounce_maps || as->bounce_waits) {
+            mon_printf(f, "  bounce buffers: %zu/%zu bytes in use, "
+                       "%" PRIu64 " maps, %" PRIu64 " waits\n",
+                       atomic_read(&as->bounce_buffer_size),
+                       as->max_bounce_buffer_size,
+                       as->bounce_maps, as->bounce_waits);
+        }
+        if (as->copy_bytes_to || as->copy_bytes_from) {
+            mon_printf(f, "  bulk copies: %" PRIu64 " bytes in, "
+                       "%" PRIu64 " bytes out\n",
+                       atomic_read(&as->copy_bytes_to),
+                       atomic_read(&as->copy_bytes_from));
+        }
         mtree_print_mr(mon_printf, f, as->root, 1, 0, &ml_head);
         mon_printf(f, "\n");
     }
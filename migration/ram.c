@@ -206,6 +206,8 @@ struct RAMState {
     uint32_t last_version;
     /* We are in the first round */
     bool ram_bulk_stage;
+    /* The guest reports free pages, so the bitmap is not full in round 1 */
+    bool fpo_enabled;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
     /* these variables are used for bitmap sync */
@@ -235,6 +237,32 @@ typedef struct RAMState RAMState;
 
 static RAMState *ram_state;
 
+static NotifierWithReturnList precopy_notifier_list;
+
+void precopy_add_notifier(NotifierWithReturn *n)
+{
+    notifier_with_return_list_add(&precopy_notifier_list, n);
+}
+
+void precopy_remove_notifier(NotifierWithReturn *n)
+{
+    notifier_with_return_remove(n);
+}
+
+static int precopy_notify(PrecopyNotifyReason reason)
+{
+    PrecopyNotifyData pnd = { .reason = reason };
+
+    return notifier_with_return_list_notify(&precopy_notifier_list, &pnd);
+}
+
+void precopy_enable_free_page_optimization(void)
+{
+    if (ram_state) {
+        ram_state->fpo_enabled = true;
+    }
+}
+
 uint64_t ram_bytes_remaining(void)
 {
     return ram_state ? (ram_state->migration_dirty_pages * TARGET_PAGE_SIZE) :
@@ -773,7 +801,7 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     unsigned long *bitmap = rb->bmap;
     unsigned long next;
 
-    if (rs->ram_bulk_stage && start > 0) {
+    if (!rs->fpo_enabled && rs->ram_bulk_stage && start > 0) {
         next = start + 1;
     } else {
         next = find_next_bit(bitmap, size, start);
@@ -788,11 +816,14 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
 {
     bool ret;
 
+    /* Free page hints clear bits from the main loop */
+    qemu_mutex_lock(&rs->bitmap_mutex);
     ret = test_and_clear_bit(page, rb->bmap);
 
     if (ret) {
         rs->migration_dirty_pages--;
     }
+    qemu_mutex_unlock(&rs->bitmap_mutex);
     return ret;
 }
 
@@ -804,6 +835,56 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
                                               &rs->num_dirty_pages_period);
 }
 
+/**
+ * qemu_guest_free_page_hint: the guest reported @addr as free
+ *
+ * Clears the range from the dirty bitmap so that it is not sent,
+ * unless it is dirtied again.  Called with the iothread lock held,
+ * between two bitmap syncs.
+ *
+ * @addr: host address of the free memory
+ * @len: length of the free memory
+ */
+void qemu_guest_free_page_hint(void *addr, size_t len)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    ram_addr_t offset;
+    size_t used_len;
+    unsigned long start, npages, cleared;
+
+    if (!rs || !rs->fpo_enabled) {
+        return;
+    }
+
+    rcu_read_lock();
+    for (; len > 0; len -= used_len, addr += used_len) {
+        block = qemu_ram_block_from_host(addr, false, &offset);
+        if (unlikely(!block || !block->bmap ||
+                     offset >= block->used_length)) {
+            break;
+        }
+        used_len = MIN(len, block->used_length - offset);
+
+        /* Only whole target pages are known to be free */
+        start = DIV_ROUND_UP(offset, TARGET_PAGE_SIZE);
+        npages = ((offset + used_len) >> TARGET_PAGE_BITS);
+        if (npages <= start) {
+            continue;
+        }
+        npages -= start;
+
+        qemu_mutex_lock(&rs->bitmap_mutex);
+        cleared = bitmap_count_one_with_offset(block->bmap, start, npages);
+        rs->migration_dirty_pages -= cleared;
+        bitmap_clear(block->bmap, start, npages);
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+
+        trace_qemu_guest_free_page_hint(block->idstr, start, npages, cleared);
+    }
+    rcu_read_unlock();
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -825,6 +906,19 @@ uint64_t ram_pagesize_summary(void)
     return summary;
 }
 
+static void migration_bitmap_sync(RAMState *rs);
+
+/*
+ * Precopy syncs tell the free page hint providers to stop, so that no
+ * stale hint can clear a bit set by the sync, and to start over after.
+ */
+static void migration_bitmap_sync_precopy(RAMState *rs)
+{
+    precopy_notify(PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC);
+    migration_bitmap_sync(rs);
+    precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC);
+}
+
 static void migration_bitmap_sync(RAMState *rs)
 {
     RAMBlock *block;
@@ -1621,6 +1715,7 @@ static void ram_save_cleanup(void *opaque)
      * no writing race against this migration_bitmap
      */
     memory_global_dirty_log_stop();
+    precopy_notify(PRECOPY_NOTIFY_CLEANUP);
 
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
         g_free(block->bmap);
@@ -2151,7 +2246,8 @@ static void ram_init_bitmaps(RAMState *rs)
 
     ram_list_init_bitmaps();
     memory_global_dirty_log_start();
-    migration_bitmap_sync(rs);
+    precopy_notify(PRECOPY_NOTIFY_SETUP);
+    migration_bitmap_sync_precopy(rs);
 
     rcu_read_unlock();
     qemu_mutex_unlock_ramlist();
@@ -2324,8 +2420,9 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     rcu_read_lock();
 
     if (!migration_in_postcopy()) {
-        migration_bitmap_sync(rs);
+        migration_bitmap_sync_precopy(rs);
     }
+    precopy_notify(PRECOPY_NOTIFY_COMPLETE);
 
     ram_control_before_iterate(f, RAM_CONTROL_FINISH);
 
@@ -2367,7 +2464,7 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         rcu_read_lock();
-        migration_bitmap_sync(rs);
+        migration_bitmap_sync_precopy(rs);
         rcu_read_unlock();
         qemu_mutex_unlock_iothread();
         remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
@@ -3004,5 +3101,6 @@ static SaveVMHandlers savevm_ram_handlers = {
 void ram_mig_init(void)
 {
     qemu_mutex_init(&XBZRLE.lock);
+    notifier_with_return_list_init(&precopy_notifier_list);
     register_savevm_live(NULL, "ram", 0, 4, &savevm_ram_handlers, &ram_state);
 }
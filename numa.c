@@ -39,6 +39,11 @@
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/cutils.h"
+#include "qemu/timer.h"
+
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
 
 QemuOptsList qemu_numa_opts = {
     .name = "numa",
@@ -320,6 +325,124 @@ void numa_default_auto_assign_ram(MachineClass *mc, NodeInfo *nodes,
     nodes[i].node_mem = size - usedmem;
 }
 
+#ifdef CONFIG_NUMA
+/* How often backends with host-nodes-follow=on look at their vCPUs */
+#define NUMA_FOLLOW_INTERVAL_MS 1000
+
+static QEMUTimer *numa_follow_timer;
+
+/* Placement seen on the previous check, for each guest node */
+static unsigned long numa_follow_pending[MAX_NODES][BITS_TO_LONGS(MAX_NODES)];
+
+/* Add the host nodes whose CPUs the vCPU thread may run on to @nodes */
+static bool numa_follow_cpu_nodes(CPUState *cpu, unsigned long *nodes)
+{
+    cpu_set_t cpus;
+    int i, n;
+
+    if (!cpu->thread_id ||
+        sched_getaffinity(cpu->thread_id, sizeof(cpus), &cpus)) {
+        return false;
+    }
+    for (i = 0, n = CPU_COUNT(&cpus); n > 0 && i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &cpus)) {
+            int node = numa_node_of_cpu(i);
+
+            if (node >= 0 && node < MAX_NODES) {
+                set_bit(node, nodes);
+            }
+            n--;
+        }
+    }
+    return true;
+}
+
+static void numa_follow_node(MachineState *ms, int nodenr,
+                             HostMemoryBackend *backend)
+{
+    MachineClass *mc = MACHINE_GET_CLASS(ms);
+    const CPUArchIdList *possible_cpus = mc->possible_cpu_arch_ids(ms);
+    DECLARE_BITMAP(nodes, MAX_NODES + 1);
+    HostMemPolicy policy;
+    MemdevRebindInfo *info;
+    Error *local_err = NULL;
+    bool busy;
+    int i;
+
+    bitmap_zero(nodes, MAX_NODES + 1);
+    for (i = 0; i < possible_cpus->len; i++) {
+        const CPUArchId *slot = &possible_cpus->cpus[i];
+
+        if (slot->cpu && slot->props.has_node_id &&
+            slot->props.node_id == nodenr) {
+            numa_follow_cpu_nodes(CPU(slot->cpu), nodes);
+        }
+    }
+
+    /* No vCPUs, or vCPUs free to run anywhere: nothing to follow */
+    if (bitmap_empty(nodes, MAX_NODES) ||
+        bitmap_count_one(nodes, MAX_NODES) >= numa_num_configured_nodes()) {
+        return;
+    }
+
+    policy = backend->policy;
+    if (policy == HOST_MEM_POLICY_DEFAULT) {
+        policy = HOST_MEM_POLICY_BIND;
+    }
+    if (policy == backend->policy &&
+        bitmap_equal(nodes, backend->host_nodes, MAX_NODES)) {
+        return;
+    }
+
+    /* Wait for the vCPUs to settle before moving memory after them */
+    if (!bitmap_equal(nodes, numa_follow_pending[nodenr], MAX_NODES)) {
+        bitmap_copy(numa_follow_pending[nodenr], nodes, MAX_NODES);
+        return;
+    }
+
+    info = host_memory_backend_rebind_info(backend);
+    busy = info && info->status == MEMDEV_REBIND_STATUS_ACTIVE;
+    qapi_free_MemdevRebindInfo(info);
+    if (busy) {
+        return;
+    }
+
+    host_memory_backend_rebind(backend, nodes, policy, &local_err);
+    if (local_err) {
+        error_reportf_err(local_err, "numa: node %d cannot follow its "
+                          "vCPUs, disabling host-nodes-follow: ", nodenr);
+        backend->host_nodes_follow = false;
+    }
+}
+
+static void numa_follow_timer_cb(void *opaque)
+{
+    MachineState *ms = opaque;
+    int i;
+
+    for (i = 0; i < nb_numa_nodes; i++) {
+        HostMemoryBackend *backend = numa_info[i].node_memdev;
+
+        if (backend && backend->host_nodes_follow) {
+            numa_follow_node(ms, i, backend);
+        }
+    }
+    timer_mod(numa_follow_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                                 NUMA_FOLLOW_INTERVAL_MS);
+}
+
+static void numa_follow_init(MachineState *ms)
+{
+    if (numa_available() < 0) {
+        return;
+    }
+    numa_follow_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                     numa_follow_timer_cb, ms);
+    timer_mod(numa_follow_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                                 NUMA_FOLLOW_INTERVAL_MS);
+}
+#endif
+
 void parse_numa_opts(MachineState *ms)
 {
     int i;
@@ -412,6 +535,12 @@ void parse_numa_opts(MachineState *ms)
             /* Validation succeeded, now fill in any missing distances. */
             complete_init_numa_distance();
         }
+
+#ifdef CONFIG_NUMA
+        if (have_memdevs == 1) {
+            numa_follow_init(ms);
+        }
+#endif
     }
 }
 
@@ -497,9 +626,10 @@ void memory_region_allocate_system_memory(MemoryRegion *mr, Object *owner,
 
 static void numa_stat_memory_devices(NumaNodeMem node_mem[])
 {
-    MemoryDeviceInfoList *info_list = qmp_pc_dimm_device_list();
+    MemoryDeviceInfoList *info_list = qmp_memory_device_list();
     MemoryDeviceInfoList *info;
     PCDIMMDeviceInfo     *pcdimm_info;
+    VirtioMEMDeviceInfo  *vmem_info;
 
     for (info = info_list; info; info = info->next) {
         MemoryDeviceInfo *value = info->value;
@@ -514,6 +644,12 @@ static void numa_stat_memory_devices(NumaNodeMem node_mem[])
                 pcdimm_info = value->u.nvdimm.data;
                 break;
 
+            case MEMORY_DEVICE_INFO_KIND_VIRTIO_MEM:
+                /* All of the memory a virtio-mem device provides is plugged */
+                vmem_info = value->u.virtio_mem.data;
+                node_mem[vmem_info->node].node_mem += vmem_info->size;
+                node_mem[vmem_info->node].node_plugged_mem += vmem_info->size;
+                /* fall through */
             default:
                 pcdimm_info = NULL;
                 break;
@@ -549,6 +685,7 @@ static int query_memdev(Object *obj, void *opaque)
 {
     MemdevList **list = opaque;
     MemdevList *m = NULL;
+    Error *local_err = NULL;
 
     if (object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
         m = g_malloc0(sizeof(*m));
@@ -574,6 +711,20 @@ static int query_memdev(Object *obj, void *opaque)
         object_property_get_uint16List(obj, "host-nodes",
                                        &m->value->host_nodes,
                                        &error_abort);
+        m->value->thp = object_property_get_enum(obj, "thp", "OnOffAuto",
+                                                 &error_abort);
+        m->value->thp_size = host_memory_backend_thp_size(
+                                 MEMORY_BACKEND(obj), &local_err);
+        if (local_err) {
+            error_free(local_err);
+            local_err = NULL;
+        } else {
+            m->value->has_thp_size = true;
+        }
+        m->value->host_nodes_follow =
+            object_property_get_bool(obj, "host-nodes-follow", &error_abort);
+        m->value->rebind = host_memory_backend_rebind_info(MEMORY_BACKEND(obj));
+        m->value->has_rebind = !!m->value->rebind;
 
         m->next = *list;
         *list = m;
@@ -591,6 +742,39 @@ MemdevList *qmp_query_memdev(Error **errp)
     return list;
 }
 
+void qmp_memdev_set_host_nodes(const char *id, uint16List *host_nodes,
+                               HostMemPolicy policy, Error **errp)
+{
+    Object *obj = object_resolve_path_component(object_get_objects_root(),
+                                                id);
+    DECLARE_BITMAP(nodes, MAX_NODES + 1);
+    HostMemoryBackend *backend;
+    Error *local_err = NULL;
+    uint16List *l;
+
+    if (!obj || !object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
+        error_setg(errp, "'%s' is not a memory backend", id);
+        return;
+    }
+    backend = MEMORY_BACKEND(obj);
+
+    bitmap_zero(nodes, MAX_NODES + 1);
+    for (l = host_nodes; l; l = l->next) {
+        if (l->value >= MAX_NODES) {
+            error_setg(errp, "Invalid host node: %" PRIu16, l->value);
+            return;
+        }
+        set_bit(l->value, nodes);
+    }
+
+    host_memory_backend_rebind(backend, nodes, policy, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    backend->host_nodes_follow = false;
+}
+
 void ram_block_notifier_add(RAMBlockNotifier *n)
 {
     QLIST_INSERT_HEAD(&ram_list.ramblock_notifiers, n, next);
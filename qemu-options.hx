@@ -34,6 +34,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                supported accelerators are kvm, or tcg (default: tcg)\n"
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-halt-poll-ns=ns KVM halt-polling limit for this VM\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -75,6 +76,10 @@ Controls in-kernel irqchip support for the chosen accelerator when available.
 Enables IGD GFX passthrough support for the chosen machine when available.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-halt-poll-ns=ns
+Sets how long, in nanoseconds, a halted vCPU of this VM is polled by the
+host before it is put to sleep. Requires host kernel support for the
+per-VM halt-polling capability; the host default is used otherwise.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -3651,7 +3656,7 @@ property must be set.  These objects are placed in the
 
 @table @option
 
-@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
+@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align},thp=@var{on|off|auto}
 
 Creates a memory file backend object, which can be used to back
 the guest RAM with huge pages.
@@ -3691,7 +3696,19 @@ memory deduplication.
 Setting the @option{dump} boolean option to @var{off} excludes the memory from
 core dumps. This feature is also known as MADV_DONTDUMP.
 
+The @option{thp} option sets the transparent huge page policy of the memory:
+@var{on} requests huge pages (MADV_HUGEPAGE), @var{off} forbids them and
+keeps khugepaged away (MADV_NOHUGEPAGE), and @var{auto} keeps QEMU's default.
+It has no effect on hugetlbfs-backed memory.  The read-only @option{thp-size}
+property reports how much of the memory is currently backed by transparent
+huge pages.
+
 The @option{prealloc} boolean option enables memory preallocation.
+Preallocation runs on the CPUs of the nodes given by @option{host-nodes}.
+Setting the @option{prealloc-async} boolean option to @var{on} lets it run
+in the background while the machine and its devices are created; the
+read-only @option{prealloc-progress} property reports the percentage
+completed so far.
 
 The @option{host-nodes} option binds the memory range to a list of NUMA host
 nodes.
@@ -3712,6 +3729,13 @@ restrict memory allocation to the given host node list
 interleave memory allocations across the given host node list
 @end table
 
+The policy and host nodes can be changed while the guest runs with the
+@code{memdev-set-host-nodes} QMP command, which moves the memory already
+allocated to the new nodes in the background.  Setting the
+@option{host-nodes-follow} boolean option to @var{on} does the same
+automatically whenever the vCPUs of the guest NUMA node using the backend
+are pinned to a different set of host nodes.
+
 The @option{align} option specifies the base address alignment when
 QEMU mmap(2) @option{mem-path}, and accepts common suffixes, eg
 @option{2M}. Some backend store specified by @option{mem-path}
@@ -3726,7 +3750,7 @@ Memory backend objects offer more control than the @option{-m} option that is
 traditionally used to define guest RAM. Please refer to
 @option{memory-backend-file} for a description of the options.
 
-@item -object memory-backend-memfd,id=@var{id},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},size=@var{size},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},seal=@var{on|off},hugetlb=@var{on|off},hugetlbsize=@var{size}
+@item -object memory-backend-memfd,id=@var{id},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},size=@var{size},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},seal=@var{on|off},hugetlb=@var{on|off},hugetlbsize=@var{size},align=@var{align},pin=@var{on|off}
 
 Creates an anonymous memory file backend object, which allows QEMU to
 share the memory with an external process (e.g. when using
@@ -3742,6 +3766,15 @@ the @option{hugetlb} option, the @option{hugetlbsize} option specify
 the hugetlb page size on systems that support multiple hugetlb page
 sizes (it must be a power of 2 value supported by the system).
 
+The @option{align} option specifies the base address alignment of the
+mapping (it must be a power of 2 multiple of the page size).
+
+The @option{pin} option populates the memory before devices are created
+and locks it with mlock(), so that DMA mappings set up by vfio and vhost
+never fault it in.  It implies @option{prealloc} and, unless
+@option{align} is given, a 1 GiB aligned mapping.  The locked size is
+subject to RLIMIT_MEMLOCK.
+
 In some versions of Linux, the @option{hugetlb} option is incompatible
 with the @option{seal} option (requires at least Linux 4.16).
 
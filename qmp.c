@@ -67,10 +67,24 @@ VersionInfo *qmp_query_version(Error **errp)
 KvmInfo *qmp_query_kvm(Error **errp)
 {
     KvmInfo *info = g_malloc0(sizeof(*info));
+    KVMHaltPollStats stats = { .halt_poll_ns = -1 };
 
     info->enabled = kvm_enabled();
     info->present = kvm_available();
 
+    if (kvm_enabled()) {
+        if (kvm_get_halt_poll_stats(&stats)) {
+            info->has_halt_poll_successful = true;
+            info->halt_poll_successful = stats.successful;
+            info->has_halt_poll_failed = true;
+            info->halt_poll_failed = stats.failed;
+        }
+        if (stats.halt_poll_ns >= 0) {
+            info->has_halt_poll_ns = true;
+            info->halt_poll_ns = stats.halt_poll_ns;
+        }
+    }
+
     return info;
 }
 
@@ -531,7 +545,7 @@ void qmp_object_del(const char *id, Error **errp)
 
 MemoryDeviceInfoList *qmp_query_memory_devices(Error **errp)
 {
-    return qmp_pc_dimm_device_list();
+    return qmp_memory_device_list();
 }
 
 ACPIOSTInfoList *qmp_query_acpi_ospm_status(Error **errp)
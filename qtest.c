@@ -20,6 +20,7 @@
 #include "chardev/char-fe.h"
 #include "exec/ioport.h"
 #include "exec/memory.h"
+#include "exec/address-spaces.h"
 #include "hw/irq.h"
 #include "sysemu/accel.h"
 #include "sysemu/sysemu.h"
@@ -133,9 +134,16 @@ static bool qtest_opened;
  *  > memset ADDR SIZE VALUE
  *  < OK
  *
+ *  > copy ADDR SRC SIZE
+ *  < OK
+ *
  * ADDR, SIZE, VALUE are all integers parsed with strtoul() with a base of 0.
  * For 'memset' a zero size is permitted and does nothing.
  *
+ * 'copy' writes SIZE bytes from guest address SRC to ADDR with
+ * address_space_copy().  The source is mapped with address_space_map(), so
+ * the two ranges may overlap, and either may include MMIO.
+ *
  * DATA is an arbitrarily long hex number prefixed with '0x'.  If it's smaller
  * than the expected size, the value will be zero filled at the end of the data
  * sequence.
@@ -530,6 +538,35 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
             g_free(data);
         }
 
+        qtest_send_prefix(chr);
+        qtest_send(chr, "OK\n");
+    } else if (strcmp(words[0], "copy") == 0) {
+        uint64_t addr, src, len;
+        hwaddr l;
+        void *buf;
+        int ret;
+
+        g_assert(words[1] && words[2] && words[3]);
+        ret = qemu_strtou64(words[1], NULL, 0, &addr);
+        g_assert(ret == 0);
+        ret = qemu_strtou64(words[2], NULL, 0, &src);
+        g_assert(ret == 0);
+        ret = qemu_strtou64(words[3], NULL, 0, &len);
+        g_assert(ret == 0);
+
+        /* The mapping stops where the source changes from RAM to MMIO */
+        while (len) {
+            l = len;
+            buf = address_space_map(&address_space_memory, src, &l, false);
+            g_assert(buf);
+            address_space_copy(&address_space_memory, addr,
+                               MEMTXATTRS_UNSPECIFIED, buf, l, true, 0);
+            address_space_unmap(&address_space_memory, buf, l, false, l);
+            addr += l;
+            src += l;
+            len -= l;
+        }
+
         qtest_send_prefix(chr);
         qtest_send(chr, "OK\n");
     }  else if (strcmp(words[0], "b64write") == 0) {
@@ -2,7 +2,7 @@
 #include "qom/object.h"
 #include "hw/mem/pc-dimm.h"
 
-MemoryDeviceInfoList *qmp_pc_dimm_device_list(void)
+MemoryDeviceInfoList *qmp_memory_device_list(void)
 {
    return NULL;
 }
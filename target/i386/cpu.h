@@ -1158,6 +1158,7 @@ typedef struct CPUX86State {
     uint64_t steal_time_msr;
     uint64_t async_pf_en_msr;
     uint64_t pv_eoi_en_msr;
+    uint64_t poll_control_msr;
 
     /* Partition-wide HV MSRs, will be updated only on the first vcpu */
     uint64_t msr_hv_hypercall;
@@ -1265,6 +1266,7 @@ typedef struct CPUX86State {
 } CPUX86State;
 
 struct kvm_msrs;
+struct X86KVMRegCache;
 
 /**
  * X86CPU:
@@ -1351,6 +1353,7 @@ struct X86CPU {
     Notifier machine_done;
 
     struct kvm_msrs *kvm_msr_buf;
+    struct X86KVMRegCache *kvm_reg_cache;
 
     int32_t node_id; /* NUMA node this CPU belongs to */
     int32_t socket_id;
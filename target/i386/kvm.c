@@ -102,8 +102,87 @@ static int has_pit_state2;
 
 static bool has_msr_mcg_ext_ctl;
 
+static bool has_sync_regs;
+
 static struct kvm_cpuid2 *cpuid_cache;
 
+/* Register classes tracked by X86KVMRegCache */
+#define KVM_REG_CACHE_REGS          (1U << 0)
+#define KVM_REG_CACHE_SREGS         (1U << 1)
+#define KVM_REG_CACHE_XSAVE         (1U << 2)
+#define KVM_REG_CACHE_XCRS          (1U << 3)
+#define KVM_REG_CACHE_MSRS          (1U << 4)
+#define KVM_REG_CACHE_EVENTS        (1U << 5)
+#define KVM_REG_CACHE_DEBUGREGS     (1U << 6)
+#define KVM_REG_CACHE_TSC_DEADLINE  (1U << 7)
+
+/*
+ * Image of the state KVM holds for each register class, in the format
+ * kvm_arch_put_registers() would write it.  A runtime writeback skips the
+ * SET ioctl of every class whose image did not change, so that updating a
+ * GPR does not also push the MSRs, the XSAVE area and the segments.  The
+ * images become stale as soon as the vCPU runs again.
+ *
+ * With KVM_CAP_SYNC_REGS, KVM also stores regs, sregs and events into
+ * kvm_run on every exit and loads dirty regs and sregs from there on the
+ * next entry.  @sync_regs_valid tells whether that copy can be used in
+ * place of the GET ioctls.
+ */
+typedef struct X86KVMRegCache {
+    uint32_t valid;
+    bool sync_regs_valid;
+    struct kvm_regs regs;
+    struct kvm_sregs sregs;
+    struct kvm_xcrs xcrs;
+    struct kvm_vcpu_events events;
+    struct kvm_debugregs dbgregs;
+    uint64_t tsc_deadline;
+    struct kvm_msrs *msrs;
+    void *xsave;
+} X86KVMRegCache;
+
+static void kvm_reg_cache_store(X86CPU *cpu, uint32_t class, void *image,
+                                const void *data, size_t size)
+{
+    memcpy(image, data, size);
+    cpu->kvm_reg_cache->valid |= class;
+}
+
+/*
+ * Write one register class to KVM with the SET ioctl @type.  For runtime
+ * writebacks the ioctl is skipped if @data matches the cached @image.
+ */
+static int kvm_put_reg_class(X86CPU *cpu, int level, uint32_t class,
+                             int type, void *image, void *data, size_t size)
+{
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
+    int ret;
+
+    if (level == KVM_PUT_RUNTIME_STATE && (cache->valid & class) &&
+        !memcmp(image, data, size)) {
+        return 0;
+    }
+
+    ret = kvm_vcpu_ioctl(CPU(cpu), type, data);
+    if (ret < 0) {
+        cache->valid &= ~class;
+        return ret;
+    }
+    kvm_reg_cache_store(cpu, class, image, data, size);
+    return ret;
+}
+
+/*
+ * Runtime writebacks are immediately followed by KVM_RUN, which loads dirty
+ * sync regs before entering the guest.  KVM_RUN on an uninitialized vCPU
+ * returns before that point though, so use the ioctls for those.
+ */
+static bool kvm_can_put_sync_regs(X86CPU *cpu, int level)
+{
+    return has_sync_regs && level == KVM_PUT_RUNTIME_STATE &&
+           cpu->env.mp_state != KVM_MP_STATE_UNINITIALIZED;
+}
+
 int kvm_has_pit_state2(void)
 {
     return has_pit_state2;
@@ -534,6 +613,8 @@ static int kvm_inject_mce_oldstyle(X86CPU *cpu)
         mce.addr = env->mce_banks[bank * 4 + 2];
         mce.misc = env->mce_banks[bank * 4 + 3];
 
+        /* The injection updates MSRs that kvm_put_msrs must overwrite */
+        cpu->kvm_reg_cache->valid = 0;
         return kvm_vcpu_ioctl(CPU(cpu), KVM_X86_SET_MCE, &mce);
     }
     return 0;
@@ -1085,6 +1166,17 @@ int kvm_arch_init_vcpu(CPUState *cs)
     }
     cpu->kvm_msr_buf = g_malloc0(MSR_BUF_SIZE);
 
+    cpu->kvm_reg_cache = g_new0(X86KVMRegCache, 1);
+    cpu->kvm_reg_cache->msrs = g_malloc0(MSR_BUF_SIZE);
+    if (has_xsave) {
+        cpu->kvm_reg_cache->xsave = qemu_memalign(4096,
+                                                  sizeof(struct kvm_xsave));
+    }
+    if (has_sync_regs) {
+        cs->kvm_run->kvm_valid_regs = KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS |
+                                      KVM_SYNC_X86_EVENTS;
+    }
+
     if (!(env->features[FEAT_8000_0001_EDX] & CPUID_EXT2_RDTSCP)) {
         has_msr_tsc_aux = false;
     }
@@ -1100,7 +1192,10 @@ void kvm_arch_reset_vcpu(X86CPU *cpu)
 {
     CPUX86State *env = &cpu->env;
 
+    cpu->kvm_reg_cache->valid = 0;
     env->xcr0 = 1;
+    /* Host-side halt polling stays enabled until the guest opts out. */
+    env->poll_control_msr = 1;
     if (kvm_irqchip_in_kernel()) {
         env->mp_state = cpu_is_bsp(cpu) ? KVM_MP_STATE_RUNNABLE :
                                           KVM_MP_STATE_UNINITIALIZED;
@@ -1234,6 +1329,9 @@ int kvm_arch_init(MachineState *ms, KVMState *s)
     has_pit_state2 = kvm_check_extension(s, KVM_CAP_PIT_STATE2);
 #endif
 
+    has_sync_regs = (kvm_check_extension(s, KVM_CAP_SYNC_REGS) &
+                     KVM_SYNC_X86_VALID_FIELDS) == KVM_SYNC_X86_VALID_FIELDS;
+
     ret = kvm_get_supported_msrs(s);
     if (ret < 0) {
         return ret;
@@ -1347,9 +1445,11 @@ static void kvm_getput_reg(__u64 *kvm_reg, target_ulong *qemu_reg, int set)
     }
 }
 
-static int kvm_getput_regs(X86CPU *cpu, int set)
+static int kvm_getput_regs(X86CPU *cpu, int set, int level)
 {
     CPUX86State *env = &cpu->env;
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
+    struct kvm_run *run = CPU(cpu)->kvm_run;
     struct kvm_regs regs;
     int ret = 0;
 
@@ -1382,8 +1482,25 @@ static int kvm_getput_regs(X86CPU *cpu, int set)
     kvm_getput_reg(&regs.rflags, &env->eflags, set);
     kvm_getput_reg(&regs.rip, &env->eip, set);
 
-    if (set) {
-        ret = kvm_vcpu_ioctl(CPU(cpu), KVM_SET_REGS, &regs);
+    if (!set) {
+        /*
+         * KVM_GET_MP_STATE may have processed an INIT or SIPI since the
+         * last exit, which leaves the kvm_run copy behind.
+         */
+        if (cache->sync_regs_valid &&
+            memcmp(&regs, &run->s.regs.regs, sizeof(regs))) {
+            cache->sync_regs_valid = false;
+        }
+        kvm_reg_cache_store(cpu, KVM_REG_CACHE_REGS, &cache->regs,
+                            &regs, sizeof(regs));
+    } else if (kvm_can_put_sync_regs(cpu, level)) {
+        run->s.regs.regs = regs;
+        run->kvm_dirty_regs |= KVM_SYNC_X86_REGS;
+        kvm_reg_cache_store(cpu, KVM_REG_CACHE_REGS, &cache->regs,
+                            &regs, sizeof(regs));
+    } else {
+        ret = kvm_put_reg_class(cpu, level, KVM_REG_CACHE_REGS, KVM_SET_REGS,
+                                &cache->regs, &regs, sizeof(regs));
     }
 
     return ret;
@@ -1454,7 +1571,7 @@ ASSERT_OFFSET(XSAVE_ZMM_Hi256, zmm_hi256_state);
 ASSERT_OFFSET(XSAVE_Hi16_ZMM, hi16_zmm_state);
 ASSERT_OFFSET(XSAVE_PKRU, pkru_state);
 
-static int kvm_put_xsave(X86CPU *cpu)
+static int kvm_put_xsave(X86CPU *cpu, int level)
 {
     CPUX86State *env = &cpu->env;
     X86XSaveArea *xsave = env->kvm_xsave_buf;
@@ -1464,31 +1581,39 @@ static int kvm_put_xsave(X86CPU *cpu)
     }
     x86_cpu_xsave_all_areas(cpu, xsave);
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_XSAVE, xsave);
+    return kvm_put_reg_class(cpu, level, KVM_REG_CACHE_XSAVE, KVM_SET_XSAVE,
+                             cpu->kvm_reg_cache->xsave, xsave,
+                             sizeof(struct kvm_xsave));
 }
 
-static int kvm_put_xcrs(X86CPU *cpu)
+static void kvm_fill_xcrs(X86CPU *cpu, struct kvm_xcrs *xcrs)
 {
-    CPUX86State *env = &cpu->env;
-    struct kvm_xcrs xcrs = {};
+    memset(xcrs, 0, sizeof(*xcrs));
+    xcrs->nr_xcrs = 1;
+    xcrs->flags = 0;
+    xcrs->xcrs[0].xcr = 0;
+    xcrs->xcrs[0].value = cpu->env.xcr0;
+}
+
+static int kvm_put_xcrs(X86CPU *cpu, int level)
+{
+    struct kvm_xcrs xcrs;
 
     if (!has_xcrs) {
         return 0;
     }
 
-    xcrs.nr_xcrs = 1;
-    xcrs.flags = 0;
-    xcrs.xcrs[0].xcr = 0;
-    xcrs.xcrs[0].value = env->xcr0;
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_XCRS, &xcrs);
+    kvm_fill_xcrs(cpu, &xcrs);
+    return kvm_put_reg_class(cpu, level, KVM_REG_CACHE_XCRS, KVM_SET_XCRS,
+                             &cpu->kvm_reg_cache->xcrs, &xcrs, sizeof(xcrs));
 }
 
-static int kvm_put_sregs(X86CPU *cpu)
+static void kvm_fill_sregs(X86CPU *cpu, struct kvm_sregs *out)
 {
     CPUX86State *env = &cpu->env;
     struct kvm_sregs sregs;
 
-    memset(sregs.interrupt_bitmap, 0, sizeof(sregs.interrupt_bitmap));
+    memset(&sregs, 0, sizeof(sregs));
     if (env->interrupt_injected >= 0) {
         sregs.interrupt_bitmap[env->interrupt_injected / 64] |=
                 (uint64_t)1 << (env->interrupt_injected % 64);
@@ -1530,7 +1655,25 @@ static int kvm_put_sregs(X86CPU *cpu)
 
     sregs.efer = env->efer;
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_SREGS, &sregs);
+    *out = sregs;
+}
+
+static int kvm_put_sregs(X86CPU *cpu, int level)
+{
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
+    struct kvm_run *run = CPU(cpu)->kvm_run;
+    struct kvm_sregs sregs;
+
+    kvm_fill_sregs(cpu, &sregs);
+    if (kvm_can_put_sync_regs(cpu, level)) {
+        run->s.regs.sregs = sregs;
+        run->kvm_dirty_regs |= KVM_SYNC_X86_SREGS;
+        kvm_reg_cache_store(cpu, KVM_REG_CACHE_SREGS, &cache->sregs,
+                            &sregs, sizeof(sregs));
+        return 0;
+    }
+    return kvm_put_reg_class(cpu, level, KVM_REG_CACHE_SREGS, KVM_SET_SREGS,
+                             &cache->sregs, &sregs, sizeof(sregs));
 }
 
 static void kvm_msr_buf_reset(X86CPU *cpu)
@@ -1568,21 +1711,30 @@ void kvm_put_apicbase(X86CPU *cpu, uint64_t value)
     assert(ret == 1);
 }
 
-static int kvm_put_tscdeadline_msr(X86CPU *cpu)
+static int kvm_put_tscdeadline_msr(X86CPU *cpu, int level)
 {
     CPUX86State *env = &cpu->env;
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
     int ret;
 
     if (!has_msr_tsc_deadline) {
         return 0;
     }
+    if (level == KVM_PUT_RUNTIME_STATE &&
+        (cache->valid & KVM_REG_CACHE_TSC_DEADLINE) &&
+        cache->tsc_deadline == env->tsc_deadline) {
+        return 0;
+    }
 
     ret = kvm_put_one_msr(cpu, MSR_IA32_TSCDEADLINE, env->tsc_deadline);
     if (ret < 0) {
+        cache->valid &= ~KVM_REG_CACHE_TSC_DEADLINE;
         return ret;
     }
 
     assert(ret == 1);
+    cache->tsc_deadline = env->tsc_deadline;
+    cache->valid |= KVM_REG_CACHE_TSC_DEADLINE;
     return 0;
 }
 
@@ -1610,11 +1762,11 @@ static int kvm_put_msr_feature_control(X86CPU *cpu)
     return 0;
 }
 
-static int kvm_put_msrs(X86CPU *cpu, int level)
+/* Fill cpu->kvm_msr_buf with the MSRs written back at @level */
+static void kvm_fill_msrs(X86CPU *cpu, int level)
 {
     CPUX86State *env = &cpu->env;
     int i;
-    int ret;
 
     kvm_msr_buf_reset(cpu);
 
@@ -1673,6 +1825,10 @@ static int kvm_put_msrs(X86CPU *cpu, int level)
         if (env->features[FEAT_KVM] & (1 << KVM_FEATURE_STEAL_TIME)) {
             kvm_msr_entry_add(cpu, MSR_KVM_STEAL_TIME, env->steal_time_msr);
         }
+        if (env->features[FEAT_KVM] & (1 << KVM_FEATURE_POLL_CONTROL)) {
+            kvm_msr_entry_add(cpu, MSR_KVM_POLL_CONTROL,
+                              env->poll_control_msr);
+        }
         if (has_architectural_pmu_version > 0) {
             if (has_architectural_pmu_version > 1) {
                 /* Stop the counter.  */
@@ -1828,9 +1984,56 @@ static int kvm_put_msrs(X86CPU *cpu, int level)
             kvm_msr_entry_add(cpu, MSR_MC0_CTL + i, env->mce_banks[i]);
         }
     }
+}
+
+/*
+ * Drop the entries of a runtime writeback that match the cached image and
+ * record the others in it.  Returns the number of entries left to write.
+ */
+static int kvm_msr_buf_drop_cached(X86CPU *cpu)
+{
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
+    struct kvm_msrs *msrs = cpu->kvm_msr_buf;
+    struct kvm_msr_entry *image = cache->msrs->entries;
+    int i, n = 0;
+
+    if (!(cache->valid & KVM_REG_CACHE_MSRS) ||
+        cache->msrs->nmsrs != msrs->nmsrs) {
+        kvm_reg_cache_store(cpu, KVM_REG_CACHE_MSRS, cache->msrs, msrs,
+                            MSR_BUF_SIZE);
+        return msrs->nmsrs;
+    }
+
+    for (i = 0; i < msrs->nmsrs; i++) {
+        if (image[i].index == msrs->entries[i].index &&
+            image[i].data == msrs->entries[i].data) {
+            continue;
+        }
+        image[i] = msrs->entries[i];
+        msrs->entries[n++] = msrs->entries[i];
+    }
+    msrs->nmsrs = n;
+    return n;
+}
+
+static int kvm_put_msrs(X86CPU *cpu, int level)
+{
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
+    int ret;
+
+    kvm_fill_msrs(cpu, level);
+    if (level == KVM_PUT_RUNTIME_STATE) {
+        if (!kvm_msr_buf_drop_cached(cpu)) {
+            return 0;
+        }
+    } else {
+        /* The image only covers the runtime set of MSRs */
+        cache->valid &= ~KVM_REG_CACHE_MSRS;
+    }
 
     ret = kvm_vcpu_ioctl(CPU(cpu), KVM_SET_MSRS, cpu->kvm_msr_buf);
     if (ret < 0) {
+        cache->valid &= ~KVM_REG_CACHE_MSRS;
         return ret;
     }
 
@@ -1891,6 +2094,9 @@ static int kvm_get_xsave(X86CPU *cpu)
     }
     x86_cpu_xrstor_all_areas(cpu, xsave);
 
+    x86_cpu_xsave_all_areas(cpu, xsave);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_XSAVE, cpu->kvm_reg_cache->xsave,
+                        xsave, sizeof(struct kvm_xsave));
     return 0;
 }
 
@@ -1916,18 +2122,27 @@ static int kvm_get_xcrs(X86CPU *cpu)
             break;
         }
     }
+
+    kvm_fill_xcrs(cpu, &xcrs);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_XCRS, &cpu->kvm_reg_cache->xcrs,
+                        &xcrs, sizeof(xcrs));
     return 0;
 }
 
 static int kvm_get_sregs(X86CPU *cpu)
 {
     CPUX86State *env = &cpu->env;
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
     struct kvm_sregs sregs;
     int bit, i, ret;
 
-    ret = kvm_vcpu_ioctl(CPU(cpu), KVM_GET_SREGS, &sregs);
-    if (ret < 0) {
-        return ret;
+    if (cache->sync_regs_valid) {
+        sregs = CPU(cpu)->kvm_run->s.regs.sregs;
+    } else {
+        ret = kvm_vcpu_ioctl(CPU(cpu), KVM_GET_SREGS, &sregs);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     /* There can only be one pending IRQ set in the bitmap at a time, so try
@@ -1966,6 +2181,9 @@ static int kvm_get_sregs(X86CPU *cpu)
     /* changes to apic base and cr8/tpr are read back via kvm_arch_post_run */
     x86_update_hflags(env);
 
+    kvm_fill_sregs(cpu, &sregs);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_SREGS, &cache->sregs,
+                        &sregs, sizeof(sregs));
     return 0;
 }
 
@@ -2038,6 +2256,9 @@ static int kvm_get_msrs(X86CPU *cpu)
     if (env->features[FEAT_KVM] & (1 << KVM_FEATURE_STEAL_TIME)) {
         kvm_msr_entry_add(cpu, MSR_KVM_STEAL_TIME, 0);
     }
+    if (env->features[FEAT_KVM] & (1 << KVM_FEATURE_POLL_CONTROL)) {
+        kvm_msr_entry_add(cpu, MSR_KVM_POLL_CONTROL, 0);
+    }
     if (has_architectural_pmu_version > 0) {
         if (has_architectural_pmu_version > 1) {
             kvm_msr_entry_add(cpu, MSR_CORE_PERF_FIXED_CTR_CTRL, 0);
@@ -2261,6 +2482,9 @@ static int kvm_get_msrs(X86CPU *cpu)
         case MSR_KVM_STEAL_TIME:
             env->steal_time_msr = msrs[i].data;
             break;
+        case MSR_KVM_POLL_CONTROL:
+            env->poll_control_msr = msrs[i].data;
+            break;
         case MSR_CORE_PERF_FIXED_CTR_CTRL:
             env->msr_fixed_ctr_ctrl = msrs[i].data;
             break;
@@ -2394,6 +2618,13 @@ static int kvm_get_msrs(X86CPU *cpu)
         }
     }
 
+    kvm_fill_msrs(cpu, KVM_PUT_RUNTIME_STATE);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_MSRS, cpu->kvm_reg_cache->msrs,
+                        cpu->kvm_msr_buf, MSR_BUF_SIZE);
+    if (has_msr_tsc_deadline) {
+        cpu->kvm_reg_cache->tsc_deadline = env->tsc_deadline;
+        cpu->kvm_reg_cache->valid |= KVM_REG_CACHE_TSC_DEADLINE;
+    }
     return 0;
 }
 
@@ -2439,15 +2670,12 @@ static int kvm_get_apic(X86CPU *cpu)
     return 0;
 }
 
-static int kvm_put_vcpu_events(X86CPU *cpu, int level)
+static void kvm_fill_vcpu_events(X86CPU *cpu, struct kvm_vcpu_events *out,
+                                 int level)
 {
     CPUX86State *env = &cpu->env;
     struct kvm_vcpu_events events = {};
 
-    if (!kvm_has_vcpu_events()) {
-        return 0;
-    }
-
     events.exception.injected = (env->exception_injected >= 0);
     events.exception.nr = env->exception_injected;
     events.exception.has_error_code = env->has_error_code;
@@ -2473,12 +2701,27 @@ static int kvm_put_vcpu_events(X86CPU *cpu, int level)
         }
     }
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_VCPU_EVENTS, &events);
+    *out = events;
+}
+
+static int kvm_put_vcpu_events(X86CPU *cpu, int level)
+{
+    struct kvm_vcpu_events events;
+
+    if (!kvm_has_vcpu_events()) {
+        return 0;
+    }
+
+    kvm_fill_vcpu_events(cpu, &events, level);
+    return kvm_put_reg_class(cpu, level, KVM_REG_CACHE_EVENTS,
+                             KVM_SET_VCPU_EVENTS, &cpu->kvm_reg_cache->events,
+                             &events, sizeof(events));
 }
 
 static int kvm_get_vcpu_events(X86CPU *cpu)
 {
     CPUX86State *env = &cpu->env;
+    X86KVMRegCache *cache = cpu->kvm_reg_cache;
     struct kvm_vcpu_events events;
     int ret;
 
@@ -2486,10 +2729,14 @@ static int kvm_get_vcpu_events(X86CPU *cpu)
         return 0;
     }
 
-    memset(&events, 0, sizeof(events));
-    ret = kvm_vcpu_ioctl(CPU(cpu), KVM_GET_VCPU_EVENTS, &events);
-    if (ret < 0) {
-       return ret;
+    if (cache->sync_regs_valid) {
+        events = CPU(cpu)->kvm_run->s.regs.events;
+    } else {
+        memset(&events, 0, sizeof(events));
+        ret = kvm_vcpu_ioctl(CPU(cpu), KVM_GET_VCPU_EVENTS, &events);
+        if (ret < 0) {
+            return ret;
+        }
     }
     env->exception_injected =
        events.exception.injected ? events.exception.nr : -1;
@@ -2510,6 +2757,9 @@ static int kvm_get_vcpu_events(X86CPU *cpu)
 
     env->sipi_vector = events.sipi_vector;
 
+    kvm_fill_vcpu_events(cpu, &events, KVM_PUT_RUNTIME_STATE);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_EVENTS, &cache->events,
+                        &events, sizeof(events));
     return 0;
 }
 
@@ -2544,24 +2794,32 @@ static int kvm_guest_debug_workarounds(X86CPU *cpu)
     return ret;
 }
 
-static int kvm_put_debugregs(X86CPU *cpu)
+static void kvm_fill_debugregs(X86CPU *cpu, struct kvm_debugregs *dbgregs)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_debugregs dbgregs;
     int i;
 
-    if (!kvm_has_debugregs()) {
-        return 0;
+    memset(dbgregs, 0, sizeof(*dbgregs));
+    for (i = 0; i < 4; i++) {
+        dbgregs->db[i] = env->dr[i];
     }
+    dbgregs->dr6 = env->dr[6];
+    dbgregs->dr7 = env->dr[7];
+    dbgregs->flags = 0;
+}
 
-    for (i = 0; i < 4; i++) {
-        dbgregs.db[i] = env->dr[i];
+static int kvm_put_debugregs(X86CPU *cpu, int level)
+{
+    struct kvm_debugregs dbgregs;
+
+    if (!kvm_has_debugregs()) {
+        return 0;
     }
-    dbgregs.dr6 = env->dr[6];
-    dbgregs.dr7 = env->dr[7];
-    dbgregs.flags = 0;
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_DEBUGREGS, &dbgregs);
+    kvm_fill_debugregs(cpu, &dbgregs);
+    return kvm_put_reg_class(cpu, level, KVM_REG_CACHE_DEBUGREGS,
+                             KVM_SET_DEBUGREGS, &cpu->kvm_reg_cache->dbgregs,
+                             &dbgregs, sizeof(dbgregs));
 }
 
 static int kvm_get_debugregs(X86CPU *cpu)
@@ -2584,6 +2842,10 @@ static int kvm_get_debugregs(X86CPU *cpu)
     env->dr[4] = env->dr[6] = dbgregs.dr6;
     env->dr[5] = env->dr[7] = dbgregs.dr7;
 
+    kvm_fill_debugregs(cpu, &dbgregs);
+    kvm_reg_cache_store(cpu, KVM_REG_CACHE_DEBUGREGS,
+                        &cpu->kvm_reg_cache->dbgregs, &dbgregs,
+                        sizeof(dbgregs));
     return 0;
 }
 
@@ -2594,6 +2856,12 @@ int kvm_arch_put_registers(CPUState *cpu, int level)
 
     assert(cpu_is_stopped(cpu) || qemu_cpu_is_self(cpu));
 
+    /*
+     * Whatever goes through the SET ioctls below leaves the kvm_run copy
+     * behind; the next exit refreshes it.
+     */
+    x86_cpu->kvm_reg_cache->sync_regs_valid = false;
+
     if (level >= KVM_PUT_RESET_STATE) {
         ret = kvm_put_msr_feature_control(x86_cpu);
         if (ret < 0) {
@@ -2610,19 +2878,19 @@ int kvm_arch_put_registers(CPUState *cpu, int level)
         kvm_arch_set_tsc_khz(cpu);
     }
 
-    ret = kvm_getput_regs(x86_cpu, 1);
+    ret = kvm_getput_regs(x86_cpu, 1, level);
     if (ret < 0) {
         return ret;
     }
-    ret = kvm_put_xsave(x86_cpu);
+    ret = kvm_put_xsave(x86_cpu, level);
     if (ret < 0) {
         return ret;
     }
-    ret = kvm_put_xcrs(x86_cpu);
+    ret = kvm_put_xcrs(x86_cpu, level);
     if (ret < 0) {
         return ret;
     }
-    ret = kvm_put_sregs(x86_cpu);
+    ret = kvm_put_sregs(x86_cpu, level);
     if (ret < 0) {
         return ret;
     }
@@ -2646,11 +2914,11 @@ int kvm_arch_put_registers(CPUState *cpu, int level)
         }
     }
 
-    ret = kvm_put_tscdeadline_msr(x86_cpu);
+    ret = kvm_put_tscdeadline_msr(x86_cpu, level);
     if (ret < 0) {
         return ret;
     }
-    ret = kvm_put_debugregs(x86_cpu);
+    ret = kvm_put_debugregs(x86_cpu, level);
     if (ret < 0) {
         return ret;
     }
@@ -2681,7 +2949,7 @@ int kvm_arch_get_registers(CPUState *cs)
     if (ret < 0) {
         goto out;
     }
-    ret = kvm_getput_regs(cpu, 0);
+    ret = kvm_getput_regs(cpu, 0, 0);
     if (ret < 0) {
         goto out;
     }
@@ -2756,6 +3024,9 @@ MemTxAttrs kvm_arch_post_run(CPUState *cpu, struct kvm_run *run)
     X86CPU *x86_cpu = X86_CPU(cpu);
     CPUX86State *env = &x86_cpu->env;
 
+    x86_cpu->kvm_reg_cache->valid = 0;
+    x86_cpu->kvm_reg_cache->sync_regs_valid = has_sync_regs;
+
     if (run->flags & KVM_RUN_X86_SMM) {
         env->hflags |= HF_SMM_MASK;
     } else {
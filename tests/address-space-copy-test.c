@@ -0,0 +1,130 @@
+/*
+ * QTest testcase for address_space_copy()
+ *
+ * Copies between overlapping ranges of guest RAM, and across the end of
+ * RAM into the BAR of a PCI device placed right above it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+
+/* With -m 3G all of RAM is below 4G, and the PCI hole starts at its end */
+#define RAM_END         0xc0000000ULL
+#define BUF_ADDR        0x100000
+#define BUF_SIZE        512
+
+/* virtio-pci puts the common configuration at the start of BAR 4 */
+#define VIRTIO_PCI_MODERN_BAR   4
+#define DEVICE_FEATURE_SELECT   0
+
+static void fill_pattern(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = i * 7 + 3;
+    }
+}
+
+static void check_guest(uint64_t addr, const uint8_t *expected, size_t len)
+{
+    uint8_t *buf = g_malloc(len);
+
+    memread(addr, buf, len);
+    g_assert(memcmp(buf, expected, len) == 0);
+    g_free(buf);
+}
+
+static void test_copy_overlap(void)
+{
+    uint8_t ref[BUF_SIZE];
+
+    qtest_start("-m 3G");
+
+    fill_pattern(ref, sizeof(ref));
+    memwrite(BUF_ADDR, ref, sizeof(ref));
+
+    /* Destination above the source */
+    qmemcopy(BUF_ADDR + 16, BUF_ADDR, 256);
+    memmove(ref + 16, ref, 256);
+    check_guest(BUF_ADDR, ref, sizeof(ref));
+
+    /* Destination below the source */
+    qmemcopy(BUF_ADDR + 8, BUF_ADDR + 40, 300);
+    memmove(ref + 8, ref + 40, 300);
+    check_guest(BUF_ADDR, ref, sizeof(ref));
+
+    /* Same range */
+    qmemcopy(BUF_ADDR, BUF_ADDR, sizeof(ref));
+    check_guest(BUF_ADDR, ref, sizeof(ref));
+
+    qtest_end();
+}
+
+static void test_copy_mmio_boundary(void)
+{
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    QPCIBar bar;
+    uint8_t ref[8];
+    uint32_t val;
+
+    qtest_start("-m 3G -nodefaults "
+                "-device virtio-rng-pci,addr=4,disable-legacy=on");
+
+    bus = qpci_init_pc(global_qtest, NULL);
+    bus->mmio_alloc_ptr = RAM_END;
+    dev = qpci_device_find(bus, QPCI_DEVFN(4, 0));
+    g_assert(dev != NULL);
+    bar = qpci_iomap(dev, VIRTIO_PCI_MODERN_BAR, NULL);
+    g_assert_cmphex(bar.addr, ==, RAM_END);
+    qpci_device_enable(dev);
+
+    /* RAM to RAM and MMIO: the second half lands in the BAR */
+    fill_pattern(ref, 4);
+    val = cpu_to_le32(0x12345678);
+    memcpy(ref + 4, &val, 4);
+    memwrite(BUF_ADDR, ref, sizeof(ref));
+    qmemcopy(RAM_END - 4, BUF_ADDR, sizeof(ref));
+    check_guest(RAM_END - 4, ref, 4);
+    g_assert_cmphex(qpci_io_readl(dev, bar, DEVICE_FEATURE_SELECT), ==,
+                    0x12345678);
+
+    /* RAM and MMIO to RAM */
+    qpci_io_writel(dev, bar, DEVICE_FEATURE_SELECT, 0xabcd0042);
+    fill_pattern(ref, 4);
+    memwrite(RAM_END - 4, ref, 4);
+    qmemset(BUF_ADDR, 0, sizeof(ref));
+    qmemcopy(BUF_ADDR, RAM_END - 4, sizeof(ref));
+    val = cpu_to_le32(0xabcd0042);
+    memcpy(ref + 4, &val, 4);
+    check_guest(BUF_ADDR, ref, sizeof(ref));
+
+    /* MMIO only */
+    val = cpu_to_le32(0x55aa55aa);
+    memwrite(BUF_ADDR, &val, 4);
+    qmemcopy(RAM_END, BUF_ADDR, 4);
+    g_assert_cmphex(qpci_io_readl(dev, bar, DEVICE_FEATURE_SELECT), ==,
+                    0x55aa55aa);
+
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/address-space-copy/overlap", test_copy_overlap);
+    qtest_add_func("/address-space-copy/mmio-boundary",
+                   test_copy_mmio_boundary);
+
+    return g_test_run();
+}
@@ -950,6 +950,12 @@ void qtest_memset(QTestState *s, uint64_t addr, uint8_t pattern, size_t size)
     qtest_rsp(s, 0);
 }
 
+void qtest_memcopy(QTestState *s, uint64_t addr, uint64_t src, size_t size)
+{
+    qtest_sendf(s, "copy 0x%" PRIx64 " 0x%" PRIx64 " 0x%zx\n", addr, src, size);
+    qtest_rsp(s, 0);
+}
+
 QDict *qmp(const char *fmt, ...)
 {
     va_list ap;
@@ -423,6 +423,18 @@ void qtest_bufwrite(QTestState *s, uint64_t addr,
  */
 void qtest_memset(QTestState *s, uint64_t addr, uint8_t patt, size_t size);
 
+/**
+ * qtest_memcopy:
+ * @s: #QTestState instance to operate on.
+ * @addr: Guest address to write to.
+ * @src: Guest address to read from.
+ * @size: Number of bytes to copy.
+ *
+ * Copy guest memory with address_space_copy().  The two ranges may
+ * overlap.
+ */
+void qtest_memcopy(QTestState *s, uint64_t addr, uint64_t src, size_t size);
+
 /**
  * qtest_clock_step_next:
  * @s: #QTestState instance to operate on.
@@ -901,6 +913,20 @@ static inline void qmemset(uint64_t addr, uint8_t patt, size_t size)
     qtest_memset(global_qtest, addr, patt, size);
 }
 
+/**
+ * qmemcopy:
+ * @addr: Guest address to write to.
+ * @src: Guest address to read from.
+ * @size: Number of bytes to copy.
+ *
+ * Copy guest memory with address_space_copy().  The two ranges may
+ * overlap.
+ */
+static inline void qmemcopy(uint64_t addr, uint64_t src, size_t size)
+{
+    qtest_memcopy(global_qtest, addr, src, size);
+}
+
 /**
  * clock_step_next:
  *
@@ -0,0 +1,142 @@
+/*
+ * MMIO dispatch microbenchmark
+ *
+ * Reads the BARs of a few PCI devices through the qtest "read" command,
+ * which goes through address_space_rw() one MMIO access at a time, both
+ * linearly and hopping from device to device.  Run with "-m perf" to
+ * print the cost per access.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define NR_DEVS         8
+#define DEV_SLOT_BASE   3
+
+/* virtio-pci puts the common configuration at the start of BAR 4 */
+#define VIRTIO_PCI_MODERN_BAR   4
+#define DEVICE_FEATURE_SELECT   0
+
+typedef struct DispatchBench {
+    QPCIBus *bus;
+    QPCIDevice *devs[NR_DEVS];
+    QPCIBar bars[NR_DEVS];
+    uint64_t bar_size;
+} DispatchBench;
+
+static void dispatch_bench_start(DispatchBench *b)
+{
+    GString *cmdline = g_string_new("-nodefaults");
+    int i;
+
+    for (i = 0; i < NR_DEVS; i++) {
+        g_string_append_printf(cmdline, " -device virtio-rng-pci,addr=%d,"
+                               "disable-legacy=on", DEV_SLOT_BASE + i);
+    }
+    qtest_start(cmdline->str);
+    g_string_free(cmdline, true);
+
+    b->bus = qpci_init_pc(global_qtest, NULL);
+    for (i = 0; i < NR_DEVS; i++) {
+        b->devs[i] = qpci_device_find(b->bus, QPCI_DEVFN(DEV_SLOT_BASE + i, 0));
+        g_assert(b->devs[i] != NULL);
+        b->bars[i] = qpci_iomap(b->devs[i], VIRTIO_PCI_MODERN_BAR,
+                                &b->bar_size);
+        qpci_device_enable(b->devs[i]);
+        qpci_io_writel(b->devs[i], b->bars[i], DEVICE_FEATURE_SELECT, i);
+    }
+
+    /* BARs are all the same size, so they are allocated back to back */
+    for (i = 1; i < NR_DEVS; i++) {
+        g_assert_cmphex(b->bars[i].addr, ==, b->bars[0].addr + i * b->bar_size);
+    }
+}
+
+static void dispatch_bench_stop(DispatchBench *b)
+{
+    int i;
+
+    for (i = 0; i < NR_DEVS; i++) {
+        g_free(b->devs[i]);
+    }
+    qpci_free_pc(b->bus);
+    qtest_end();
+}
+
+static void test_mmio_dispatch(void)
+{
+    DispatchBench b;
+    uint32_t *buf;
+    int i;
+
+    dispatch_bench_start(&b);
+
+    buf = g_malloc(NR_DEVS * b.bar_size);
+    memread(b.bars[0].addr, buf, NR_DEVS * b.bar_size);
+    for (i = 0; i < NR_DEVS; i++) {
+        g_assert_cmpint(le32_to_cpu(buf[i * b.bar_size / 4]), ==, i);
+        g_assert_cmpint(qpci_io_readl(b.devs[i], b.bars[i],
+                                      DEVICE_FEATURE_SELECT), ==, i);
+    }
+    g_free(buf);
+
+    dispatch_bench_stop(&b);
+}
+
+static void bench_mmio_dispatch(void)
+{
+    DispatchBench b;
+    int rounds = 100;
+    uint64_t accesses;
+    uint32_t *buf;
+    double elapsed;
+    int i, r;
+
+    dispatch_bench_start(&b);
+    buf = g_malloc(NR_DEVS * b.bar_size);
+
+    /* Linear: one read command, one dispatch every 4 bytes */
+    g_test_timer_start();
+    for (r = 0; r < rounds; r++) {
+        memread(b.bars[0].addr, buf, NR_DEVS * b.bar_size);
+    }
+    elapsed = g_test_timer_elapsed();
+    accesses = (uint64_t)rounds * NR_DEVS * b.bar_size / 4;
+    g_test_message("linear: %.1f ns per MMIO access", elapsed * 1e9 / accesses);
+    g_test_minimized_result(elapsed * 1e9 / accesses,
+                            "linear MMIO access, ns");
+
+    /* Interleaved: every read hits a different device */
+    g_test_timer_start();
+    for (r = 0; r < rounds * 10; r++) {
+        for (i = 0; i < NR_DEVS; i++) {
+            qpci_io_readl(b.devs[i], b.bars[i], DEVICE_FEATURE_SELECT);
+        }
+    }
+    elapsed = g_test_timer_elapsed();
+    accesses = (uint64_t)rounds * 10 * NR_DEVS;
+    g_test_message("interleaved: %.1f us per read command (incl. qtest)",
+                   elapsed * 1e6 / accesses);
+
+    g_free(buf);
+    dispatch_bench_stop(&b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/mmio-dispatch/read", test_mmio_dispatch);
+    if (g_test_perf()) {
+        qtest_add_func("/mmio-dispatch/bench", bench_mmio_dispatch);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,175 @@
+/*
+ * PCI BAR remapping test and benchmark
+ *
+ * Toggles the memory decode bit of many PCI devices, each one causing a
+ * memory transaction that moves a BAR in or out of the system FlatView.
+ * Run with "-m perf" to time 500 devices behind 16 PCI bridges.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+#define DEVS_PER_BRIDGE     32
+#define BRIDGE_SLOT_BASE    3
+#define BRIDGE_WINDOW_ALIGN (1 << 20)
+
+/* virtio-pci puts the common configuration at the start of BAR 4 */
+#define VIRTIO_PCI_MODERN_BAR   4
+#define DEVICE_FEATURE_SELECT   0
+
+typedef struct BarBench {
+    QPCIBus *bus;
+    int nr_devs;
+    QPCIDevice **devs;
+    QPCIBar *bars;
+} BarBench;
+
+static void bar_bench_start(BarBench *b, int nr_devs)
+{
+    int nr_bridges = DIV_ROUND_UP(nr_devs, DEVS_PER_BRIDGE);
+    GString *cmdline = g_string_new("-nodefaults");
+    int i, j, n = 0;
+
+    for (i = 0; i < nr_bridges; i++) {
+        g_string_append_printf(cmdline, " -device pci-bridge,id=br%d,"
+                               "bus=pci.0,addr=%d,chassis_nr=%d,shpc=off",
+                               i, BRIDGE_SLOT_BASE + i, i + 1);
+    }
+    for (i = 0; i < nr_devs; i++) {
+        g_string_append_printf(cmdline, " -device virtio-rng-pci,bus=br%d,"
+                               "addr=%d,disable-legacy=on",
+                               i / DEVS_PER_BRIDGE, i % DEVS_PER_BRIDGE);
+    }
+    qtest_start(cmdline->str);
+    g_string_free(cmdline, true);
+
+    b->bus = qpci_init_pc(global_qtest, NULL);
+    b->nr_devs = nr_devs;
+    b->devs = g_new0(QPCIDevice *, nr_devs);
+    b->bars = g_new0(QPCIBar, nr_devs);
+
+    for (i = 0; i < nr_bridges; i++) {
+        QPCIDevice *bridge;
+        uint64_t base, limit;
+
+        bridge = qpci_device_find(b->bus, QPCI_DEVFN(BRIDGE_SLOT_BASE + i, 0));
+        g_assert(bridge != NULL);
+        qpci_config_writeb(bridge, PCI_PRIMARY_BUS, 0);
+        qpci_config_writeb(bridge, PCI_SECONDARY_BUS, i + 1);
+        qpci_config_writeb(bridge, PCI_SUBORDINATE_BUS, i + 1);
+
+        b->bus->mmio_alloc_ptr = QEMU_ALIGN_UP(b->bus->mmio_alloc_ptr,
+                                               BRIDGE_WINDOW_ALIGN);
+        base = b->bus->mmio_alloc_ptr;
+        for (j = 0; j < DEVS_PER_BRIDGE && n < nr_devs; j++, n++) {
+            /* Bus number goes in bits 8-15 of the configuration address */
+            b->devs[n] = qpci_device_find(b->bus,
+                                          ((i + 1) << 8) | QPCI_DEVFN(j, 0));
+            g_assert(b->devs[n] != NULL);
+            b->bars[n] = qpci_iomap(b->devs[n], VIRTIO_PCI_MODERN_BAR, NULL);
+            qpci_device_enable(b->devs[n]);
+        }
+        limit = QEMU_ALIGN_UP(b->bus->mmio_alloc_ptr, BRIDGE_WINDOW_ALIGN) - 1;
+
+        qpci_config_writew(bridge, PCI_PREF_MEMORY_BASE,
+                           (base >> 16) & PCI_PREF_RANGE_MASK);
+        qpci_config_writew(bridge, PCI_PREF_MEMORY_LIMIT,
+                           (limit >> 16) & PCI_PREF_RANGE_MASK);
+        qpci_device_enable(bridge);
+        g_free(bridge);
+    }
+}
+
+static void bar_bench_stop(BarBench *b)
+{
+    int i;
+
+    for (i = 0; i < b->nr_devs; i++) {
+        g_free(b->devs[i]);
+    }
+    g_free(b->devs);
+    g_free(b->bars);
+    qpci_free_pc(b->bus);
+    qtest_end();
+}
+
+static void bar_bench_toggle(BarBench *b, int i)
+{
+    uint16_t cmd = qpci_config_readw(b->devs[i], PCI_COMMAND);
+
+    qpci_config_writew(b->devs[i], PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+    qpci_config_writew(b->devs[i], PCI_COMMAND, cmd);
+}
+
+static void test_bar_remap(void)
+{
+    BarBench b;
+    uint16_t cmd;
+    int i;
+
+    bar_bench_start(&b, 2 * DEVS_PER_BRIDGE);
+
+    for (i = 0; i < b.nr_devs; i++) {
+        qpci_io_writel(b.devs[i], b.bars[i], DEVICE_FEATURE_SELECT, 1);
+    }
+
+    for (i = 0; i < b.nr_devs; i++) {
+        cmd = qpci_config_readw(b.devs[i], PCI_COMMAND);
+        qpci_config_writew(b.devs[i], PCI_COMMAND, cmd & ~PCI_COMMAND_MEMORY);
+        g_assert_cmpint(qpci_io_readl(b.devs[i], b.bars[i],
+                                      DEVICE_FEATURE_SELECT), ==, 0);
+        if (i) {
+            /* Neighbours must not be affected */
+            g_assert_cmpint(qpci_io_readl(b.devs[i - 1], b.bars[i - 1],
+                                          DEVICE_FEATURE_SELECT), ==, 1);
+        }
+        qpci_config_writew(b.devs[i], PCI_COMMAND, cmd);
+        g_assert_cmpint(qpci_io_readl(b.devs[i], b.bars[i],
+                                      DEVICE_FEATURE_SELECT), ==, 1);
+    }
+
+    bar_bench_stop(&b);
+}
+
+static void bench_bar_remap(void)
+{
+    BarBench b;
+    int rounds = 10;
+    double elapsed;
+    int i, r;
+
+    bar_bench_start(&b, 500);
+
+    g_test_timer_start();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < b.nr_devs; i++) {
+            bar_bench_toggle(&b, i);
+        }
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("%d devices: %.1f us per BAR unmap+map",
+                   b.nr_devs, elapsed * 1e6 / (rounds * b.nr_devs));
+    g_test_minimized_result(elapsed * 1e6 / (rounds * b.nr_devs),
+                            "BAR unmap+map, us");
+
+    bar_bench_stop(&b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/pci-bar/remap", test_bar_remap);
+    if (g_test_perf()) {
+        qtest_add_func("/pci-bar/bench", bench_bar_remap);
+    }
+
+    return g_test_run();
+}
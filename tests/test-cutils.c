@@ -2168,6 +2168,34 @@ static void test_qemu_strtosz_metric(void)
     g_assert(endptr == str + 6);
 }
 
+static void test_memcpy_nontemporal(void)
+{
+    /* Odd sizes and offsets, so the copies have unaligned heads and tails */
+    const size_t sizes[] = { 0, 3, 63, 64, 65, 300 * 1024 + 7 };
+    size_t sz = 512 * 1024, i, j, off;
+    unsigned char *src = g_malloc(sz);
+    unsigned char *dst = g_malloc(sz);
+
+    for (i = 0; i < sz; i++) {
+        src[i] = i * 7 + (i >> 8);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        for (off = 0; off < 40; off += 13) {
+            memset(dst, 0, sz);
+            qemu_memcpy_nontemporal(dst + off, src + 2 * off, sizes[i]);
+            g_assert(memcmp(dst + off, src + 2 * off, sizes[i]) == 0);
+            for (j = 0; j < off; j++) {
+                g_assert_cmpint(dst[j], ==, 0);
+            }
+            g_assert_cmpint(dst[off + sizes[i]], ==, 0);
+        }
+    }
+
+    g_free(src);
+    g_free(dst);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -2445,5 +2473,7 @@ int main(int argc, char **argv)
     g_test_add_func("/cutils/strtosz/metric",
                     test_qemu_strtosz_metric);
 
+    g_test_add_func("/cutils/memcpy/nontemporal", test_memcpy_nontemporal);
+
     return g_test_run();
 }
@@ -59,6 +59,7 @@
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 #define VHOST_USER_PROTOCOL_F_MQ 0
 #define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
+#define VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS 15
 
 #define VHOST_LOG_PAGE 0x1000
 
@@ -82,6 +83,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_PROTOCOL_FEATURES = 16,
     VHOST_USER_GET_QUEUE_NUM = 17,
     VHOST_USER_SET_VRING_ENABLE = 18,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 36,
+    VHOST_USER_ADD_MEM_REG = 37,
+    VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -98,6 +102,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -117,6 +126,7 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
     } payload;
 } QEMU_PACKED VhostUserMsg;
@@ -157,6 +167,8 @@ typedef struct TestServer {
     bool test_fail;
     int test_flags;
     int queues;
+    bool mem_slots;
+    int mem_regs_removed;
     QGuestAllocator *alloc;
 } TestServer;
 
@@ -317,7 +329,7 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
     CharBackend *chr = &s->chr;
     VhostUserMsg msg;
     uint8_t *p = (uint8_t *) &msg;
-    int fd;
+    int fd, i;
 
     if (s->test_fail) {
         qemu_chr_fe_disconnect(chr);
@@ -378,6 +390,9 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         if (s->queues > 1) {
             msg.payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_MQ;
         }
+        if (s->mem_slots) {
+            msg.payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+        }
         p = (uint8_t *) &msg;
         qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
         break;
@@ -404,6 +419,40 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         g_cond_signal(&s->data_cond);
         break;
 
+    case VHOST_USER_GET_MAX_MEM_SLOTS:
+        msg.flags |= VHOST_USER_REPLY_MASK;
+        msg.size = sizeof(m.payload.u64);
+        msg.payload.u64 = VHOST_MEMORY_MAX_NREGIONS;
+        p = (uint8_t *) &msg;
+        qemu_chr_fe_write_all(chr, p, VHOST_USER_HDR_SIZE + msg.size);
+        break;
+
+    case VHOST_USER_ADD_MEM_REG:
+        g_assert_cmpint(s->fds_num, <, VHOST_MEMORY_MAX_NREGIONS);
+        s->memory.regions[s->fds_num] = msg.payload.mem_reg.region;
+        g_assert_cmpint(qemu_chr_fe_get_msgfds(chr, &s->fds[s->fds_num], 1),
+                        ==, 1);
+        s->memory.nregions = ++s->fds_num;
+
+        g_cond_signal(&s->data_cond);
+        break;
+
+    case VHOST_USER_REM_MEM_REG:
+        for (i = 0; i < s->fds_num; i++) {
+            if (s->memory.regions[i].guest_phys_addr ==
+                msg.payload.mem_reg.region.guest_phys_addr) {
+                break;
+            }
+        }
+        g_assert_cmpint(i, <, s->fds_num);
+        close(s->fds[i]);
+        s->fds_num--;
+        s->fds[i] = s->fds[s->fds_num];
+        s->memory.regions[i] = s->memory.regions[s->fds_num];
+        s->memory.nregions = s->fds_num;
+        s->mem_regs_removed++;
+        break;
+
     case VHOST_USER_SET_VRING_KICK:
     case VHOST_USER_SET_VRING_CALL:
         /* consume the fd */
@@ -686,6 +735,68 @@ static void test_read_guest_mem(const void *arg)
     test_server_free(server);
 }
 
+static void wait_for_mem_regions(TestServer *s, int nregions)
+{
+    gint64 end_time;
+
+    g_mutex_lock(&s->data_mutex);
+    end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+    while (s->memory.nregions != nregions) {
+        if (!g_cond_wait_until(&s->data_cond, &s->data_mutex, end_time)) {
+            /* timeout has passed */
+            g_assert_cmpint(s->memory.nregions, ==, nregions);
+            break;
+        }
+    }
+
+    g_mutex_unlock(&s->data_mutex);
+}
+
+static void test_mem_slots(void)
+{
+    TestServer *server = test_server_new("mem-slots");
+    char *qemu_cmd;
+    QDict *rsp;
+    int nregions;
+
+    server->mem_slots = true;
+    test_server_listen(server);
+
+    qemu_cmd = get_qemu_cmd(server, 256, TEST_MEMFD_NO, root, "",
+                            " -m 256,slots=2,maxmem=1G");
+    qtest_start(qemu_cmd);
+    g_free(qemu_cmd);
+
+    init_virtio_dev(server, 1u << VIRTIO_NET_F_MAC);
+    read_guest_mem_server(server);
+    nregions = server->memory.nregions;
+
+    /* Hotplugging a DIMM must add one region and leave the others alone */
+    qemu_cmd = g_strdup_printf("{ 'execute': 'object-add', 'arguments': {"
+                               " 'qom-type': 'memory-backend-file',"
+                               " 'id': 'mem1', 'props': { 'size': %d,"
+                               " 'mem-path': '%s', 'share': true } } }",
+                               128 << 20, root);
+    rsp = qmp(qemu_cmd);
+    g_free(qemu_cmd);
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    rsp = qmp("{ 'execute': 'device_add', 'arguments': {"
+              " 'driver': 'pc-dimm', 'id': 'dimm1', 'memdev': 'mem1' } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    wait_for_mem_regions(server, nregions + 1);
+    g_assert_cmpint(server->mem_regs_removed, ==, 0);
+    read_guest_mem_server(server);
+
+    uninit_virtio_dev(server);
+
+    qtest_end();
+    test_server_free(server);
+}
+
 static void test_migrate(void)
 {
     TestServer *s = test_server_new("src");
@@ -918,15 +1029,9 @@ static void test_flags_mismatch(void)
 
 #endif
 
-static void test_multiqueue(void)
+static void multiqueue_start(TestServer *s)
 {
-    TestServer *s = test_server_new("mq");
     char *cmd;
-    uint32_t features_mask = ~(QVIRTIO_F_BAD_FEATURE |
-                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
-                            (1u << VIRTIO_RING_F_EVENT_IDX));
-    s->queues = 2;
-    test_server_listen(s);
 
     if (qemu_memfd_check()) {
         cmd = g_strdup_printf(
@@ -945,6 +1050,17 @@ static void test_multiqueue(void)
     }
     qtest_start(cmd);
     g_free(cmd);
+}
+
+static void test_multiqueue(void)
+{
+    TestServer *s = test_server_new("mq");
+    uint32_t features_mask = ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX));
+    s->queues = 2;
+    test_server_listen(s);
+    multiqueue_start(s);
 
     init_virtio_dev(s, features_mask);
 
@@ -957,6 +1073,39 @@ static void test_multiqueue(void)
     test_server_free(s);
 }
 
+/*
+ * Without VIRTIO_NET_F_MQ, virtio-net deletes the second queue pair after
+ * the driver has set it up.  A kick for one of those queues must be ignored.
+ */
+static void test_multiqueue_deleted_kick(void)
+{
+    TestServer *s = test_server_new("mq-del");
+    uint32_t features_mask = ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_NET_F_MQ));
+    QDict *rsp;
+
+    s->queues = 2;
+    test_server_listen(s);
+    multiqueue_start(s);
+
+    init_virtio_dev(s, features_mask);
+
+    wait_for_rings_started(s, 2);
+
+    qvirtqueue_kick(&s->dev->vdev, s->vq[3], 0);
+    rsp = qmp("{ 'execute': 'query-status' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QDECREF(rsp);
+
+    uninit_virtio_dev(s);
+
+    qtest_end();
+
+    test_server_free(s);
+}
+
 int main(int argc, char **argv)
 {
     const char *hugefs;
@@ -995,8 +1144,11 @@ int main(int argc, char **argv)
     }
     qtest_add_data_func("/vhost-user/read-guest-mem/memfile",
                         GINT_TO_POINTER(TEST_MEMFD_NO), test_read_guest_mem);
+    qtest_add_func("/vhost-user/mem-slots", test_mem_slots);
     qtest_add_func("/vhost-user/migrate", test_migrate);
     qtest_add_func("/vhost-user/multiqueue", test_multiqueue);
+    qtest_add_func("/vhost-user/multiqueue/deleted-kick",
+                   test_multiqueue_deleted_kick);
 
 #if defined(CONFIG_HAS_GLIB_SUBPROCESS_TESTS)
     /* keeps failing on build-system since Aug 15 2017 */
@@ -15,6 +15,9 @@
 #include "libqos/virtio-pci.h"
 #include "libqos/virtio-mmio.h"
 #include "libqos/malloc-generic.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/bswap.h"
 #include "standard-headers/linux/virtio_ids.h"
 #include "standard-headers/linux/virtio_config.h"
@@ -674,6 +677,138 @@ static void pci_hotplug(void)
     qtest_shutdown(qs);
 }
 
+/*
+ * Stop the VM while a request is still in flight: the drain in do_vm_stop()
+ * completes it after the device has seen the stop, and its interrupt must
+ * not be left behind in the coalescing timer.
+ */
+static void pci_coalesce_stop(void)
+{
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci;
+    QVirtioBlkReq req;
+    QDict *resp;
+    uint64_t req_addr;
+    uint32_t features;
+    uint32_t free_head;
+    uint8_t status;
+    const char *cmd = "-drive if=none,id=drive0,file.driver=null-co,"
+                      "file.latency-ns=200000000,format=raw "
+                      "-global virtio-blk-device.intr-coalesce-usecs=10000 "
+                      "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                      "addr=%x.%x";
+
+    qs = qtest_pc_boot(cmd, PCI_SLOT, PCI_FN);
+    global_qtest = qs->qts;
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(qs->alloc, &dev->vdev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(&vqpci->vq, req_addr, 16, false, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(&dev->vdev, &vqpci->vq, free_head);
+
+    resp = qmp("{ 'execute': 'stop' }");
+    QDECREF(resp);
+
+    /* The request was completed by the drain and signalled right away */
+    g_assert(qvirtqueue_get_buf(&vqpci->vq, NULL, NULL));
+    g_assert(dev->vdev.bus->get_queue_isr_status(&dev->vdev, &vqpci->vq));
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    resp = qmp("{ 'execute': 'cont' }");
+    QDECREF(resp);
+
+    /* End test */
+    guest_free(qs->alloc, req_addr);
+    qvirtqueue_cleanup(dev->vdev.bus, &vqpci->vq, qs->alloc);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+}
+
+static void pci_queue_status(void)
+{
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci;
+    QDict *resp, *status, *latency;
+    QList *list, *bins, *boundaries;
+    QListEntry *entry;
+    uint64_t completed, total = 0;
+
+    qs = pci_test_start();
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+
+    test_basic(&dev->vdev, qs->alloc, &vqpci->vq);
+
+    resp = qmp("{ 'execute': 'query-virtio-queue-status', 'arguments': {"
+               " 'path': '/machine/peripheral/drv0/virtio-backend' } }");
+    list = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(list), ==, 1);
+    status = qobject_to(QDict, qlist_peek(list));
+
+    /* Every request has completed */
+    completed = qdict_get_int(status, "completed");
+    g_assert_cmpint(completed, >, 0);
+    g_assert_cmpint(qdict_get_int(status, "popped"), ==, completed);
+    g_assert_cmpint(qdict_get_int(status, "inuse"), ==, 0);
+    g_assert_cmpint(qdict_get_int(status, "avail-idx"), ==, completed);
+    g_assert_cmpint(qdict_get_int(status, "used-idx"), ==, completed);
+    g_assert_cmpint(qdict_get_int(status, "kicks"), >, 0);
+    g_assert(qdict_haskey(status, "last-kick-ns"));
+
+    latency = qdict_get_qdict(status, "latency");
+    bins = qdict_get_qlist(latency, "bins");
+    boundaries = qdict_get_qlist(latency, "boundaries");
+    g_assert_cmpint(qlist_size(bins), ==, qlist_size(boundaries) + 1);
+    QLIST_FOREACH_ENTRY(bins, entry) {
+        total += qnum_get_uint(qobject_to(QNum, entry->value));
+    }
+    g_assert_cmpint(total, ==, completed);
+    QDECREF(resp);
+
+    /* virtio-blk has a single queue by default */
+    resp = qmp("{ 'execute': 'query-virtio-queue-status', 'arguments': {"
+               " 'path': '/machine/peripheral/drv0/virtio-backend',"
+               " 'queue': 1 } }");
+    g_assert(qdict_haskey(resp, "error"));
+    QDECREF(resp);
+
+    resp = qmp("{ 'execute': 'query-virtio-queue-status', 'arguments': {"
+               " 'path': '/machine/peripheral/drv0' } }");
+    g_assert(qdict_haskey(resp, "error"));
+    QDECREF(resp);
+
+    /* End test */
+    qvirtqueue_cleanup(dev->vdev.bus, &vqpci->vq, qs->alloc);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -748,6 +883,8 @@ int main(int argc, char **argv)
         qtest_add_func("/virtio/blk/pci/indirect", pci_indirect);
         qtest_add_func("/virtio/blk/pci/config", pci_config);
         qtest_add_func("/virtio/blk/pci/nxvirtq", test_nonexistent_virtqueue);
+        qtest_add_func("/virtio/blk/pci/queue-status", pci_queue_status);
+        qtest_add_func("/virtio/blk/pci/coalesce-stop", pci_coalesce_stop);
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
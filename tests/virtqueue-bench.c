@@ -0,0 +1,217 @@
+/*
+ * VirtQueueElement pool test and benchmark
+ *
+ * Sends reads to a virtio-blk device backed by null-co, each one through
+ * an indirect descriptor table so that it takes a single ring slot.  With
+ * a queue of 256 entries, the requests in flight can fill the element
+ * pool, which never holds more slots than the ring, while one request has
+ * more segments than the pool serves and is allocated with malloc.
+ * Run with "-m perf" to time pop+push at a few queue depths.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "libqos/libqos-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_ids.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "standard-headers/linux/virtio_blk.h"
+
+#define PCI_SLOT        0x04
+#define QUEUE_SIZE      256
+#define TIMEOUT_US      (30 * 1000 * 1000)
+
+#define REQ_HDR_SIZE    16
+#define SECTOR_SIZE     512
+
+/* virtio-blk pools elements of up to 128 segments; this one has 202 */
+#define BIG_REQ_SECTORS 200
+
+/* One request per ring slot, the last one is the big request */
+#define NR_REQS         QUEUE_SIZE
+#define NR_SMALL_REQS   (NR_REQS - 1)
+#define BIG_REQ         NR_SMALL_REQS
+
+static QOSState *qs;
+static QVirtioPCIDevice *dev;
+static QVirtQueue *vq;
+static uint16_t avail_idx;
+static uint16_t heads[NR_REQS];
+static uint64_t status[NR_REQS];
+
+/* A read of sector 0 into @sectors buffers of one sector each */
+static void add_read(int i, int sectors)
+{
+    QVRingIndirectDesc *indirect;
+    uint64_t req;
+    int j;
+
+    req = guest_alloc(qs->alloc, REQ_HDR_SIZE + sectors * SECTOR_SIZE + 1);
+    writeq(req, 0);
+    writeq(req + 8, 0);
+
+    indirect = qvring_indirect_desc_setup(&dev->vdev, qs->alloc, sectors + 2);
+    qvring_indirect_desc_add(indirect, req, REQ_HDR_SIZE, false);
+    for (j = 0; j < sectors; j++) {
+        qvring_indirect_desc_add(indirect, req + REQ_HDR_SIZE + j * SECTOR_SIZE,
+                                 SECTOR_SIZE, true);
+    }
+    status[i] = req + REQ_HDR_SIZE + sectors * SECTOR_SIZE;
+    qvring_indirect_desc_add(indirect, status[i], 1, true);
+
+    heads[i] = qvirtqueue_add_indirect(vq, indirect);
+    g_free(indirect);
+}
+
+static void blk_start(void)
+{
+    uint32_t features;
+    int i;
+
+    qs = qtest_pc_boot("-drive if=none,id=drive0,file=null-co://,format=raw "
+                       "-device virtio-blk-pci,drive=drive0,queue-size=%d,"
+                       "addr=%x.0", QUEUE_SIZE, PCI_SLOT);
+    global_qtest = qs->qts;
+
+    dev = qvirtio_pci_device_find_slot(qs->pcibus, VIRTIO_ID_BLOCK, PCI_SLOT);
+    g_assert(dev != NULL);
+    qvirtio_pci_device_enable(dev);
+    qvirtio_reset(&dev->vdev);
+    qvirtio_set_acknowledge(&dev->vdev);
+    qvirtio_set_driver(&dev->vdev);
+
+    features = qvirtio_get_features(&dev->vdev);
+    g_assert(features & (1u << VIRTIO_RING_F_INDIRECT_DESC));
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1u << VIRTIO_RING_F_EVENT_IDX) |
+                  (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    vq = qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+    g_assert_cmpint(vq->size, ==, QUEUE_SIZE);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    /* The tables never change, only their heads are made available again */
+    for (i = 0; i < NR_SMALL_REQS; i++) {
+        add_read(i, 1);
+    }
+    add_read(BIG_REQ, BIG_REQ_SECTORS);
+    avail_idx = 0;
+}
+
+static void blk_stop(void)
+{
+    qvirtqueue_cleanup(dev->vdev.bus, vq, qs->alloc);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+}
+
+/* Make requests @first to @first + @n - 1 available, kick once and wait */
+static void submit(int first, int n)
+{
+    uint64_t used_idx = vq->used + offsetof(struct vring_used, idx);
+    gint64 start_time = g_get_monotonic_time();
+    uint16_t ring[NR_REQS];
+    int i, idx, len;
+
+    for (i = 0; i < n; i++) {
+        ring[i] = cpu_to_le16(heads[first + i]);
+    }
+    for (i = 0; i < n; i += len) {
+        idx = (uint16_t)(avail_idx + i) % vq->size;
+        len = MIN(n - i, vq->size - idx);
+        memwrite(vq->avail + offsetof(struct vring_avail, ring) +
+                 idx * sizeof(ring[0]), &ring[i], len * sizeof(ring[0]));
+    }
+    avail_idx += n;
+    writew(vq->avail + offsetof(struct vring_avail, idx), avail_idx);
+    dev->vdev.bus->virtqueue_kick(&dev->vdev, vq);
+
+    while (readw(used_idx) != avail_idx) {
+        g_assert(g_get_monotonic_time() - start_time <= TIMEOUT_US);
+    }
+    vq->last_used_idx = avail_idx;
+}
+
+static void submit_checked(int first, int n)
+{
+    int i;
+
+    for (i = first; i < first + n; i++) {
+        writeb(status[i], 0xff);
+    }
+    submit(first, n);
+    for (i = first; i < first + n; i++) {
+        g_assert_cmpint(readb(status[i]), ==, VIRTIO_BLK_S_OK);
+    }
+}
+
+static void test_element_pool(void)
+{
+    int r;
+
+    blk_start();
+
+    /* Grow the pool to its limit, then reuse every slot */
+    for (r = 0; r < 3; r++) {
+        submit_checked(0, NR_SMALL_REQS);
+    }
+
+    /* Oversized elements come from malloc, alone or among pooled ones */
+    submit_checked(BIG_REQ, 1);
+    submit_checked(0, NR_REQS);
+    submit_checked(NR_SMALL_REQS - 1, 2);
+
+    blk_stop();
+}
+
+static void bench_element_pool(gconstpointer data)
+{
+    int depth = GPOINTER_TO_INT(data);
+    int rounds = 16384 / depth;
+    double elapsed;
+    int r;
+
+    blk_start();
+
+    /* Warm up, so that the pool has grown to @depth slots */
+    submit(0, depth);
+
+    g_test_timer_start();
+    for (r = 0; r < rounds; r++) {
+        submit(0, depth);
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("%d in flight: %.2f us per request (incl. qtest)",
+                   depth, elapsed * 1e6 / (rounds * depth));
+
+    blk_stop();
+}
+
+int main(int argc, char **argv)
+{
+    static const int depths[] = { 1, 16, NR_SMALL_REQS };
+    char *path;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtqueue/element-pool", test_element_pool);
+    if (g_test_perf()) {
+        for (i = 0; i < ARRAY_SIZE(depths); i++) {
+            path = g_strdup_printf("/virtqueue/bench/depth-%d", depths[i]);
+            qtest_add_data_func(path, GINT_TO_POINTER(depths[i]),
+                                bench_element_pool);
+            g_free(path);
+        }
+    }
+
+    return g_test_run();
+}
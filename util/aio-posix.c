@@ -520,7 +520,7 @@ static bool run_poll_handlers_once(AioContext *ctx)
 static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
 {
     bool progress;
-    int64_t end_time;
+    int64_t now, end_time;
 
     assert(ctx->notify_me);
     assert(qemu_lockcnt_count(&ctx->list_lock) > 0);
@@ -528,7 +528,9 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
 
     trace_run_poll_handlers_begin(ctx, max_ns);
 
-    end_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + max_ns;
+    /* Poll-forever mode can pass INT64_MAX */
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    end_time = max_ns < INT64_MAX - now ? now + max_ns : INT64_MAX;
 
     do {
         progress = run_poll_handlers_once(ctx);
@@ -539,6 +541,39 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
     return progress;
 }
 
+/* Period over which the poll-forever CPU budget is enforced */
+#define POLL_BUDGET_PERIOD_NS (10 * SCALE_MS)
+
+/* poll_forever_window:
+ * @ctx: the AioContext
+ * @now: current QEMU_CLOCK_REALTIME time
+ *
+ * Returns: how long a poll-forever AioContext may poll for, or 0 if the
+ * CPU budget for the current period has been used up
+ */
+static int64_t poll_forever_window(AioContext *ctx, int64_t now)
+{
+    int64_t window = ctx->poll_idle_ns ? ctx->poll_idle_ns : INT64_MAX;
+    int64_t budget_ns;
+
+    if (ctx->poll_budget >= 100) {
+        return window;
+    }
+
+    if (now - ctx->poll_period_start >= POLL_BUDGET_PERIOD_NS) {
+        ctx->poll_period_start = now;
+        ctx->poll_period_ns = 0;
+    }
+
+    budget_ns = POLL_BUDGET_PERIOD_NS * ctx->poll_budget / 100 -
+                ctx->poll_period_ns;
+    if (budget_ns <= 0) {
+        trace_poll_budget_exhausted(ctx, ctx->poll_period_ns);
+        return 0;
+    }
+    return MIN(window, budget_ns);
+}
+
 /* try_poll_mode:
  * @ctx: the AioContext
  * @blocking: busy polling is only attempted when blocking is true
@@ -551,15 +586,30 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
  */
 static bool try_poll_mode(AioContext *ctx, bool blocking)
 {
-    if (blocking && ctx->poll_max_ns && ctx->poll_disable_cnt == 0) {
+    if (blocking && (ctx->poll_max_ns || ctx->poll_forever) &&
+        ctx->poll_disable_cnt == 0) {
+        int64_t start = 0;
+        int64_t window = ctx->poll_ns;
+        int64_t max_ns;
+        bool progress;
+
+        if (ctx->poll_forever) {
+            start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            window = poll_forever_window(ctx, start);
+        }
+
         /* See qemu_soonest_timeout() uint64_t hack */
-        int64_t max_ns = MIN((uint64_t)aio_compute_timeout(ctx),
-                             (uint64_t)ctx->poll_ns);
+        max_ns = MIN((uint64_t)aio_compute_timeout(ctx), (uint64_t)window);
 
         if (max_ns) {
             poll_set_started(ctx, true);
 
-            if (run_poll_handlers(ctx, max_ns)) {
+            progress = run_poll_handlers(ctx, max_ns);
+            if (ctx->poll_forever) {
+                ctx->poll_period_ns +=
+                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+            }
+            if (progress) {
                 return true;
             }
         }
@@ -595,7 +645,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     qemu_lockcnt_inc(&ctx->list_lock);
 
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns && !ctx->poll_forever) {
         start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     }
 
@@ -635,7 +685,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     }
 
     /* Adjust polling time */
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns && !ctx->poll_forever) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
         if (block_ns <= ctx->poll_ns) {
@@ -726,3 +776,17 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 
     aio_notify(ctx);
 }
+
+void aio_context_set_poll_forever(AioContext *ctx, bool enable,
+                                  int64_t idle_ns, int64_t budget,
+                                  Error **errp)
+{
+    /* Same as aio_context_set_poll_params(), no synchronization needed */
+    ctx->poll_forever = enable;
+    ctx->poll_idle_ns = idle_ns;
+    ctx->poll_budget = budget;
+    ctx->poll_period_start = 0;
+    ctx->poll_period_ns = 0;
+
+    aio_notify(ctx);
+}
@@ -422,6 +422,9 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    ctx->poll_forever = false;
+    ctx->poll_idle_ns = 0;
+    ctx->poll_budget = 100;
 
     return ctx;
 fail:
@@ -32,6 +32,10 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 void strpadcpy(char *buf, int buf_size, const char *str, char pad)
 {
     int len = qemu_strnlen(str, buf_size);
@@ -146,6 +150,43 @@ int qemu_fdatasync(int fd)
 #endif
 }
 
+void qemu_memcpy_nontemporal(void *dst, const void *src, size_t len)
+{
+#ifdef __SSE2__
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t head = -(uintptr_t)d & 15;
+
+    if (len < head + 64) {
+        memcpy(dst, src, len);
+        return;
+    }
+
+    /* Streaming stores need an aligned destination */
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+
+    for (; len >= 64; len -= 64, d += 64, s += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)s);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+
+        _mm_stream_si128((__m128i *)d, v0);
+        _mm_stream_si128((__m128i *)(d + 16), v1);
+        _mm_stream_si128((__m128i *)(d + 32), v2);
+        _mm_stream_si128((__m128i *)(d + 48), v3);
+    }
+    /* Order the streaming stores before anything that publishes the data */
+    _mm_sfence();
+    memcpy(d, s, len);
+#else
+    memcpy(dst, src, len);
+#endif
+}
+
 /* Sets a specific flag */
 int fcntl_setfl(int fd, int flag)
 {
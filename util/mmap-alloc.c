@@ -82,6 +82,40 @@ void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared)
     return ptr1;
 }
 
+int64_t qemu_ram_thp_size(void *ptr, size_t size)
+{
+    uintptr_t start = (uintptr_t)ptr, end = start + size;
+    uintptr_t vma_start, vma_end;
+    unsigned long kb;
+    bool in_range = false;
+    int64_t total = 0;
+    char line[256];
+    FILE *f;
+
+    f = fopen("/proc/self/smaps", "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &vma_start, &vma_end) == 2) {
+            in_range = vma_start < end && vma_end > start;
+            continue;
+        }
+        if (in_range &&
+            (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+             sscanf(line, "ShmemPmdMapped: %lu kB", &kb) == 1 ||
+             sscanf(line, "FilePmdMapped: %lu kB", &kb) == 1)) {
+            /* A VMA can extend past the range; never report more than it */
+            total += MIN((uint64_t)kb * 1024,
+                         MIN(vma_end, end) - MAX(vma_start, start));
+        }
+    }
+    fclose(f);
+
+    return MIN(total, size);
+}
+
 void qemu_ram_munmap(void *ptr, size_t size)
 {
     if (ptr) {
@@ -38,8 +38,12 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
 
 #include <sys/syscall.h>
+#ifdef CONFIG_LINUX
+#include <sched.h>
+#endif
 
 #ifdef __FreeBSD__
 #include <sys/sysctl.h>
@@ -56,18 +60,43 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+/* Granularity of progress updates and of early exit after a failure */
+#define MEM_PREALLOC_CHUNK_SIZE (64 * 1024 * 1024)
+
+#if defined(CONFIG_LINUX) && !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+typedef struct MemsetThread MemsetThread;
+
 struct MemsetThread {
+    MemPrealloc *job;
     char *addr;
     size_t numpages;
-    size_t hpagesize;
     QemuThread pgthread;
-    sigjmp_buf env;
 };
-typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+struct MemPrealloc {
+    char *area;
+    size_t size;
+    size_t hpagesize;
+    bool populate_write;
+    bool failed;
+    size_t done;
+    int num_threads;
+    MemsetThread *threads;
+#ifdef CONFIG_LINUX
+    bool has_cpus;
+    cpu_set_t cpus;
+#endif
+};
+
+/* Set while a preallocation thread is touching pages */
+static __thread sigjmp_buf *memset_thread_env;
+
+/* Jobs that rely on SIGBUS and the handler they replaced */
+static int memset_sigbus_users;
+static struct sigaction memset_sigbus_oldact;
 
 int qemu_get_thread_id(void)
 {
@@ -247,34 +276,20 @@ char *qemu_get_exec_dir(void)
 
 static void sigbus_handler(int signal)
 {
-    int i;
-    if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
-            }
-        }
+    if (memset_thread_env) {
+        siglongjmp(*memset_thread_env, 1);
     }
 }
 
-static void *do_touch_pages(void *arg)
+static void touch_pages(MemPrealloc *job, char *addr, size_t numpages)
 {
-    MemsetThread *memset_args = (MemsetThread *)arg;
-    sigset_t set, oldset;
-
-    /* unblock SIGBUS */
-    sigemptyset(&set);
-    sigaddset(&set, SIGBUS);
-    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+    size_t chunk = MAX(MEM_PREALLOC_CHUNK_SIZE / job->hpagesize, 1);
 
-    if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
-    } else {
-        char *addr = memset_args->addr;
-        size_t numpages = memset_args->numpages;
-        size_t hpagesize = memset_args->hpagesize;
+    while (numpages && !atomic_read(&job->failed)) {
+        size_t n = MIN(numpages, chunk);
         size_t i;
-        for (i = 0; i < numpages; i++) {
+
+        for (i = 0; i < n; i++) {
             /*
              * Read & write back the same value, so we don't
              * corrupt existing user/app data that might be
@@ -282,15 +297,110 @@ static void *do_touch_pages(void *arg)
              *
              * 'volatile' to stop compiler optimizing this away
              * to a no-op
-             *
-             * TODO: get a better solution from kernel so we
-             * don't need to write at all so we don't cause
-             * wear on the storage backing the region...
              */
             *(volatile char *)addr = *addr;
-            addr += hpagesize;
+            addr += job->hpagesize;
         }
+        numpages -= n;
+        atomic_add(&job->done, n * job->hpagesize);
     }
+}
+
+#ifdef CONFIG_LINUX
+/*
+ * MADV_POPULATE_WRITE (Linux 5.14) faults the pages in without writing
+ * to them and reports failures as errors instead of SIGBUS.
+ */
+static void populate_pages(MemPrealloc *job, char *addr, size_t numpages)
+{
+    size_t chunk = MAX(MEM_PREALLOC_CHUNK_SIZE / job->hpagesize, 1);
+
+    while (numpages && !atomic_read(&job->failed)) {
+        size_t n = MIN(numpages, chunk);
+
+        if (madvise(addr, n * job->hpagesize, MADV_POPULATE_WRITE)) {
+            atomic_set(&job->failed, true);
+            break;
+        }
+        addr += n * job->hpagesize;
+        numpages -= n;
+        atomic_add(&job->done, n * job->hpagesize);
+    }
+}
+
+/*
+ * Populate the first page as a probe.  Any error, whether the kernel does
+ * not know the advice or the page could not be allocated, makes us touch
+ * the pages instead, which reports failures on its own.
+ */
+static bool madv_populate_write_possible(char *area, size_t pagesize)
+{
+    return !madvise(area, pagesize, MADV_POPULATE_WRITE);
+}
+
+/* Parse a sysfs cpulist such as "0-3,8-11" into @cpus. */
+static bool add_node_cpus(unsigned long node, cpu_set_t *cpus)
+{
+    char *path, *contents;
+    const char *p;
+    unsigned long first, last;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist", node);
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return false;
+    }
+    g_free(path);
+
+    p = contents;
+    while (qemu_strtoul(p, &p, 10, &first) == 0) {
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last)) {
+            break;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, cpus);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    g_free(contents);
+    return true;
+}
+#endif
+
+static void *do_touch_pages(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    MemPrealloc *job = memset_args->job;
+    sigjmp_buf env;
+    sigset_t set, oldset;
+
+#ifdef CONFIG_LINUX
+    /* Zero the pages from CPUs local to the node they are bound to */
+    if (job->has_cpus) {
+        sched_setaffinity(0, sizeof(job->cpus), &job->cpus);
+    }
+    if (job->populate_write) {
+        populate_pages(job, memset_args->addr, memset_args->numpages);
+        return NULL;
+    }
+#endif
+
+    /* unblock SIGBUS */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+
+    if (sigsetjmp(env, 1)) {
+        atomic_set(&job->failed, true);
+    } else {
+        memset_thread_env = &env;
+        touch_pages(job, memset_args->addr, memset_args->numpages);
+    }
+    memset_thread_env = NULL;
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
     return NULL;
 }
@@ -307,69 +417,120 @@ static inline int get_memset_num_threads(int smp_cpus)
     return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t memory,
+                                   int max_threads,
+                                   const unsigned long *host_nodes,
+                                   unsigned long max_node, Error **errp)
 {
-    size_t numpages_per_thread;
-    size_t size_per_thread;
+    MemPrealloc *job = g_new0(MemPrealloc, 1);
+    size_t numpages, numpages_per_thread;
     char *addr = area;
-    int i = 0;
-
-    memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = (numpages / memset_num_threads);
-    size_per_thread = (hpagesize * numpages_per_thread);
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
-                                    numpages : numpages_per_thread;
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
-                           QEMU_THREAD_JOINABLE);
-        addr += size_per_thread;
-        numpages -= numpages_per_thread;
+    int i;
+
+    job->area = area;
+    job->hpagesize = qemu_fd_getpagesize(fd);
+    numpages = DIV_ROUND_UP(memory, job->hpagesize);
+    job->size = numpages * job->hpagesize;
+    job->num_threads = get_memset_num_threads(max_threads);
+
+#ifdef CONFIG_LINUX
+    if (host_nodes) {
+        unsigned long node;
+
+        CPU_ZERO(&job->cpus);
+        for (node = find_first_bit(host_nodes, max_node); node < max_node;
+             node = find_next_bit(host_nodes, max_node, node + 1)) {
+            add_node_cpus(node, &job->cpus);
+        }
+        if (CPU_COUNT(&job->cpus)) {
+            job->has_cpus = true;
+            job->num_threads = MIN(MIN(CPU_COUNT(&job->cpus),
+                                       MAX_MEM_PREALLOC_THREAD_COUNT),
+                                   max_threads);
+        }
     }
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
+    job->populate_write = madv_populate_write_possible(area, job->hpagesize);
+#endif
+    job->num_threads = MAX(MIN(job->num_threads, numpages), 1);
+
+    if (!job->populate_write && !memset_sigbus_users) {
+        struct sigaction act;
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
+
+        if (sigaction(SIGBUS, &act, &memset_sigbus_oldact)) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            g_free(job);
+            return NULL;
+        }
+    }
+    if (!job->populate_write) {
+        memset_sigbus_users++;
     }
-    g_free(memset_thread);
-    memset_thread = NULL;
 
-    return memset_thread_failed;
+    trace_os_mem_prealloc_start(area, job->size, job->hpagesize,
+                                job->num_threads, job->populate_write);
+
+    /* touch pages simultaneously */
+    job->threads = g_new0(MemsetThread, job->num_threads);
+    numpages_per_thread = numpages / job->num_threads;
+    for (i = 0; i < job->num_threads; i++) {
+        MemsetThread *t = &job->threads[i];
+
+        t->job = job;
+        t->addr = addr;
+        t->numpages = (i == job->num_threads - 1) ?
+                      numpages : numpages_per_thread;
+        qemu_thread_create(&t->pgthread, "touch_pages", do_touch_pages, t,
+                           QEMU_THREAD_JOINABLE);
+        addr += numpages_per_thread * job->hpagesize;
+        numpages -= numpages_per_thread;
+    }
+    return job;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+void os_mem_prealloc_progress(MemPrealloc *job, size_t *done, size_t *total)
 {
-    int ret;
-    struct sigaction act, oldact;
-    size_t hpagesize = qemu_fd_getpagesize(fd);
-    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    *done = atomic_read(&job->done);
+    *total = job->size;
+}
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
+void os_mem_prealloc_finish(MemPrealloc *job, Error **errp)
+{
+    int i;
 
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
-        return;
+    for (i = 0; i < job->num_threads; i++) {
+        qemu_thread_join(&job->threads[i].pgthread);
     }
+    trace_os_mem_prealloc_finish(job->area, job->done, job->failed);
 
-    /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    if (job->failed) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    if (!job->populate_write && !--memset_sigbus_users) {
+        if (sigaction(SIGBUS, &memset_sigbus_oldact, NULL)) {
+            /* Terminate QEMU since it can't recover from error */
+            perror("os_mem_prealloc: failed to reinstall signal handler");
+            exit(1);
+        }
+    }
+    g_free(job->threads);
+    g_free(job);
+}
+
+void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     Error **errp)
+{
+    MemPrealloc *job;
+
+    job = os_mem_prealloc_start(fd, area, memory, smp_cpus, NULL, 0, errp);
+    if (job) {
+        os_mem_prealloc_finish(job, errp);
     }
 }
 
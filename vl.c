@@ -51,6 +51,7 @@
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/numa.h"
+#include "sysemu/hostmem.h"
 #include "exec/gdbstub.h"
 #include "qemu/timer.h"
 #include "chardev/char.h"
@@ -3715,6 +3716,9 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    /* Cold-plugged memory backends may still be preallocating. */
+    host_memory_backend_prealloc_wait_all(&error_fatal);
+
     cpu_synchronize_all_post_init();
 
     rom_reset_order_override();